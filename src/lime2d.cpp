@@ -52,20 +52,17 @@ l2d::Editor::Editor(bool enabled, sf::RenderWindow *window) :
     ImGui::SFML::Init(*window);
     this->_window = window;
 
-    auto tts = l2d_internal::utils::split(l2d_internal::utils::getConfigValue("tile_types"), ",");
-    for (const auto &tt : tts) {
-        auto v = l2d_internal::utils::split(tt, "|");
-        this->_tileTypes.emplace_back(v[0], l2d_internal::utils::getColor(v[1]));
-    }
-
-    this->_currentTileType = !this->_tileTypes.empty() ? this->_tileTypes[0] : l2d_internal::TileType::Default;
+    this->applyConfig(false);
     if (!this->_ambientLight.loadFromFile("content/shaders/ambient.frag", sf::Shader::Fragment)) {
         return;
     }
 }
 
 void l2d::Editor::toggle(std::string mapName, sf::Vector2f cameraPos) {
+    //A drag in progress won't see its button release once the editor is switched
+    this->_level.endEdit();
     this->_enabled = !this->_enabled;
+    this->clearShapeHandles();
     this->_level.loadMap(mapName);
     this->createGridLines(true);
     if (mapName != "l2dSTART") {
@@ -103,6 +100,47 @@ void l2d::Editor::nextTileType() {
     }(this->_currentTileType);
 }
 
+// std::string applyConfig
+// Brings the editor up to date with the config after it was saved or changed on disk.
+// The map is only reloaded if reloadMap is true, since that throws away unsaved changes.
+// Returns an error message, or an empty string if everything was applied
+std::string l2d::Editor::applyConfig(bool reloadMap) {
+    this->_tileTypes.clear();
+    auto tts = l2d_internal::utils::split(l2d_internal::Config::get().TileTypes, ",");
+    for (const auto &tt : tts) {
+        auto v = l2d_internal::utils::split(tt, "|");
+        if (v.size() >= 2) {
+            this->_tileTypes.emplace_back(v[0], l2d_internal::utils::getColor(v[1]));
+        }
+    }
+    this->_currentTileType = !this->_tileTypes.empty() ? this->_tileTypes[0] : l2d_internal::TileType::Default;
+
+    if (reloadMap && this->_level.isLoaded()) {
+        std::string name = this->_level.getName();
+        this->clearShapeHandles();
+        std::string error = this->_level.loadMap(name);
+        if (error.length() > 0) {
+            return error;
+        }
+    }
+    this->createGridLines(true);
+    return "";
+}
+
+// void clearShapeHandles
+// Lets go of every shape the editor holds on to. Called before another map is loaded, since the level
+// can only reuse the memory of the old map's shapes once nothing refers to them anymore
+void l2d::Editor::clearShapeHandles() {
+    this->_selectedShape = nullptr;
+    this->_rightClickedShape = nullptr;
+    this->_selectedEntityRectangle = nullptr;
+    this->_originalSelectedEntityRectangle = nullptr;
+    this->_selectedEntityPoint = nullptr;
+    this->_originalSelectedEntityPoint = nullptr;
+    this->_selectedEntityLine = nullptr;
+    this->_originalSelectedEntityLine = nullptr;
+}
+
 void l2d::Editor::processEvent(sf::Event &event) {
     if (this->_enabled) {
         ImGui::SFML::ProcessEvent(event);
@@ -113,6 +151,19 @@ void l2d::Editor::processEvent(sf::Event &event) {
                 break;
             case sf::Event::LostFocus:
                 this->_windowHasFocus = false;
+                //The button release of a drag may go to another window, so the stroke ends here
+                this->_level.endEdit();
+                break;
+            case sf::Event::MouseButtonPressed:
+                //Everything edited while the left button is held down is undone as one step
+                if (event.mouseButton.button == sf::Mouse::Left) {
+                    this->_level.beginEdit();
+                }
+                break;
+            case sf::Event::MouseButtonReleased:
+                if (event.mouseButton.button == sf::Mouse::Left) {
+                    this->_level.endEdit();
+                }
                 break;
             case sf::Event::KeyReleased:
                 switch (event.key.code) {
@@ -222,51 +273,52 @@ void l2d::Editor::render() {
             this->_ambientLight.setUniform("intensity", this->_level.getAmbientIntensity());
             this->_level.draw(&this->_ambientLight);
             if (this->_showGridLines) {
-                for (auto &t : this->_gridLines) {
-                    this->_graphics->draw(t.data(), 2, sf::Lines);
+                if (this->_graphics->getViewBounds() != this->_gridLinesView) {
+                    this->createGridLines(true);
+                }
+                if (this->_gridLines.getVertexCount() > 0) {
+                    this->_graphics->draw(&this->_gridLines[0], static_cast<unsigned int>(this->_gridLines.getVertexCount()), sf::Lines,
+                                          sf::RenderStates::Default, l2d_internal::Graphics::OVERLAY_LAYER);
                 }
                 if (this->_currentDrawShape == l2d_internal::DrawShapes::None &&
-                    this->_currentMapEditorMode == l2d_internal::MapEditorMode::Tile) {
+                    (this->_currentMapEditorMode == l2d_internal::MapEditorMode::Tile ||
+                     this->_currentMapEditorMode == l2d_internal::MapEditorMode::TileType)) {
                     //Get the mouse position and draw a square around the correct grid tile
                     sf::Vector2f mousePos = getMousePos();
 
 
                     if (mousePos.x >= 0 && mousePos.x <= (this->_level.getSize().x * this->_level.getTileSize().x *
-                                                          std::stof(
-                                                                  l2d_internal::utils::getConfigValue("tile_scale_x")) -
+                                                          l2d_internal::Config::get().TileScale.x -
                                                           1) &&
                         mousePos.y >= 0 && mousePos.y <= (this->_level.getSize().y * this->_level.getTileSize().y *
-                                                          std::stof(
-                                                                  l2d_internal::utils::getConfigValue("tile_scale_y")) -
+                                                          l2d_internal::Config::get().TileScale.y -
                                                           1)) {
                         sf::RectangleShape rectangle;
                         rectangle.setSize(sf::Vector2f(this->_level.getTileSize().x *
-                                                       std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) -
+                                                       l2d_internal::Config::get().TileScale.x -
                                                        1,
                                                        this->_level.getTileSize().y *
-                                                       std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) -
+                                                       l2d_internal::Config::get().TileScale.y -
                                                        1));
                         rectangle.setOutlineColor(this->_eraserActive ? sf::Color::Blue : sf::Color::Magenta);
                         rectangle.setOutlineThickness(2);
                         rectangle.setPosition(
                                 std::floor(mousePos.x - ((int) mousePos.x % (int) (this->_level.getTileSize().x *
-                                                                                   std::stof(
-                                                                                           l2d_internal::utils::getConfigValue(
-                                                                                                   "tile_scale_x"))))),
+                                                                                   l2d_internal::Config::get().TileScale.x))),
                                 std::floor(mousePos.y - ((int) mousePos.y % (int) (this->_level.getTileSize().y *
-                                                                                   std::stof(
-                                                                                           l2d_internal::utils::getConfigValue(
-                                                                                                   "tile_scale_y"))))));
+                                                                                   l2d_internal::Config::get().TileScale.y))));
                         rectangle.setFillColor(sf::Color::Transparent);
-                        this->_window->draw(rectangle);
+                        this->_graphics->draw(rectangle);
                     }
                 }
             }
+            //Draw the tile type overlay
+            if (this->_currentMapEditorMode == l2d_internal::MapEditorMode::TileType) {
+                this->_level.drawTileTypes(this->_tileTypes);
+            }
             //Draw shapes
             if (!this->_hideShapes) {
-                for (std::shared_ptr<l2d_internal::Shape> shape : this->_level.getShapeList()) {
-                    shape.get()->draw(this->_window);
-                }
+                this->_level.drawShapes();
             }
         }
 
@@ -278,7 +330,7 @@ void l2d::Editor::render() {
         rectangle.setPosition(0 + cameraOffset.x,
                               (this->_window->getSize().y / (this->_graphics->getZoomPercentage() / 100.0f)) - (30 / (this->_graphics->getZoomPercentage() / 100.0f)) +
                               cameraOffset.y);
-        this->_window->draw(rectangle);
+        this->_graphics->draw(rectangle);
 
         //Shape creation
         //Rectangles
@@ -312,11 +364,11 @@ void l2d::Editor::render() {
                         //Check rectangle bounds to make sure it is not drawn outside of the map
                         mousePos.x = std::max(0.0f, mousePos.x);
                         mousePos.x = std::min(this->_level.getSize().x *
-                                              std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) *
+                                              l2d_internal::Config::get().TileScale.x *
                                               this->_level.getTileSize().x, mousePos.x);
                         mousePos.y = std::max(0.0f, mousePos.y);
                         mousePos.y = std::min(this->_level.getSize().y *
-                                              std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) *
+                                              l2d_internal::Config::get().TileScale.y *
                                               this->_level.getTileSize().y, mousePos.y);
 
 
@@ -329,14 +381,14 @@ void l2d::Editor::render() {
                         rect.setOutlineColor(sf::Color(0, 0, 0, 160));
                         started = true;
 
-                        this->_window->draw(rect); //Temporarily draw the box while it's being created
+                        this->_graphics->draw(rect); //Temporarily draw the box while it's being created
                     } else {
                         this->_currentEvent = sf::Event();
                     }
                 }
                 if (this->_currentEvent.type == sf::Event::MouseButtonPressed &&
                     this->_currentEvent.mouseButton.button == sf::Mouse::Left && started) {
-                    this->_level.addShape(std::make_shared<l2d_internal::Rectangle>("Rectangle", sf::Color::White,
+                    this->_level.addShape(this->_level.makeShape<l2d_internal::Rectangle>("Rectangle", sf::Color::White,
                                                                                     l2d_internal::ObjectTypes::Other,
                                                                                     rect));
                     this->_currentEvent = sf::Event();
@@ -355,18 +407,18 @@ void l2d::Editor::render() {
                         mousePos = getMousePos();
                         mousePos.x = std::max(0.0f, mousePos.x);
                         mousePos.x = std::min(this->_level.getSize().x *
-                                              std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) *
+                                              l2d_internal::Config::get().TileScale.x *
                                               this->_level.getTileSize().x, mousePos.x);
                         mousePos.y = std::max(0.0f, mousePos.y);
                         mousePos.y = std::min(this->_level.getSize().y *
-                                              std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) *
+                                              l2d_internal::Config::get().TileScale.y *
                                               this->_level.getTileSize().y, mousePos.y);
                         dot.setRadius(DOT_RADIUS);
                         dot.setPosition(sf::Vector2f(mousePos.x - DOT_RADIUS, mousePos.y - DOT_RADIUS));
                         dot.setFillColor(sf::Color(0, 0, 255, 80));
                         dot.setOutlineColor(sf::Color(0, 0, 255, 160));
                         dot.setOutlineThickness(2.0f);
-                        this->_level.addShape(std::make_shared<l2d_internal::Point>("Point", sf::Color::Blue, dot));
+                        this->_level.addShape(this->_level.makeShape<l2d_internal::Point>("Point", sf::Color::Blue, dot));
                         this->_currentEvent = sf::Event();
                         this->_currentDrawShape = l2d_internal::DrawShapes::None;
                         this->_menuClicks = 0;
@@ -415,11 +467,11 @@ void l2d::Editor::render() {
                             mousePos = getMousePos();
                             mousePos.x = std::max(0.0f, mousePos.x);
                             mousePos.x = std::min(this->_level.getSize().x *
-                                                  std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) *
+                                                  l2d_internal::Config::get().TileScale.x *
                                                   this->_level.getTileSize().x, mousePos.x);
                             mousePos.y = std::max(0.0f, mousePos.y);
                             mousePos.y = std::min(this->_level.getSize().y *
-                                                  std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) *
+                                                  l2d_internal::Config::get().TileScale.y *
                                                   this->_level.getTileSize().y, mousePos.y);
                             sf::CircleShape c;
                             c.setRadius(6.0f);
@@ -427,7 +479,7 @@ void l2d::Editor::render() {
                             c.setFillColor(sf::Color(0, 180, 0, 80));
                             c.setOutlineColor(sf::Color(0, 180, 0, 160));
                             c.setOutlineThickness(2.0f);
-                            points.push_back(std::make_shared<l2d_internal::Point>("p" + std::to_string((points.size() + 1)), sf::Color(0, 255, 0), c));
+                            points.push_back(this->_level.makeShape<l2d_internal::Point>("p" + std::to_string((points.size() + 1)), sf::Color(0, 255, 0), c));
                             this->_currentEvent = sf::Event();
                         } else {
                             this->_currentEvent = sf::Event();
@@ -436,7 +488,7 @@ void l2d::Editor::render() {
                     if (this->_currentEvent.mouseButton.button == sf::Mouse::Right) {
                         if (points.size() >= 2) {
                             //Save the line!
-                            this->_level.addShape(std::make_shared<l2d_internal::Line>("Line", sf::Color::White, points));
+                            this->_level.addShape(this->_level.makeShape<l2d_internal::Line>("Line", sf::Color::White, points));
                         }
                         points.clear();
                         this->_currentEvent = sf::Event();
@@ -454,40 +506,34 @@ void l2d::Editor::render() {
                 //Check the mouse pos and determine if it is inside a shape.
                 sf::Vector2f mousePos = getMousePos();
                 bool sel = false;
-                auto shapes = this->_level.getShapeList();
-                for (int i = this->_level.getShapeList().size() - 1; i >= 0; --i) {
-                    if (shapes[i]->isPointInside(mousePos)) {
-                        if (shapes[i] == this->_selectedShape) {
-                            this->_lastFrameMousePos = sf::Vector2f(0.0f, 0.0f);
-                        }
+                //The front-most shape under the mouse, found through the level's shape index
+                std::shared_ptr<l2d_internal::Shape> hit = this->_level.getShapeAt(mousePos);
+                if (hit != nullptr) {
+                    if (hit == this->_selectedShape) {
+                        this->_lastFrameMousePos = sf::Vector2f(0.0f, 0.0f);
+                    }
 
-                        //Check if line. If so, use mousePos to figure out which point is selected
-                        //and return it. Use that point for _selectedShape.
-                        std::shared_ptr<l2d_internal::Shape> shape = nullptr;
-                        auto l = std::dynamic_pointer_cast<l2d_internal::Line>(shapes[i]);
-                        if (l != nullptr) {
-                            shape = l->getSelectedPoint(mousePos);
-                        } else {
-                            shape = shapes[i];
-                        }
-                        shape->select();
-                        sel = true;
-                        this->_selectedShape = shape;
-                        for (auto &t : this->_level.getShapeList()) {
-                            if (shape != t) {
-                                t->unselect();
-                            }
-                        }
-                        //Left click on a shape
-                        if (this->_currentEvent.mouseButton.button == sf::Mouse::Left) {
-                            break;
-                        }
-                            //Right click on a shape
-                        else if (this->_currentEvent.mouseButton.button == sf::Mouse::Right) {
-                            this->_removingShape = true;
-                            break;
+                    //Check if line. If so, use mousePos to figure out which point is selected
+                    //and return it. Use that point for _selectedShape.
+                    std::shared_ptr<l2d_internal::Shape> shape = nullptr;
+                    auto l = std::dynamic_pointer_cast<l2d_internal::Line>(hit);
+                    if (l != nullptr) {
+                        shape = l->getSelectedPoint(mousePos);
+                    } else {
+                        shape = hit;
+                    }
+                    shape->select();
+                    sel = true;
+                    this->_selectedShape = shape;
+                    for (auto &t : this->_level.getShapeList()) {
+                        if (shape != t) {
+                            t->unselect();
                         }
                     }
+                    //Right click on a shape
+                    if (this->_currentEvent.mouseButton.button == sf::Mouse::Right) {
+                        this->_removingShape = true;
+                    }
                 }
                 //If user clicked but none were selected, unselect all shapes
                 if (!sel) {
@@ -498,37 +544,69 @@ void l2d::Editor::render() {
                 }
             }
         }
+        this->_graphics->flush();
         ImGui::Render();
     }
 }
 
+// void createGridLines
+// Builds the grid for the part of the level that is currently in view as a single line list.
+// When zoomed out far enough that the lines would be only a few pixels apart, every 2nd, 4th, 8th... line is kept instead.
 void l2d::Editor::createGridLines(bool always) {
     if (this->_level.isLoaded() && (this->_currentFeature == l2d_internal::Features::Map || always)) {
         this->_gridLines.clear();
-        std::array<sf::Vertex, 2> line;
+        this->_gridLines.setPrimitiveType(sf::Lines);
+        const sf::FloatRect view = this->_graphics->getViewBounds();
+        this->_gridLinesView = view;
+
+        const float tileWidth = this->_level.getTileSize().x * l2d_internal::Config::get().TileScale.x;
+        const float tileHeight = this->_level.getTileSize().y * l2d_internal::Config::get().TileScale.y;
+        const int columns = this->_level.getSize().x;
+        const int rows = this->_level.getSize().y;
+        if (tileWidth <= 0 || tileHeight <= 0 || view.width <= 0 || view.height <= 0) {
+            return;
+        }
+
+        //Thin out the grid so lines are at least minSpacing pixels apart on screen
+        const float minSpacing = 8.0f;
+        const float pixelsPerUnit = this->_window->getSize().x / view.width;
+        int step = 1;
+        while (step < std::max(columns, rows) && std::min(tileWidth, tileHeight) * step * pixelsPerUnit < minSpacing) {
+            step *= 2;
+        }
+
+        //Visible part of the level
+        const float left = std::max(0.0f, view.left);
+        const float top = std::max(0.0f, view.top);
+        const float right = std::min(columns * tileWidth, view.left + view.width);
+        const float bottom = std::min(rows * tileHeight, view.top + view.height);
+        if (left > right || top > bottom) {
+            return;
+        }
+
+        static auto visibleLines = [](float from, float to, float size, int count, int step) -> std::vector<int> {
+            std::vector<int> lines;
+            int first = std::max(0, static_cast<int>(std::floor(from / size)) / step * step);
+            int last = std::min(count, static_cast<int>(std::ceil(to / size)));
+            for (int i = first; i <= last; i += step) {
+                lines.push_back(i);
+            }
+            //Always keep the edge of the map
+            if (last == count && (lines.empty() || lines.back() != count)) {
+                lines.push_back(count);
+            }
+            return lines;
+        };
+
         //Horizontal lines
-        for (int i = 0; i < this->_level.getSize().y + 1; ++i) {
-            line = {
-                    sf::Vertex(sf::Vector2f(0, i * (this->_level.getTileSize().y * std::stof(
-                            l2d_internal::utils::getConfigValue("tile_scale_y"))))),
-                    sf::Vertex(sf::Vector2f(this->_level.getSize().x * this->_level.getTileSize().x *
-                                            std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")),
-                                            i * (this->_level.getTileSize().y *
-                                                 std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")))))
-            };
-            this->_gridLines.push_back(line);
+        for (int i : visibleLines(top, bottom, tileHeight, rows, step)) {
+            this->_gridLines.append(sf::Vertex(sf::Vector2f(left, i * tileHeight)));
+            this->_gridLines.append(sf::Vertex(sf::Vector2f(right, i * tileHeight)));
         }
         //Vertical lines
-        for (int i = 0; i < this->_level.getSize().x + 1; ++i) {
-            line = {
-                    sf::Vertex(sf::Vector2f(i * (this->_level.getTileSize().x * std::stof(
-                            l2d_internal::utils::getConfigValue("tile_scale_x"))), 0)),
-                    sf::Vertex(sf::Vector2f(i * this->_level.getTileSize().x *
-                                            std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")),
-                                            this->_level.getSize().y * (this->_level.getTileSize().y *
-                                                                        std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")))))
-            };
-            this->_gridLines.push_back(line);
+        for (int i : visibleLines(left, right, tileWidth, columns, step)) {
+            this->_gridLines.append(sf::Vertex(sf::Vector2f(i * tileWidth, top)));
+            this->_gridLines.append(sf::Vertex(sf::Vector2f(i * tileWidth, bottom)));
         }
     }
 }
@@ -560,13 +638,12 @@ void l2d::Editor::update(sf::Time t) {
         static bool shapeColorWindowVisible = false;
         static bool entityPropertiesLoaded = false;
         static bool cbHideShapes = false;
+        static bool cbChunkCache = false;
         static bool configureMapWindowVisible = false;
         static bool cbShowConsole = false;
         static bool newTileTypeColorWindowVisible = false;
         static bool editExistingTileTypeColorWindowVisible = false;
 
-        static std::shared_ptr<l2d_internal::Shape> rightClickedShape = nullptr;
-
         static sf::Vector2f mousePos(0.0f, 0.0f);
 
         static std::string currentFeature = "Lime2D";
@@ -586,25 +663,13 @@ void l2d::Editor::update(sf::Time t) {
         static ImVec4 newEditExistingTileTypeColor;
         static std::string editExistingTileTypeColorName = "";
 
-        static std::string typeStr = l2d_internal::utils::getConfigValue("tile_types");
+        static std::string typeStr = l2d_internal::Config::get().TileTypes;
         static std::vector<std::string> typeList = l2d_internal::utils::split(typeStr, ",");
 
         //Entity list variables
         static ImVec4 selectedEntityColor = sf::Color::White;
         static int selectedEntitySelectedObjectTypeIndex = -1;
 
-        //Rectangle
-        static std::shared_ptr<l2d_internal::Rectangle> selectedEntityRectangle;
-        static std::shared_ptr<l2d_internal::Rectangle> originalSelectedEntityRectangle;
-
-        //Point
-        static std::shared_ptr<l2d_internal::Point> selectedEntityPoint;
-        static std::shared_ptr<l2d_internal::Point> originalSelectedEntityPoint;
-
-        //Line
-        static std::shared_ptr<l2d_internal::Line> selectedEntityLine;
-        static std::shared_ptr<l2d_internal::Line> originalSelectedEntityLine;
-
         //Custom properties
         static std::vector<l2d_internal::CustomProperty> customProperties;
 
@@ -657,12 +722,12 @@ void l2d::Editor::update(sf::Time t) {
 
         //Clear all of the selected entity objects
         static auto clearSelectedEntityObjects = [&]() {
-            selectedEntityRectangle = nullptr;
-            originalSelectedEntityRectangle = nullptr;
-            selectedEntityPoint = nullptr;
-            originalSelectedEntityPoint = nullptr;
-            selectedEntityLine = nullptr;
-            originalSelectedEntityLine = nullptr;
+            this->_selectedEntityRectangle = nullptr;
+            this->_originalSelectedEntityRectangle = nullptr;
+            this->_selectedEntityPoint = nullptr;
+            this->_originalSelectedEntityPoint = nullptr;
+            this->_selectedEntityLine = nullptr;
+            this->_originalSelectedEntityLine = nullptr;
         };
 
         //Set mainHasFocus (very important)
@@ -676,7 +741,43 @@ void l2d::Editor::update(sf::Time t) {
         //Config window
         if (configWindowVisible) {
             this->_currentWindowType = l2d_internal::WindowTypes::ConfigWindow;
-            static bool loaded = false;
+            l2d_internal::Config &config = l2d_internal::Config::get();
+            static char mapPath[500] = "";
+            static char tilesetPath[500] = "";
+            static float spriteScaleX = 1.0f;
+            static float spriteScaleY = 1.0f;
+            static float tileScaleX = 1.0f;
+            static float tileScaleY = 1.0f;
+            static int screenSizeX = 1;
+            static int screenSizeY = 1;
+            static char spritePath[500] = "";
+            static char animationPath[500] = "";
+            static float cameraPanFactor = 4.0f;
+            static int mapEncodingIndex = 0;
+            static const l2d_internal::MapData::TileEncoding mapEncodings[] = {
+                    l2d_internal::MapData::TileEncoding::Verbose, l2d_internal::MapData::TileEncoding::Csv,
+                    l2d_internal::MapData::TileEncoding::Base64, l2d_internal::MapData::TileEncoding::Base64Zlib
+            };
+            static const char* mapEncodingNames[] = { "One element per tile", "CSV", "Base64", "Base64 + zlib" };
+            //Fill the fields from the config whenever it was loaded or saved since they were last filled
+            static unsigned int loadedVersion = 0;
+            if (loadedVersion != config.getVersion()) {
+                strcpy(mapPath, config.MapPath.c_str());
+                strcpy(tilesetPath, config.TilesetPath.c_str());
+                spriteScaleX = config.SpriteScale.x;
+                spriteScaleY = config.SpriteScale.y;
+                tileScaleX = config.TileScale.x;
+                tileScaleY = config.TileScale.y;
+                screenSizeX = config.ScreenSize.x;
+                screenSizeY = config.ScreenSize.y;
+                strcpy(spritePath, config.SpritePath.c_str());
+                strcpy(animationPath, config.AnimationPath.c_str());
+                cameraPanFactor = config.CameraPanFactor;
+                mapEncodingIndex = static_cast<int>(std::find(std::begin(mapEncodings), std::end(mapEncodings),
+                        l2d_internal::MapData::getTileEncoding(config.MapEncoding)) - std::begin(mapEncodings));
+                typeList = l2d_internal::utils::split(config.TileTypes, ",");
+                loadedVersion = config.getVersion();
+            }
 
             ImGui::SetNextWindowPosCenter();
             ImGui::SetNextWindowSize(ImVec2(480, 380));
@@ -685,10 +786,6 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureMapPath");
             ImGui::Text("Map path");
-            static char mapPath[500] = "";
-            if (!l2d_internal::utils::getConfigValue("map_path").empty() && !loaded) {
-                strcpy(mapPath, l2d_internal::utils::getConfigValue("map_path").c_str());
-            }
             ImGui::PushItemWidth(300);
             ImGui::InputText("", mapPath, 500);
             ImGui::PopItemWidth();
@@ -697,10 +794,6 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureTilesetPath");
             ImGui::Text("Tileset path");
-            static char tilesetPath[500] = "";
-            if (!l2d_internal::utils::getConfigValue("tileset_path").empty() && !loaded) {
-                strcpy(tilesetPath, l2d_internal::utils::getConfigValue("tileset_path").c_str());
-            }
             ImGui::PushItemWidth(300);
             ImGui::InputText("", tilesetPath, 500);
             ImGui::PopItemWidth();
@@ -711,8 +804,6 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureSpriteScale");
             ImGui::Text("Sprite scale");
-            static float spriteScaleX = l2d_internal::utils::getConfigValue("sprite_scale_x").empty() ? 1.0f : std::stof(l2d_internal::utils::getConfigValue("sprite_scale_x"));
-            static float spriteScaleY = l2d_internal::utils::getConfigValue("sprite_scale_y").empty() ? 1.0f : std::stof(l2d_internal::utils::getConfigValue("sprite_scale_y"));
             ImGui::InputFloat("x", &spriteScaleX, 0.1f, 0.0f, 2);
             ImGui::InputFloat("y", &spriteScaleY, 0.1f, 0.0f, 2);
             ImGui::Separator();
@@ -720,8 +811,6 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureTileScale");
             ImGui::Text("Tile scale");
-            static float tileScaleX = l2d_internal::utils::getConfigValue("tile_scale_x").empty() ? 1.0f : std::stof(l2d_internal::utils::getConfigValue("tile_scale_x"));
-            static float tileScaleY = l2d_internal::utils::getConfigValue("tile_scale_y").empty() ? 1.0f : std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"));
             ImGui::InputFloat("x", &tileScaleX, 0.1f, 0.0f, 2);
             ImGui::InputFloat("y", &tileScaleY, 0.1f, 0.0f, 2);
             ImGui::Separator();
@@ -729,8 +818,6 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureScreenSize");
             ImGui::Text("Screen size");
-            static int screenSizeX = l2d_internal::utils::getConfigValue("screen_size_x").empty() ? 1 : std::stoi(l2d_internal::utils::getConfigValue("screen_size_x"));
-            static int screenSizeY = l2d_internal::utils::getConfigValue("screen_size_y").empty() ? 1 : std::stoi(l2d_internal::utils::getConfigValue("screen_size_y"));
             ImGui::InputInt("x", &screenSizeX, 5);
             ImGui::InputInt("y", &screenSizeY, 5);
             ImGui::Separator();
@@ -738,10 +825,6 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureSpritesPath");
             ImGui::Text("Sprite path");
-            static char spritePath[500] = "";
-            if (!l2d_internal::utils::getConfigValue("sprite_path").empty() && !loaded) {
-                strcpy(spritePath, l2d_internal::utils::getConfigValue("sprite_path").c_str());
-            }
             ImGui::PushItemWidth(300);
             ImGui::InputText("", spritePath, 500);
             ImGui::PopItemWidth();
@@ -750,10 +833,6 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureAnimationPath");
             ImGui::Text("Animation path");
-            static char animationPath[500] = "";
-            if (!l2d_internal::utils::getConfigValue("animation_path").empty() && !loaded) {
-                strcpy(animationPath, l2d_internal::utils::getConfigValue("animation_path").c_str());
-            }
             ImGui::PushItemWidth(300);
             ImGui::InputText("", animationPath, 500);
             ImGui::PopItemWidth();
@@ -762,12 +841,18 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::PushID("ConfigureCameraPanAmount");
             ImGui::Text("Camera pan factor");
-            static float cameraPanFactor =
-                    l2d_internal::utils::getConfigValue("camera_pan_factor").empty() ? 4.0f : std::stof(l2d_internal::utils::getConfigValue("camera_pan_factor"));
             ImGui::InputFloat("", &cameraPanFactor, 0.25f, 0.0f, 2);
             ImGui::Separator();
             ImGui::PopID();
 
+            ImGui::PushID("ConfigureMapEncoding");
+            ImGui::Text("Tile layer encoding in map files");
+            ImGui::PushItemWidth(300);
+            ImGui::Combo("", &mapEncodingIndex, mapEncodingNames, IM_ARRAYSIZE(mapEncodingNames));
+            ImGui::PopItemWidth();
+            ImGui::Separator();
+            ImGui::PopID();
+
             ImGui::PushID("ConfigureTileTypes");
             ImGui::Text("Tile types");
 
@@ -852,46 +937,24 @@ void l2d::Editor::update(sf::Time t) {
                 } else {
                     configureMapErrorText = "";
                     //Everything checks out, so save.
-                    std::ofstream os("lime2d.config");
-                    if (os.is_open()) {
-                        os << "map_path=" << mapPath << "\n";
-                        os << "tileset_path=" << tilesetPath << "\n";
-                        os << "sprite_scale_x=" << spriteScaleX << "\n";
-                        os << "sprite_scale_y=" << spriteScaleY << "\n";
-                        os << "tile_scale_x=" << tileScaleX << "\n";
-                        os << "tile_scale_y=" << tileScaleY << "\n";
-                        os << "screen_size_x=" << screenSizeX << "\n";
-                        os << "screen_size_y=" << screenSizeY << "\n";
-                        os << "sprite_path=" << spritePath << "\n";
-                        os << "animation_path=" << animationPath << "\n";
-                        os << "camera_pan_factor=" << cameraPanFactor << "\n";
-                        os << "tile_types=" << ss.str() << "\n";
-                        os.close();
-                        if (this->_level.isLoaded()) {
-                            std::string name = this->_level.getName();
-                            configureMapErrorText = this->_level.loadMap(name);
-                            if (configureMapErrorText.length() <= 0) {
-                                createGridLines();
-                                this->_currentWindowType = l2d_internal::WindowTypes::None;
-                                configWindowVisible = false;
-                                startStatusTimer("Configurations saved successfully!", 200);
-
-                                auto tts = l2d_internal::utils::split(l2d_internal::utils::getConfigValue("tile_types"), ",");
-                                for (const auto &tt : tts) {
-                                    auto v = l2d_internal::utils::split(tt, "|");
-                                    this->_tileTypes.emplace_back(v[0], l2d_internal::utils::getColor(v[1]));
-                                }
-
-                                this->_currentTileType = this->_tileTypes.size() > 0 ? this->_tileTypes[0] : l2d_internal::TileType::Default;
-                                this->nextTileType();
-                            }
-                        } else {
-                            this->_currentWindowType = l2d_internal::WindowTypes::None;
-                            configWindowVisible = false;
-                            startStatusTimer("Configurations saved successfully!", 200);
-                        }
-                    } else {
-                        configureMapErrorText = "Unable to save file. Please refer to www.limeoats.com/lime2d for more information.";
+                    config.MapPath = mapPath;
+                    config.TilesetPath = tilesetPath;
+                    config.SpriteScale = sf::Vector2f(spriteScaleX, spriteScaleY);
+                    config.TileScale = sf::Vector2f(tileScaleX, tileScaleY);
+                    config.ScreenSize = sf::Vector2i(screenSizeX, screenSizeY);
+                    config.SpritePath = spritePath;
+                    config.AnimationPath = animationPath;
+                    config.CameraPanFactor = cameraPanFactor;
+                    config.MapEncoding = l2d_internal::MapData::getTileEncodingName(mapEncodings[mapEncodingIndex]);
+                    config.TileTypes = ss.str();
+                    configureMapErrorText = config.save();
+                    if (configureMapErrorText.length() <= 0) {
+                        configureMapErrorText = this->applyConfig(true);
+                    }
+                    if (configureMapErrorText.length() <= 0) {
+                        this->_currentWindowType = l2d_internal::WindowTypes::None;
+                        configWindowVisible = false;
+                        startStatusTimer("Configurations saved successfully!", 200);
                     }
                 }
             }
@@ -900,6 +963,8 @@ void l2d::Editor::update(sf::Time t) {
                 this->_currentWindowType = l2d_internal::WindowTypes::None;
                 configWindowVisible = false;
                 configureMapErrorText = "";
+                //Throw away the edits so the window shows the saved config next time
+                loadedVersion = 0;
             }
             ImGui::Text("%s", configureMapErrorText.c_str());
 
@@ -912,7 +977,6 @@ void l2d::Editor::update(sf::Time t) {
             cameraPanFactor = std::max(0.0f, cameraPanFactor);
 
             ImGui::End();
-            loaded = true;
         }
 
         //About box
@@ -939,7 +1003,7 @@ void l2d::Editor::update(sf::Time t) {
             this->_currentWindowType = l2d_internal::WindowTypes::MapSelectWindow;
             std::string mapSelectErrorMessage = "";
             std::stringstream ss;
-            ss << l2d_internal::utils::getConfigValue("map_path");
+            ss << l2d_internal::Config::get().MapPath;
             std::vector<const char *> mapFiles = l2d_internal::utils::getFilesInDirectory(ss.str());
             ImGui::SetNextWindowPosCenter();
             ImGui::SetNextWindowSize(ImVec2(500, 270));
@@ -953,6 +1017,7 @@ void l2d::Editor::update(sf::Time t) {
                 //Get the name of the file
                 std::vector<std::string> fullNameSplit = l2d_internal::utils::split(mapFiles[mapSelectIndex], '/');
                 std::vector<std::string> fileNameSplit = l2d_internal::utils::split(fullNameSplit.back(), '.');
+                this->clearShapeHandles();
                 mapSelectErrorMessage = this->_level.loadMap(fileNameSplit.front());
                 if (mapSelectErrorMessage.length() <= 0) {
                     createGridLines();
@@ -1014,13 +1079,14 @@ void l2d::Editor::update(sf::Time t) {
                 } else {
                     //Check if map with that name already exists. If so, give a box asking to overwrite
                     std::stringstream ss;
-                    ss << l2d_internal::utils::getConfigValue("map_path");
+                    ss << l2d_internal::Config::get().MapPath;
                     std::vector<const char *> mapFiles = l2d_internal::utils::getFilesInDirectory(ss.str());
                     ss.str("");
-                    ss << l2d_internal::utils::getConfigValue("map_path") << name << ".xml";
+                    ss << l2d_internal::Config::get().MapPath << name << ".xml";
                     if (l2d_internal::utils::contains(mapFiles, ss.str())) {
                         newMapExistsOverwriteVisible = true;
                     } else {
+                        this->clearShapeHandles();
                         this->_level.createMap(std::string(name), sf::Vector2i(mapSizeX, mapSizeY),
                                                sf::Vector2i(mapTileSizeX, mapTileSizeY));
                         createGridLines();
@@ -1055,6 +1121,7 @@ void l2d::Editor::update(sf::Time t) {
                 ImGui::Text("The name you have chosen already exists in your map directory.");
                 ImGui::Text("Would you like to overwrite the existing map?");
                 if (ImGui::Button("Sure!")) {
+                    this->clearShapeHandles();
                     this->_level.createMap(std::string(name), sf::Vector2i(mapSizeX, mapSizeY),
                                            sf::Vector2i(mapTileSizeX, mapTileSizeY));
                     createGridLines();
@@ -1083,6 +1150,7 @@ void l2d::Editor::update(sf::Time t) {
                     configWindowVisible = true;
                 }
                 if (ImGui::MenuItem("Exit")) {
+                    this->_level.endEdit();
                     this->_enabled = false; //TODO: do you want to save?
                 }
                 ImGui::EndMenu();
@@ -1136,7 +1204,6 @@ void l2d::Editor::update(sf::Time t) {
                 if (this->_level.isLoaded()) {
                     if (ImGui::MenuItem("Save map")) {
                         this->_level.saveMap(this->_level.getName());
-                        startStatusTimer("Map saved successfully!", 200);
                     }
                 }
                 if (this->_level.isLoaded()) {
@@ -1179,6 +1246,9 @@ void l2d::Editor::update(sf::Time t) {
                     if (ImGui::Checkbox("Hide shapes", &cbHideShapes)) {
                         this->_hideShapes = cbHideShapes;
                     }
+                    if (ImGui::Checkbox("Cache static layers", &cbChunkCache)) {
+                        this->_level.setChunkCacheEnabled(cbChunkCache);
+                    }
                     ImGui::Separator();
                     if (ImGui::MenuItem("Configure")) {
                         configureMapWindowVisible = true;
@@ -1238,17 +1308,15 @@ void l2d::Editor::update(sf::Time t) {
                 drawingMousePos = sf::Vector2f(std::floor(drawingMousePos.x), std::floor(drawingMousePos.y));
                 if (ImGui::IsMouseDown(0) && this->_mainHasFocus) {
                     sf::Vector2f tilePos(
-                            (drawingMousePos.x - ((int) drawingMousePos.x % (int) (this->_level.getTileSize().x * std::stof(
-                                    l2d_internal::utils::getConfigValue("tile_scale_x"))))) / this->_level.getTileSize().x /
-                            (int) std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) + 1,
-                            (drawingMousePos.y - ((int) drawingMousePos.y % (int) (this->_level.getTileSize().y * std::stof(
-                                    l2d_internal::utils::getConfigValue("tile_scale_y"))))) / this->_level.getTileSize().y /
-                            (int) std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) + 1);
+                            (drawingMousePos.x - ((int) drawingMousePos.x % (int) (this->_level.getTileSize().x * l2d_internal::Config::get().TileScale.x))) / this->_level.getTileSize().x /
+                            (int) l2d_internal::Config::get().TileScale.x + 1,
+                            (drawingMousePos.y - ((int) drawingMousePos.y % (int) (this->_level.getTileSize().y * l2d_internal::Config::get().TileScale.y))) / this->_level.getTileSize().y /
+                            (int) l2d_internal::Config::get().TileScale.y + 1);
                     if (tilePos.x >= 1 && tilePos.y >= 1 && tilePos.x <= this->_level.getSize().x && tilePos.y <= this->_level.getSize().y) {
                         if (this->_eraserActive) {
                             this->_level.removeTile(selectedTileLayer,
-                                                    sf::Vector2f((tilePos.x - 1) * this->_level.getTileSize().x * std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")),
-                                                                 (tilePos.y - 1) * this->_level.getTileSize().y * std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))));
+                                                    sf::Vector2f((tilePos.x - 1) * this->_level.getTileSize().x * l2d_internal::Config::get().TileScale.x,
+                                                                 (tilePos.y - 1) * this->_level.getTileSize().y * l2d_internal::Config::get().TileScale.y));
                         } else {
                             this->_level.updateTile(selectedTilesetPath, selectedTilesetSize, selectedTileSrcPos, tilePos, this->_level.getTilesetID(selectedTilesetPath),
                                                     selectedTileLayer);
@@ -1276,7 +1344,7 @@ void l2d::Editor::update(sf::Time t) {
                 ss << l2d_internal::utils::getConfigValue("background_path");
                 std::vector<const char *> backgroundFiles = l2d_internal::utils::getFilesInDirectory(ss.str());
                 if (ImGui::Button("New layer")) {
-                    this->_level.getBackground().addLayer(this->_graphics, sf::Vector2i(640, 480),
+                    this->_level.getBackground().addLayer(this->_graphics,
                                                           backgroundFiles.size() > 0 ? backgroundFiles[0] : "",
                                                           this->_level.getSize(), this->_level.getTileSize());
                 }
@@ -1286,7 +1354,7 @@ void l2d::Editor::update(sf::Time t) {
                     static int backgroundLayerIndex = -1;
                     static bool showImageCombo = false;
                     std::vector<const char *> backgroundLayerIds = [&]() {
-                        auto x = this->_level.getBackground().getLayers();
+                        const auto &x = this->_level.getBackground().getLayers();
                         std::vector<const char *> ids;
                         for (auto &xx : x) ids.push_back(std::to_string(xx.first).c_str());
                         return ids;
@@ -1330,19 +1398,19 @@ void l2d::Editor::update(sf::Time t) {
                 this->_currentWindowType = l2d_internal::WindowTypes::TilesetWindow;
                 static int tilesetComboIndex = -1;
                 static bool showTilesetImage = false;
-                static sf::Texture tilesetTexture;
+                static std::shared_ptr<sf::Texture> tilesetTexture = std::make_shared<sf::Texture>();
                 static sf::Vector2f tilesetViewSize(384, 128);
                 static sf::Vector2f selectedTilePos(0, 0);
 
-                float tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture.getSize().x;
-                float th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture.getSize().y;
+                float tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture->getSize().x;
+                float th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture->getSize().y;
                 static float dx = 0, dy = 0;
 
                 ImGui::SetNextWindowPosCenter();
                 ImGui::SetNextWindowSize(ImVec2(540, 300));
                 ImGui::Begin("Tilesets", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_HorizontalScrollbar);
                 std::stringstream ss;
-                ss << l2d_internal::utils::getConfigValue("tileset_path");
+                ss << l2d_internal::Config::get().TilesetPath;
                 std::vector<const char *> tilesetFiles = l2d_internal::utils::getFilesInDirectory(ss.str());
                 ImGui::PushItemWidth(400);
                 if (ImGui::Combo("Select tileset", &tilesetComboIndex, &tilesetFiles[0], static_cast<int>(tilesetFiles.size()))) {
@@ -1351,27 +1419,27 @@ void l2d::Editor::update(sf::Time t) {
                     selectedTileLayer = 1;
                     selectedTileSrcPos = sf::Vector2i(0, 0);
                     tilesetTexture = this->_graphics->loadImage(tilesetFiles[tilesetComboIndex]);
-                    selectedTilesetSize = sf::Vector2i(tilesetTexture.getSize());
+                    selectedTilesetSize = sf::Vector2i(tilesetTexture->getSize());
                     tilesetViewSize = sf::Vector2f(selectedTilesetSize) * 3.0f;
                     selectedTilePos = sf::Vector2f(0.0f, 0.0f);
-                    tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture.getSize().x;
-                    th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture.getSize().y;
+                    tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture->getSize().x;
+                    th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture->getSize().y;
                 }
                 ImGui::PopItemWidth();
                 if (tilesetComboIndex > -1) {
                     ImGui::PushItemWidth(80);
                     if (ImGui::Button("+", ImVec2(20, 20))) {
                         tilesetViewSize *= 1.2f; //TODO: MAKE THIS 1.2 VALUE CONFIGURABLE
-                        tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture.getSize().x;
-                        th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture.getSize().y;
+                        tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture->getSize().x;
+                        th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture->getSize().y;
                         dx = 0;
                         dy = 0;
                     }
                     ImGui::SameLine();
                     if (ImGui::Button("-", ImVec2(20, 20))) {
                         tilesetViewSize /= 1.2f;
-                        tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture.getSize().x;
-                        th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture.getSize().y;
+                        tw = (tilesetViewSize.x * this->_level.getTileSize().x) / tilesetTexture->getSize().x;
+                        th = (tilesetViewSize.y * this->_level.getTileSize().y) / tilesetTexture->getSize().y;
                         dx = 0;
                         dy = 0;
                     }
@@ -1401,16 +1469,16 @@ void l2d::Editor::update(sf::Time t) {
                     ImGui::BeginChild("tilesetChildArea", ImVec2(500, 200), true, ImGuiWindowFlags_HorizontalScrollbar);
                     ImVec2 pos = ImGui::GetCursorScreenPos();
                     tilesetTexture = this->_graphics->loadImage(tilesetFiles[tilesetComboIndex]);
-                    selectedTilesetSize = sf::Vector2i(tilesetTexture.getSize());
-                    ImGui::Image(tilesetTexture, tilesetViewSize);
+                    selectedTilesetSize = sf::Vector2i(tilesetTexture->getSize());
+                    ImGui::Image(*tilesetTexture, tilesetViewSize);
                     //Tileset grid
                     ImGui::SetItemAllowOverlap();
 
-                    for (unsigned int i = 0; i < (tilesetTexture.getSize().x / this->_level.getTileSize().x) + 1; ++i) {
+                    for (unsigned int i = 0; i < (tilesetTexture->getSize().x / this->_level.getTileSize().x) + 1; ++i) {
                         ImGui::GetWindowDrawList()->AddLine(ImVec2(pos.x + (i * tw), pos.y),
                                                             ImVec2(pos.x + (i * tw), pos.y + tilesetViewSize.y), ImColor(255, 255, 255, 255));
                     }
-                    for (unsigned int i = 0; i < (tilesetTexture.getSize().y / this->_level.getTileSize().y) + 1; ++i) {
+                    for (unsigned int i = 0; i < (tilesetTexture->getSize().y / this->_level.getTileSize().y) + 1; ++i) {
                         ImGui::GetWindowDrawList()->AddLine(ImVec2(pos.x, pos.y + (i * th)),
                                                             ImVec2(pos.x + tilesetViewSize.x, pos.y + (i * th)), ImColor(255, 255, 255, 255));
                     }
@@ -1443,7 +1511,7 @@ void l2d::Editor::update(sf::Time t) {
                         dy = mPos.y - pos.y;
                     }
                     //Make sure the user clicked on an actual tile and not blank space
-                    if (dx < (tw * (tilesetTexture.getSize().x / this->_level.getTileSize().x)) && dy < th * (tilesetTexture.getSize().y / this->_level.getTileSize().y)) {
+                    if (dx < (tw * (tilesetTexture->getSize().x / this->_level.getTileSize().x)) && dy < th * (tilesetTexture->getSize().y / this->_level.getTileSize().y)) {
                         selectedTilePos = ImVec2(tw * (static_cast<int>(dx) / static_cast<int>(tw)),
                                                  th * (static_cast<int>(dy) / static_cast<int>(th)));
                         tileHasBeenSelected = true;
@@ -1461,9 +1529,14 @@ void l2d::Editor::update(sf::Time t) {
 
 
         // TileType editor
-        if (this->_level.isLoaded() && this->_currentMapEditorMode == l2d_internal::MapEditorMode::TileType) {
-            if (this->_currentTileType != l2d_internal::TileType::Default) {
-                // TODO: implement drawing the tile types
+        if (this->_level.isLoaded() && this->_currentFeature == l2d_internal::Features::Map &&
+            this->_currentMapEditorMode == l2d_internal::MapEditorMode::TileType && this->_mainHasFocus) {
+            //Left click paints the current tile type (or clears it with the eraser), right click always clears
+            bool painting = ImGui::IsMouseDown(0) && this->_currentTileType != l2d_internal::TileType::Default;
+            bool clearing = ImGui::IsMouseDown(1) || (painting && this->_eraserActive);
+            sf::Vector2f mousePos = getMousePos();
+            if ((painting || clearing) && mousePos.x >= 0 && mousePos.y >= 0) {
+                this->_level.setTileType(this->_level.globalToLocalCoordinates(mousePos), clearing ? "" : this->_currentTileType.Name);
             }
         }
 
@@ -1475,12 +1548,19 @@ void l2d::Editor::update(sf::Time t) {
             if (selectedLightType == l2d_internal::LightType::Ambient) {
                 ImGui::Text("Ambient light editor");
                 ImGui::Separator();
+                //Pick up the light again if it was changed from outside of this window, e.g. by an undo
                 static ImVec4 col = ImVec4(this->_level.getAmbientColor());
+                static sf::Color lastAmbientColor = this->_level.getAmbientColor();
+                if (lastAmbientColor != this->_level.getAmbientColor()) {
+                    col = ImVec4(this->_level.getAmbientColor());
+                }
                 ImGui::ColorPicker3("", &col.x);
                 ImVec4 col2 = {col.x, col.y, col.z, col.w};
                 this->_level.setAmbientColor(col2);
+                lastAmbientColor = this->_level.getAmbientColor();
                 ImGui::Separator();
                 static float intensity = this->_level.getAmbientIntensity();
+                intensity = this->_level.getAmbientIntensity();
                 ImGui::SliderFloat("Intensity", &intensity, 0, 10, "%.2f");
                 this->_level.setAmbientIntensity(intensity);
                 ImGui::Separator();
@@ -1563,15 +1643,15 @@ void l2d::Editor::update(sf::Time t) {
                                                                rect->getRectangle().getPosition().y + diff.y);
                             newPos.x = std::max(0.0f, newPos.x);
                             newPos.x = std::min(newPos.x, this->_level.getSize().x * this->_level.getTileSize().x *
-                                                          std::stof(
-                                                                  l2d_internal::utils::getConfigValue("tile_scale_x")) -
+                                                          l2d_internal::Config::get().TileScale.x -
                                                           rect->getRectangle().getSize().x);
                             newPos.y = std::max(0.0f, newPos.y);
                             newPos.y = std::min(newPos.y, this->_level.getSize().y * this->_level.getTileSize().y *
-                                                          std::stof(
-                                                                  l2d_internal::utils::getConfigValue("tile_scale_y")) -
+                                                          l2d_internal::Config::get().TileScale.y -
                                                           rect->getRectangle().getSize().y);
+                            this->_level.beginShapeEdit(rect);
                             rect->setPosition(newPos);
+                            this->_level.refreshShape(rect);
                         }
                         this->_lastFrameMousePos = getMousePos();
                     } else if (ImGui::GetMouseCursor() == ImGuiMouseCursor_ResizeNWSE) {
@@ -1584,15 +1664,15 @@ void l2d::Editor::update(sf::Time t) {
                                 sf::Vector2f newSize = sf::Vector2f(rect->getRectangle().getSize().x + diff.x,
                                                                     rect->getRectangle().getSize().y + diff.y);
                                 newSize.x = std::min(newSize.x, this->_level.getSize().x * this->_level.getTileSize().x *
-                                                                std::stof(
-                                                                        l2d_internal::utils::getConfigValue("tile_scale_x")) -
+                                                                l2d_internal::Config::get().TileScale.x -
                                                                 (rect->getRectangle().getPosition().x));
                                 newSize.y = std::min(newSize.y, this->_level.getSize().y * this->_level.getTileSize().y *
-                                                                std::stof(
-                                                                        l2d_internal::utils::getConfigValue("tile_scale_y")) -
+                                                                l2d_internal::Config::get().TileScale.y -
                                                                 (rect->getRectangle().getPosition().y));
+                                this->_level.beginShapeEdit(rect);
                                 rect->setSize(sf::Vector2f(std::max(1.0f, newSize.x),
                                                            std::max(1.0f, newSize.y)));
+                                this->_level.refreshShape(rect);
                             }
                         }
                         this->_lastFrameMousePos = getMousePos();
@@ -1606,13 +1686,15 @@ void l2d::Editor::update(sf::Time t) {
                                 sf::Vector2f newPos = sf::Vector2f(getMousePos().x - point->getCircle().getRadius(), getMousePos().y - point->getCircle().getRadius());
                                 newPos.x = std::max(0.0f, newPos.x);
                                 newPos.x = std::min(newPos.x, this->_level.getSize().x * this->_level.getTileSize().x *
-                                                              std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) -
+                                                              l2d_internal::Config::get().TileScale.x -
                                                               (point->getCircle().getRadius() * 2));
                                 newPos.y = std::max(0.0f, newPos.y);
                                 newPos.y = std::min(newPos.y, this->_level.getSize().y * this->_level.getTileSize().y *
-                                                              std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) -
+                                                              l2d_internal::Config::get().TileScale.y -
                                                               (point->getCircle().getRadius() * 2));
+                                this->_level.beginShapeEdit(point);
                                 point->setPosition(newPos);
+                                this->_level.refreshShape(point);
                             }
                             this->_lastFrameMousePos = getMousePos();
                         }
@@ -1627,34 +1709,30 @@ void l2d::Editor::update(sf::Time t) {
         }
 
         if (this->_removingShape) {
-            rightClickedShape = this->_selectedShape;
+            this->_rightClickedShape = this->_selectedShape;
             ImGui::OpenPopup("right_click_shape");
             this->_removingShape = false;
         }
         if (ImGui::BeginPopup("right_click_shape")) {
             if (ImGui::MenuItem("Edit shape")) {
                 entityPropertiesLoaded = false;
-                if (rightClickedShape != nullptr) {
-                    this->_selectedShape = rightClickedShape;
+                if (this->_rightClickedShape != nullptr) {
+                    this->_selectedShape = this->_rightClickedShape;
                 }
                 if (this->_selectedShape != nullptr) {
                     customProperties = this->_selectedShape->getCustomProperties();
                 }
 
                 //Unset all selected shapes
-                selectedEntityRectangle = nullptr;
-                originalSelectedEntityRectangle = nullptr;
-                selectedEntityPoint = nullptr;
-                originalSelectedEntityPoint = nullptr;
+                this->_selectedEntityRectangle = nullptr;
+                this->_originalSelectedEntityRectangle = nullptr;
+                this->_selectedEntityPoint = nullptr;
+                this->_originalSelectedEntityPoint = nullptr;
 
                 auto r = std::dynamic_pointer_cast<l2d_internal::Rectangle>(this->_selectedShape);
                 if (r != nullptr) {
-                    selectedEntityRectangle = r;
-                    originalSelectedEntityRectangle = std::make_shared<l2d_internal::Rectangle>(
-                            r->getName(),
-                            r->getColor(),
-                            r->getObjectType(),
-                            r->getRectangle());
+                    this->_selectedEntityRectangle = r;
+                    this->_originalSelectedEntityRectangle = std::static_pointer_cast<l2d_internal::Rectangle>(this->_level.copyShape(r));
                     selectedEntityColor = this->_selectedShape->getColor();
                     selectedEntitySelectedObjectTypeIndex = static_cast<int>(r->getObjectType()) - 1;
 
@@ -1662,12 +1740,8 @@ void l2d::Editor::update(sf::Time t) {
                 } else {
                     auto p = std::dynamic_pointer_cast<l2d_internal::Point>(this->_selectedShape);
                     if (p != nullptr) {
-                        selectedEntityPoint = p;
-                        originalSelectedEntityPoint = std::make_shared<l2d_internal::Point>(
-                                p->getName(),
-                                p->getColor(),
-                                p->getCircle()
-                        );
+                        this->_selectedEntityPoint = p;
+                        this->_originalSelectedEntityPoint = std::static_pointer_cast<l2d_internal::Point>(this->_level.copyShape(p));
                         selectedEntityColor = p->getColor();
 
                         showEntityProperties = true;
@@ -1676,8 +1750,8 @@ void l2d::Editor::update(sf::Time t) {
             }
             ImGui::Separator();
             if (ImGui::MenuItem("Delete shape")) {
-                if (rightClickedShape != nullptr) {
-                    this->_selectedShape = rightClickedShape;
+                if (this->_rightClickedShape != nullptr) {
+                    this->_selectedShape = this->_rightClickedShape;
                 }
                 this->_level.removeShape(this->_selectedShape);
                 this->_selectedShape = nullptr;
@@ -1697,7 +1771,7 @@ void l2d::Editor::update(sf::Time t) {
             //FillObjectSection function
             auto fillObjectSection = [&](l2d_internal::ObjectTypes objectType, std::string strObjectType) {
                 int c = 0;
-                for (std::shared_ptr<l2d_internal::Shape> shape : this->_level.getShapeList()) {
+                for (const std::shared_ptr<l2d_internal::Shape> &shape : this->_level.getShapeList()) {
                     ++c;
                     //Rectangle check
                     auto s = std::dynamic_pointer_cast<l2d_internal::Rectangle>(shape);
@@ -1707,21 +1781,18 @@ void l2d::Editor::update(sf::Time t) {
                         if (ImGui::Selectable(s->getName().c_str())) {
                             entityPropertiesLoaded = false;
                             shape->select();
-                            rightClickedShape = shape;
-                            selectedEntityRectangle = s;
-                            originalSelectedEntityRectangle = std::make_shared<l2d_internal::Rectangle>(s->getName(),
-                                                                                                        s->getColor(),
-                                                                                                        s->getObjectType(),
-                                                                                                        s->getRectangle());
+                            this->_rightClickedShape = shape;
+                            this->_selectedEntityRectangle = s;
+                            this->_originalSelectedEntityRectangle = std::static_pointer_cast<l2d_internal::Rectangle>(this->_level.copyShape(s));
                             selectedEntitySelectedObjectTypeIndex = static_cast<int>(s->getObjectType()) - 1;
                             selectedEntityColor = s->getColor();
                             customProperties = shape->getCustomProperties();
 
                             //Unset the rest of the shapes
-                            selectedEntityPoint = nullptr;
-                            originalSelectedEntityPoint = nullptr;
-                            selectedEntityLine = nullptr;
-                            originalSelectedEntityLine = nullptr;
+                            this->_selectedEntityPoint = nullptr;
+                            this->_originalSelectedEntityPoint = nullptr;
+                            this->_selectedEntityLine = nullptr;
+                            this->_originalSelectedEntityLine = nullptr;
 
                             //Show the properties window
                             showEntityProperties = true;
@@ -1734,7 +1805,7 @@ void l2d::Editor::update(sf::Time t) {
             //FillPointSection function
             auto fillPointSection = [&]() -> void {
                 int c = 0;
-                for (std::shared_ptr<l2d_internal::Shape> shape : this->_level.getShapeList()) {
+                for (const std::shared_ptr<l2d_internal::Shape> &shape : this->_level.getShapeList()) {
                     ++c;
                     //Point check
                     auto p = std::dynamic_pointer_cast<l2d_internal::Point>(shape);
@@ -1744,17 +1815,17 @@ void l2d::Editor::update(sf::Time t) {
                         if (ImGui::Selectable(p->getName().c_str())) {
                             entityPropertiesLoaded = false;
                             shape->select();
-                            rightClickedShape = shape;
-                            selectedEntityPoint = p;
-                            originalSelectedEntityPoint = std::make_shared<l2d_internal::Point>(p->getName(), p->getColor(), p->getCircle());
+                            this->_rightClickedShape = shape;
+                            this->_selectedEntityPoint = p;
+                            this->_originalSelectedEntityPoint = std::static_pointer_cast<l2d_internal::Point>(this->_level.copyShape(p));
                             selectedEntityColor = p->getColor();
                             customProperties = shape->getCustomProperties();
 
                             //Unset the rest of the shapes
-                            selectedEntityRectangle = nullptr;
-                            originalSelectedEntityRectangle = nullptr;
-                            selectedEntityLine = nullptr;
-                            originalSelectedEntityLine = nullptr;
+                            this->_selectedEntityRectangle = nullptr;
+                            this->_originalSelectedEntityRectangle = nullptr;
+                            this->_selectedEntityLine = nullptr;
+                            this->_originalSelectedEntityLine = nullptr;
 
                             //Show the properties window
                             showEntityProperties = true;
@@ -1767,7 +1838,7 @@ void l2d::Editor::update(sf::Time t) {
             //FillLineSection function
             auto fillLineSection = [&]() -> void {
                 int c = 0;
-                for (std::shared_ptr<l2d_internal::Shape> shape : this->_level.getShapeList()) {
+                for (const std::shared_ptr<l2d_internal::Shape> &shape : this->_level.getShapeList()) {
                     ++c;
                     //Line check
                     auto l = std::dynamic_pointer_cast<l2d_internal::Line>(shape);
@@ -1777,17 +1848,17 @@ void l2d::Editor::update(sf::Time t) {
                         if (ImGui::Selectable(l->getName().c_str())) {
                             entityPropertiesLoaded = false;
                             shape->select();
-                            rightClickedShape = shape;
-                            selectedEntityLine = l;
-                            originalSelectedEntityLine = std::make_shared<l2d_internal::Line>(l->getName(), l->getColor(), l->getPoints());
+                            this->_rightClickedShape = shape;
+                            this->_selectedEntityLine = l;
+                            this->_originalSelectedEntityLine = std::static_pointer_cast<l2d_internal::Line>(this->_level.copyShape(l));
                             selectedEntityColor = l->getColor();
                             customProperties = shape->getCustomProperties();
 
                             //Unset the rest of the shapes
-                            selectedEntityRectangle = nullptr;
-                            originalSelectedEntityRectangle = nullptr;
-                            selectedEntityPoint = nullptr;
-                            originalSelectedEntityPoint = nullptr;
+                            this->_selectedEntityRectangle = nullptr;
+                            this->_originalSelectedEntityRectangle = nullptr;
+                            this->_selectedEntityPoint = nullptr;
+                            this->_originalSelectedEntityPoint = nullptr;
 
                             //Show the properties window
                             showEntityProperties = true;
@@ -1839,9 +1910,15 @@ void l2d::Editor::update(sf::Time t) {
             }
             ImGui::End();
         }
+        if (showEntityProperties && this->_selectedEntityRectangle == nullptr && this->_selectedEntityPoint == nullptr &&
+            this->_selectedEntityLine == nullptr) {
+            //The shape was let go of because another map was loaded
+            this->_currentWindowType = l2d_internal::WindowTypes::None;
+            showEntityProperties = false;
+        }
         if (showEntityProperties) {
-            if (rightClickedShape != nullptr) {
-                this->_selectedShape = rightClickedShape;
+            if (this->_rightClickedShape != nullptr) {
+                this->_selectedShape = this->_rightClickedShape;
             }
             ImGui::SetNextWindowSize(ImVec2(511, 234));
             this->_currentWindowType = l2d_internal::WindowTypes::EntityPropertiesWindow;
@@ -1850,9 +1927,9 @@ void l2d::Editor::update(sf::Time t) {
             ImGui::PushID("SelectedEntityName");
             static char name[500] = "";
             if (!entityPropertiesLoaded) {
-                strcpy(name, selectedEntityRectangle != nullptr ? selectedEntityRectangle->getName().c_str() :
-                             selectedEntityPoint != nullptr ? selectedEntityPoint->getName().c_str() :
-                             selectedEntityLine != nullptr ? selectedEntityLine->getName().c_str() :
+                strcpy(name, this->_selectedEntityRectangle != nullptr ? this->_selectedEntityRectangle->getName().c_str() :
+                             this->_selectedEntityPoint != nullptr ? this->_selectedEntityPoint->getName().c_str() :
+                             this->_selectedEntityLine != nullptr ? this->_selectedEntityLine->getName().c_str() :
                              "");
             }
             ImGui::PushItemWidth(200);
@@ -1874,12 +1951,12 @@ void l2d::Editor::update(sf::Time t) {
 
             ImGui::Separator();
 
-            if (selectedEntityRectangle != nullptr) {
+            if (this->_selectedEntityRectangle != nullptr) {
                 ImGui::PushID("SelectedEntityObjectType");
                 std::vector<const char *> objectTypeList = l2d_internal::utils::getObjectTypesForList();
                 if (!entityPropertiesLoaded) {
                     selectedEntitySelectedObjectTypeIndex =
-                            static_cast<int>(selectedEntityRectangle->getObjectType()) - 1;
+                            static_cast<int>(this->_selectedEntityRectangle->getObjectType()) - 1;
                 }
                 ImGui::Combo("Object type", &selectedEntitySelectedObjectTypeIndex, &objectTypeList[0],
                              static_cast<int>(objectTypeList.size()));
@@ -1887,19 +1964,27 @@ void l2d::Editor::update(sf::Time t) {
             }
 
             //List all of the points (with an option to delete)
-            if (selectedEntityLine != nullptr) {
+            if (this->_selectedEntityLine != nullptr) {
                 ImGui::Text("Points");
-                for (auto &p : selectedEntityLine->getPoints()) {
+                const auto &points = this->_selectedEntityLine->getPoints();
+                std::shared_ptr<l2d_internal::Point> deletedPoint = nullptr;
+                for (auto &p : points) {
                     ImGui::Text(p->getName().c_str());
-                    if (selectedEntityLine->getPoints().size() > 2) {
+                    if (points.size() > 2) {
                         ImGui::SameLine();
                         ImGui::PushID(("btn_" + p->getName()).c_str());
                         if (ImGui::Button("x", ImVec2(26, 20))) {
-                            selectedEntityLine->deletePoint(p);
+                            deletedPoint = p;
                         }
                         ImGui::PopID();
                     }
                 }
+                //Deleting while looping would invalidate the points being iterated over
+                if (deletedPoint != nullptr) {
+                    this->_level.beginShapeEdit(this->_selectedEntityLine);
+                    this->_selectedEntityLine->deletePoint(deletedPoint);
+                    this->_level.refreshShape(this->_selectedEntityLine);
+                }
             }
 
             //Custom properties
@@ -1944,29 +2029,29 @@ void l2d::Editor::update(sf::Time t) {
             if (ImGui::Button("Update")) {
                 this->_selectedShape.get()->clearCustomProperties();
                 this->_selectedShape.get()->setCustomProperties(customProperties);
-                if (selectedEntityRectangle != nullptr) {
-                    selectedEntityRectangle->setName(name);
-                    selectedEntityRectangle->setColor(selectedEntityColor);
-                    selectedEntityRectangle->setObjectType(static_cast<l2d_internal::ObjectTypes>(selectedEntitySelectedObjectTypeIndex + 1));
-                    selectedEntityRectangle->clearCustomProperties();
-                    selectedEntityRectangle->setCustomProperties(customProperties);
-                    this->_level.updateShape(originalSelectedEntityRectangle, selectedEntityRectangle);
+                if (this->_selectedEntityRectangle != nullptr) {
+                    this->_selectedEntityRectangle->setName(name);
+                    this->_selectedEntityRectangle->setColor(selectedEntityColor);
+                    this->_selectedEntityRectangle->setObjectType(static_cast<l2d_internal::ObjectTypes>(selectedEntitySelectedObjectTypeIndex + 1));
+                    this->_selectedEntityRectangle->clearCustomProperties();
+                    this->_selectedEntityRectangle->setCustomProperties(customProperties);
+                    this->_level.updateShape(this->_originalSelectedEntityRectangle, this->_selectedEntityRectangle);
                     this->_level.saveMap(this->_level.getName());
                     startStatusTimer("Rectangle saved successfully!", 200);
-                } else if (selectedEntityPoint != nullptr) {
-                    selectedEntityPoint->setName(name);
-                    selectedEntityPoint->setColor(selectedEntityColor);
-                    selectedEntityPoint->clearCustomProperties();
-                    selectedEntityPoint->setCustomProperties(customProperties);
-                    this->_level.updateShape(originalSelectedEntityPoint, selectedEntityPoint);
+                } else if (this->_selectedEntityPoint != nullptr) {
+                    this->_selectedEntityPoint->setName(name);
+                    this->_selectedEntityPoint->setColor(selectedEntityColor);
+                    this->_selectedEntityPoint->clearCustomProperties();
+                    this->_selectedEntityPoint->setCustomProperties(customProperties);
+                    this->_level.updateShape(this->_originalSelectedEntityPoint, this->_selectedEntityPoint);
                     this->_level.saveMap(this->_level.getName());
                     startStatusTimer("Point saved successfully!", 200);
-                } else if (selectedEntityLine != nullptr) {
-                    selectedEntityLine->setName(name);
-                    selectedEntityLine->setColor(selectedEntityColor);
-                    selectedEntityLine->clearCustomProperties();
-                    selectedEntityLine->setCustomProperties(customProperties);
-                    this->_level.updateShape(originalSelectedEntityLine, selectedEntityLine);
+                } else if (this->_selectedEntityLine != nullptr) {
+                    this->_selectedEntityLine->setName(name);
+                    this->_selectedEntityLine->setColor(selectedEntityColor);
+                    this->_selectedEntityLine->clearCustomProperties();
+                    this->_selectedEntityLine->setCustomProperties(customProperties);
+                    this->_level.updateShape(this->_originalSelectedEntityLine, this->_selectedEntityLine);
                     this->_level.saveMap(this->_level.getName());
                     startStatusTimer("Line saved successfully!", 200);
                 }
@@ -1984,12 +2069,12 @@ void l2d::Editor::update(sf::Time t) {
             ImGui::Text("    ");
             ImGui::SameLine();
             if (ImGui::Button("Delete")) {
-                if (selectedEntityRectangle != nullptr) {
-                    this->_level.removeShape(selectedEntityRectangle);
-                } else if (selectedEntityPoint != nullptr) {
-                    this->_level.removeShape(selectedEntityPoint);
-                } else if (selectedEntityLine != nullptr) {
-                    this->_level.removeShape(selectedEntityLine);
+                if (this->_selectedEntityRectangle != nullptr) {
+                    this->_level.removeShape(this->_selectedEntityRectangle);
+                } else if (this->_selectedEntityPoint != nullptr) {
+                    this->_level.removeShape(this->_selectedEntityPoint);
+                } else if (this->_selectedEntityLine != nullptr) {
+                    this->_level.removeShape(this->_selectedEntityLine);
                 }
                 clearSelectedEntityObjects();
                 this->_currentWindowType = l2d_internal::WindowTypes::None;
@@ -2019,9 +2104,10 @@ void l2d::Editor::update(sf::Time t) {
                 this->_level.setSize(sf::Vector2i(width, height));
                 this->_level.updateTileList();
                 for (auto &s : this->_level.getShapeList()) {
-                    s->fixPosition(this->_level.getSize(), this->_level.getTileSize(), sf::Vector2f(std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")),
-                                                                                                    std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))));
+                    s->fixPosition(this->_level.getSize(), this->_level.getTileSize(), sf::Vector2f(l2d_internal::Config::get().TileScale.x,
+                                                                                                    l2d_internal::Config::get().TileScale.y));
                 }
+                this->_level.refreshShapes();
                 this->_level.saveMap(this->_level.getName());
                 createGridLines();
             }
@@ -2112,9 +2198,21 @@ void l2d::Editor::update(sf::Time t) {
                                    "/clear : Clear out all of the text in the console\n"
                                            "/help : Show a list of console commands\n"
                                            "/lua : Start an interactive Lua session\n"
+                                           "/stats : Show how much of the level was drawn last frame\n"
                                            "");
                     return;
                 }
+                if (strcmp(command, "/stats") == 0) {
+                    const l2d_internal::RenderStats &stats = this->_graphics->getRenderStats();
+                    std::stringstream ss;
+                    ss << "Chunks drawn: " << stats.ChunksDrawn << ", culled: " << stats.ChunksCulled << ", baked: " << stats.ChunksBaked << "\n"
+                       << "Tiles drawn: " << stats.TilesDrawn << "\n"
+                       << "Background layers drawn: " << stats.SpritesDrawn << ", culled: " << stats.SpritesCulled << "\n"
+                       << "Shapes drawn: " << stats.ShapesDrawn << ", culled: " << stats.ShapesCulled << "\n"
+                       << "Draw calls: " << stats.DrawCalls << ", state changes: " << stats.StateChanges;
+                    addConsoleLine(l2d_internal::ConsoleItem::Type::Info, std::string(command), ss.str());
+                    return;
+                }
                 if (strcmp(command, "/lua") == 0 && !consoleLuaActive) {
                     addConsoleLine(l2d_internal::ConsoleItem::Type::Info, std::string(command),
                                    "Lua console is now active. Type /quit to exit the Lua session.");
@@ -2202,7 +2300,7 @@ void l2d::Editor::update(sf::Time t) {
             static std::string newSpriteErrorMessage = "";
 
             std::stringstream ss;
-            ss << l2d_internal::utils::getConfigValue("sprite_path");
+            ss << l2d_internal::Config::get().SpritePath;
             std::vector<const char *> spriteList = l2d_internal::utils::getFilesInDirectory(ss.str());
 
             ImGui::SetNextWindowPosCenter();
@@ -2351,7 +2449,7 @@ void l2d::Editor::update(sf::Time t) {
             ImGui::Begin("Animation editor", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_HorizontalScrollbar);
 
             std::stringstream ss;
-            ss << l2d_internal::utils::getConfigValue("animation_path");
+            ss << l2d_internal::Config::get().AnimationPath;
             std::vector<const char *> existingAnimationSprites = l2d_internal::utils::getFilesInDirectory(ss.str());
 
             ImGui::PushItemWidth(400);
@@ -2421,7 +2519,7 @@ void l2d::Editor::update(sf::Time t) {
                     ImGui::Separator();
 
                     ss.str("");
-                    ss << l2d_internal::utils::getConfigValue("sprite_path");
+                    ss << l2d_internal::Config::get().SpritePath;
                     std::vector<const char *> spriteList = l2d_internal::utils::getFilesInDirectory(ss.str());
                     std::string p = script->get<std::string>(
                             "animations.sprite_path");
@@ -2540,6 +2638,12 @@ void l2d::Editor::update(sf::Time t) {
             ImGui::End();
         }
 
+        //Maps are saved in the background. Say how the last save went once it is done
+        std::string saveError;
+        if (this->_level.takeSaveResult(saveError)) {
+            startStatusTimer(saveError.empty() ? "Map saved successfully!" : saveError, 200);
+        }
+
         //Status bar
         ImGui::Begin("Background", nullptr, ImGui::GetIO().DisplaySize, 0.0f,
                      ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove |
@@ -2556,7 +2660,13 @@ void l2d::Editor::update(sf::Time t) {
             ImGui::GetWindowDrawList()->AddText(ImVec2(this->_window->getSize().x - 80, this->_window->getSize().y - 20),
                                                 ImColor(1.0f, 1.0f, 1.0f, 1.0f), ss.str().c_str());
         }
-        if (showCurrentStatus) {
+        if (this->_level.isSaving()) {
+            std::stringstream ss;
+            ss << "Saving map... " << static_cast<int>(this->_level.getSaveProgress() * 100.0f) << "%";
+            ImGui::GetWindowDrawList()->AddText(ImVec2(280, this->_window->getSize().y - 20),
+                                                ImColor(1.0f, 1.0f, 1.0f, 1.0f), ss.str().c_str());
+        }
+        else if (showCurrentStatus) {
             ImGui::GetWindowDrawList()->AddText(ImVec2(280, this->_window->getSize().y - 20),
                                                 ImColor(1.0f, 1.0f, 1.0f, 1.0f), currentStatus.c_str());
 
@@ -2570,6 +2680,12 @@ void l2d::Editor::update(sf::Time t) {
             showCurrentStatus = false;
         }
 
+        //Pick up changes made to lime2d.config outside of the editor
+        if (l2d_internal::Config::get().reloadIfChanged()) {
+            this->applyConfig(false);
+            startStatusTimer("Configuration reloaded from lime2d.config", 200);
+        }
+
         //Updating internal classes
         this->_level.update(t.asSeconds());
         this->_graphics->update(t.asSeconds(), sf::Vector2f(this->_level.getTileSize()), (this->_windowHasFocus && this->_mainHasFocus));
@@ -50,15 +50,26 @@ namespace l2d {
         std::shared_ptr<l2d_internal::Graphics>  _graphics;
         l2d_internal::Level _level;
         sf::Shader _ambientLight;
-        std::vector<std::array<sf::Vertex, 2>> _gridLines;
+        sf::VertexArray _gridLines;
+        sf::FloatRect _gridLinesView;
         l2d_internal::DrawShapes _currentDrawShape;
         l2d_internal::MapEditorMode _currentMapEditorMode;
         sf::Event _currentEvent;
         std::shared_ptr<l2d_internal::Shape> _selectedShape;
+        std::shared_ptr<l2d_internal::Shape> _rightClickedShape;
+        //The shape open in the properties window, along with a copy of how it was before it was edited
+        std::shared_ptr<l2d_internal::Rectangle> _selectedEntityRectangle;
+        std::shared_ptr<l2d_internal::Rectangle> _originalSelectedEntityRectangle;
+        std::shared_ptr<l2d_internal::Point> _selectedEntityPoint;
+        std::shared_ptr<l2d_internal::Point> _originalSelectedEntityPoint;
+        std::shared_ptr<l2d_internal::Line> _selectedEntityLine;
+        std::shared_ptr<l2d_internal::Line> _originalSelectedEntityLine;
         l2d_internal::WindowTypes _currentWindowType;
 
         void createGridLines(bool always = false);
         void nextTileType();
+        std::string applyConfig(bool reloadMap);
+        void clearShapeHandles();
     };
 }
 
@@ -11,10 +11,37 @@
 #include <tuple>
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
+#include <cctype>
 #include <memory>
 #include <functional>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <set>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef LIME2D_ZLIB
+#include <zlib.h>
+#endif
 
 #include "../libext/tinyxml2.h"
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "../libext/stb_rect_pack.h"
 #include "lime2d_internal.h"
 
 #define tx2 tinyxml2
@@ -22,6 +49,166 @@
 l2d_internal::TileType l2d_internal::TileType::Default =  l2d_internal::TileType("", sf::Color::White);
 
 
+/*
+ * Config
+ */
+
+const char* l2d_internal::Config::FILE_NAME = "lime2d.config";
+
+l2d_internal::Config::Config() :
+        SpriteScale(1.0f, 1.0f),
+        TileScale(1.0f, 1.0f),
+        ScreenSize(1, 1),
+        CameraPanFactor(4.0f),
+        UndoMemoryBudget(16384),
+        MapEncoding("verbose"),
+        _lastWriteTime(0),
+        _version(0)
+{
+    this->load();
+}
+
+l2d_internal::Config &l2d_internal::Config::get() {
+    static Config config;
+    return config;
+}
+
+// std::string getValue
+// Returns the value of a key as it appears in the file, or an empty string if the key isn't there
+std::string l2d_internal::Config::getValue(const std::string &key) const {
+    auto it = this->_values.find(key);
+    return it == this->_values.end() ? "" : it->second;
+}
+
+// void load
+// Parses the config file and fills in the typed fields. Missing or malformed values keep their defaults.
+void l2d_internal::Config::load() {
+    this->_values.clear();
+    std::ifstream in(FILE_NAME);
+    if (!in.fail()) {
+        for (std::string line; std::getline(in, line); ) {
+            const std::string::size_type equals = line.find('=');
+            if (equals != std::string::npos) {
+                this->_values[line.substr(0, equals)] = line.substr(equals + 1);
+            }
+        }
+    }
+    auto readFloat = [&](const std::string &key, float defaultValue) {
+        try {
+            return std::stof(this->getValue(key));
+        }
+        catch (const std::logic_error &) {
+            return defaultValue;
+        }
+    };
+    auto readInt = [&](const std::string &key, int defaultValue) {
+        try {
+            return std::stoi(this->getValue(key));
+        }
+        catch (const std::logic_error &) {
+            return defaultValue;
+        }
+    };
+    this->MapPath = this->getValue("map_path");
+    this->TilesetPath = this->getValue("tileset_path");
+    this->SpritePath = this->getValue("sprite_path");
+    this->AnimationPath = this->getValue("animation_path");
+    this->SpriteScale = sf::Vector2f(readFloat("sprite_scale_x", 1.0f), readFloat("sprite_scale_y", 1.0f));
+    this->TileScale = sf::Vector2f(readFloat("tile_scale_x", 1.0f), readFloat("tile_scale_y", 1.0f));
+    this->ScreenSize = sf::Vector2i(readInt("screen_size_x", 1), readInt("screen_size_y", 1));
+    this->CameraPanFactor = readFloat("camera_pan_factor", 4.0f);
+    this->TileTypes = this->getValue("tile_types");
+    this->UndoMemoryBudget = static_cast<unsigned int>(std::max(0, readInt("undo_memory_budget", 16384)));
+    //Unknown names fall back to the verbose encoding
+    this->MapEncoding = l2d_internal::MapData::getTileEncodingName(l2d_internal::MapData::getTileEncoding(this->getValue("map_encoding")));
+    this->_lastWriteTime = this->getLastWriteTime();
+    this->_lastCheck = std::chrono::steady_clock::now();
+    ++this->_version;
+}
+
+// std::string save
+// Writes the typed fields, plus any other keys that were in the file, back to the config file.
+// Returns an error message, or an empty string if it saved
+std::string l2d_internal::Config::save() {
+    std::stringstream ss;
+    ss << this->SpriteScale.x;
+    this->_values["sprite_scale_x"] = ss.str();
+    ss.str("");
+    ss << this->SpriteScale.y;
+    this->_values["sprite_scale_y"] = ss.str();
+    ss.str("");
+    ss << this->TileScale.x;
+    this->_values["tile_scale_x"] = ss.str();
+    ss.str("");
+    ss << this->TileScale.y;
+    this->_values["tile_scale_y"] = ss.str();
+    ss.str("");
+    ss << this->CameraPanFactor;
+    this->_values["camera_pan_factor"] = ss.str();
+    this->_values["map_path"] = this->MapPath;
+    this->_values["tileset_path"] = this->TilesetPath;
+    this->_values["sprite_path"] = this->SpritePath;
+    this->_values["animation_path"] = this->AnimationPath;
+    this->_values["screen_size_x"] = std::to_string(this->ScreenSize.x);
+    this->_values["screen_size_y"] = std::to_string(this->ScreenSize.y);
+    this->_values["tile_types"] = this->TileTypes;
+    this->_values["undo_memory_budget"] = std::to_string(this->UndoMemoryBudget);
+    this->_values["map_encoding"] = this->MapEncoding;
+
+    std::ofstream os(FILE_NAME);
+    if (!os.is_open()) {
+        return "Unable to save file. Please refer to www.limeoats.com/lime2d for more information.";
+    }
+    //The known keys go first, in the order the editor has always written them
+    static const char* keys[] = { "map_path", "tileset_path", "sprite_scale_x", "sprite_scale_y", "tile_scale_x", "tile_scale_y",
+                                  "screen_size_x", "screen_size_y", "sprite_path", "animation_path", "camera_pan_factor", "tile_types",
+                                  "undo_memory_budget", "map_encoding" };
+    for (const char* key : keys) {
+        os << key << "=" << this->_values[key] << "\n";
+    }
+    for (auto &value : this->_values) {
+        if (!l2d_internal::utils::contains(keys, value.first)) {
+            os << value.first << "=" << value.second << "\n";
+        }
+    }
+    os.close();
+    this->_lastWriteTime = this->getLastWriteTime();
+    ++this->_version;
+    return "";
+}
+
+// bool reloadIfChanged
+// Reloads the config if the file was modified since it was last read. The file is checked at most once a second.
+// Returns true if it was reloaded
+bool l2d_internal::Config::reloadIfChanged() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - this->_lastCheck < std::chrono::seconds(1)) {
+        return false;
+    }
+    this->_lastCheck = now;
+    const std::time_t writeTime = this->getLastWriteTime();
+    if (writeTime == this->_lastWriteTime) {
+        return false;
+    }
+    this->load();
+    return true;
+}
+
+// unsigned int getVersion
+// Changes every time the config is loaded or saved
+unsigned int l2d_internal::Config::getVersion() const {
+    return this->_version;
+}
+
+std::time_t l2d_internal::Config::getLastWriteTime() const {
+    std::error_code error;
+    auto writeTime = std::experimental::filesystem::last_write_time(FILE_NAME, error);
+    if (error) {
+        return 0;
+    }
+    return decltype(writeTime)::clock::to_time_t(writeTime);
+}
+
 /*
  * Utils
  */
@@ -84,18 +271,11 @@ std::vector<const char*> l2d_internal::utils::getFilesInDirectory(std::string di
 }
 
 std::string l2d_internal::utils::getConfigValue(std::string key) {
-    std::ifstream in("lime2d.config");
-    std::map<std::string, std::string> configMap;
-    if (!in.fail()) {
-        for (std::string line; std::getline(in, line); ) {
-            configMap.insert(std::pair<std::string, std::string>(l2d_internal::utils::split(line, '=')[0], l2d_internal::utils::split(line, '=')[1]));
-        }
-    }
-    return configMap.size() <= 0 ? "" : configMap[key];
+    return l2d_internal::Config::get().getValue(key);
 }
 
 void l2d_internal::utils::createNewAnimationFile(std::string name, std::string spriteSheetPath) {
-    std::ofstream os(l2d_internal::utils::getConfigValue("animation_path") + name + ".lua");
+    std::ofstream os(l2d_internal::Config::get().AnimationPath + name + ".lua");
     os << "animations = {" << std::endl;
     os << "\tlist = {" << std::endl;
     os << "\t\tanimation_1 = {" << std::endl;
@@ -210,7 +390,18 @@ sf::View l2d_internal::Graphics::getView() const {
     return this->_view;
 }
 
+// sf::FloatRect getViewBounds
+// Returns the area of the world that is currently visible through the view, taking zoom into account
+sf::FloatRect l2d_internal::Graphics::getViewBounds() const {
+    return sf::FloatRect(this->_view.getCenter() - this->_view.getSize() / 2.0f, this->_view.getSize());
+}
+
+l2d_internal::RenderStats &l2d_internal::Graphics::getRenderStats() {
+    return this->_renderStats;
+}
+
 void l2d_internal::Graphics::draw(sf::Drawable &drawable, sf::Shader* ambientLight) {
+    this->flush();
     this->_window->setView(this->_view);
     if (ambientLight == nullptr) {
         this->_window->draw(drawable);
@@ -220,10 +411,118 @@ void l2d_internal::Graphics::draw(sf::Drawable &drawable, sf::Shader* ambientLig
     }
 }
 
+// void draw
+// Queues the vertices (they are copied, so the caller's buffer can go away) to be drawn on the next flush
 void l2d_internal::Graphics::draw(const sf::Vertex *vertices, unsigned int vertexCount, sf::PrimitiveType type,
-                                  const sf::RenderStates &states) {
+                                  const sf::RenderStates &states, int layer) {
+    if (vertexCount == 0) {
+        return;
+    }
+    static auto sameTransform = [](const sf::Transform &a, const sf::Transform &b) -> bool {
+        return std::equal(a.getMatrix(), a.getMatrix() + 16, b.getMatrix());
+    };
+    static auto isList = [](sf::PrimitiveType type) -> bool {
+        return type == sf::Points || type == sf::Lines || type == sf::Triangles || type == sf::Quads;
+    };
+    //Append to the last command of the same layer, shader and texture if the rest of the state matches too.
+    //Those two would end up next to each other after sorting anyway, so this is the same as merging them on flush
+    const auto key = std::make_tuple(layer, states.shader, states.texture);
+    auto last = this->_lastCommands.find(key);
+    if (last != this->_lastCommands.end() && isList(type)) {
+        RenderCommand &command = this->_commands[last->second];
+        if (command.Type == type && command.States.blendMode == states.blendMode && sameTransform(command.States.transform, states.transform)) {
+            command.Vertices.insert(command.Vertices.end(), vertices, vertices + vertexCount);
+            ++command.Draws;
+            return;
+        }
+    }
+    if (this->_commandCount == this->_commands.size()) {
+        this->_commands.emplace_back();
+    }
+    RenderCommand &command = this->_commands[this->_commandCount];
+    command.Layer = layer;
+    command.States = states;
+    command.Type = type;
+    command.Vertices.assign(vertices, vertices + vertexCount);
+    command.Buffer = nullptr;
+    command.Draws = 1;
+    this->_lastCommands[key] = this->_commandCount++;
+}
+
+// void drawBuffer
+// Queues a vertex array to be drawn on the next flush without copying it, so it has to stay alive and unchanged until then.
+// It gets a command of its own, and later draws with the same state start a new one so they still end up on top of it
+void l2d_internal::Graphics::drawBuffer(const sf::VertexArray &vertices, const sf::RenderStates &states, int layer) {
+    if (vertices.getVertexCount() == 0) {
+        return;
+    }
+    if (this->_commandCount == this->_commands.size()) {
+        this->_commands.emplace_back();
+    }
+    RenderCommand &command = this->_commands[this->_commandCount++];
+    command.Layer = layer;
+    command.States = states;
+    command.Type = vertices.getPrimitiveType();
+    command.Vertices.clear();
+    command.Buffer = &vertices;
+    command.Draws = 1;
+    this->_lastCommands.erase(std::make_tuple(layer, states.shader, states.texture));
+}
+
+// FlushStats flush
+// Draws the queued commands sorted by layer, shader and texture. Commands were already merged as they were
+// queued, so each one is a single draw call.
+l2d_internal::FlushStats l2d_internal::Graphics::flush() {
+    FlushStats stats;
+    if (this->_commandCount == 0) {
+        return stats;
+    }
+    static auto sameTransform = [](const sf::Transform &a, const sf::Transform &b) -> bool {
+        return std::equal(a.getMatrix(), a.getMatrix() + 16, b.getMatrix());
+    };
+    static auto sameState = [](const RenderCommand &a, const RenderCommand &b) -> bool {
+        return a.States.texture == b.States.texture && a.States.shader == b.States.shader &&
+               a.States.blendMode == b.States.blendMode && sameTransform(a.States.transform, b.States.transform);
+    };
+
+    this->_order.resize(this->_commandCount);
+    for (std::size_t i = 0; i < this->_commandCount; ++i) {
+        this->_order[i] = i;
+    }
+    std::stable_sort(this->_order.begin(), this->_order.end(), [this](std::size_t a, std::size_t b) {
+        const RenderCommand &ca = this->_commands[a];
+        const RenderCommand &cb = this->_commands[b];
+        return std::make_tuple(ca.Layer, ca.States.shader, ca.States.texture) <
+               std::make_tuple(cb.Layer, cb.States.shader, cb.States.texture);
+    });
+
     this->_window->setView(this->_view);
-    this->_window->draw(vertices, vertexCount, type, states);
+    const RenderCommand* previous = nullptr;
+    for (std::size_t index : this->_order) {
+        const RenderCommand &command = this->_commands[index];
+        if (previous == nullptr || !sameState(*previous, command)) {
+            ++stats.StateChanges;
+        }
+        if (command.Buffer != nullptr) {
+            this->_window->draw(*command.Buffer, command.States);
+        }
+        else {
+            this->_window->draw(command.Vertices.data(), command.Vertices.size(), command.Type, command.States);
+        }
+        stats.Commands += command.Draws;
+        ++stats.DrawCalls;
+        previous = &command;
+    }
+    //The buffers only had to stay alive until now
+    for (std::size_t i = 0; i < this->_commandCount; ++i) {
+        this->_commands[i].Buffer = nullptr;
+    }
+    this->_commandCount = 0;
+    this->_lastCommands.clear();
+
+    this->_renderStats.DrawCalls += stats.DrawCalls;
+    this->_renderStats.StateChanges += stats.StateChanges;
+    return stats;
 }
 
 void l2d_internal::Graphics::setViewPosition(sf::Vector2f pos) {
@@ -255,18 +554,22 @@ void l2d_internal::Graphics::setZoomPercentage(float zoomPercentage) {
     this->_zoomPercentage = zoomPercentage;
 }
 
-sf::Texture l2d_internal::Graphics::loadImage(const std::string &filePath) {
-    if (this->_spriteSheets.count(filePath) == 0) {
-        sf::Texture texture;
-        texture.loadFromFile(filePath);
-        this->_spriteSheets[filePath] = texture;
+// std::shared_ptr<sf::Texture> loadImage
+// Returns the shared texture for the image at filePath, loading and uploading it the first time it is requested.
+// Every sprite, tile and background using the same image points at this one texture.
+std::shared_ptr<sf::Texture> l2d_internal::Graphics::loadImage(const std::string &filePath) {
+    auto it = this->_spriteSheets.find(filePath);
+    if (it == this->_spriteSheets.end()) {
+        auto texture = std::make_shared<sf::Texture>();
+        texture->loadFromFile(filePath);
+        it = this->_spriteSheets.insert(std::make_pair(filePath, texture)).first;
     }
-    return this->_spriteSheets[filePath];
+    return it->second;
 }
 
 void l2d_internal::Graphics::update(float elapsedTime, sf::Vector2f tileSize, bool windowHasFocus) {
-    float amountToMoveX = (tileSize.x * std::stof(l2d_internal::utils::getConfigValue("tile_scale_x"))) / std::stof(l2d_internal::utils::getConfigValue("camera_pan_factor"));
-    float amountToMoveY = (tileSize.y * std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))) / std::stof(l2d_internal::utils::getConfigValue("camera_pan_factor"));
+    float amountToMoveX = (tileSize.x * l2d_internal::Config::get().TileScale.x) / l2d_internal::Config::get().CameraPanFactor;
+    float amountToMoveY = (tileSize.y * l2d_internal::Config::get().TileScale.y) / l2d_internal::Config::get().CameraPanFactor;
     if (windowHasFocus) {
         if (sf::Keyboard::isKeyPressed(sf::Keyboard::S)) {
             this->_view.move(0, amountToMoveY);
@@ -291,9 +594,9 @@ void l2d_internal::Graphics::update(float elapsedTime, sf::Vector2f tileSize, bo
 l2d_internal::Sprite::Sprite(std::shared_ptr<Graphics> graphics, const std::string &filePath, sf::Vector2i srcPos, sf::Vector2i size,
                              sf::Vector2f destPos) {
     this->_texture = graphics->loadImage(filePath);
-    this->_sprite = sf::Sprite(this->_texture, sf::IntRect(srcPos.x, srcPos.y, size.x, size.y));
+    this->_sprite = sf::Sprite(*this->_texture, sf::IntRect(srcPos.x, srcPos.y, size.x, size.y));
     this->_sprite.setPosition(destPos);
-    this->_sprite.setScale(std::stof(l2d_internal::utils::getConfigValue("sprite_scale_x")), std::stof(l2d_internal::utils::getConfigValue("sprite_scale_y")));
+    this->_sprite.setScale(l2d_internal::Config::get().SpriteScale.x, l2d_internal::Config::get().SpriteScale.y);
     this->_graphics = graphics;
 }
 
@@ -403,7 +706,7 @@ void l2d_internal::AnimatedSprite::draw(sf::Shader *ambientLight) {
     }
 }
 
-sf::Sprite l2d_internal::AnimatedSprite::getSprite() const {
+const sf::Sprite &l2d_internal::AnimatedSprite::getSprite() const {
     return this->_sprite;
 }
 
@@ -417,21 +720,24 @@ l2d_internal::Tile::Tile(std::shared_ptr<Graphics> graphics, std::string &filePa
         _tilesetId(tilesetId),
         _layer(layer)
 {
-    this->_sprite.setScale(std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")), std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")));
+    this->_sprite.setScale(l2d_internal::Config::get().TileScale.x, l2d_internal::Config::get().TileScale.y);
 }
 
 l2d_internal::Tile::Tile(const Tile &tile) {
+    this->_texture = tile._texture;
     this->_sprite = tile.getSprite();
+    this->_graphics = tile._graphics;
     this->_tilesetId = tile._tilesetId;
+    this->_layer = tile._layer;
 }
 
 l2d_internal::Tile::~Tile() {}
 
-sf::Sprite l2d_internal::Tile::getSprite() const {
+const sf::Sprite &l2d_internal::Tile::getSprite() const {
     return this->_sprite;
 }
 
-sf::Texture l2d_internal::Tile::getTexture() const {
+const std::shared_ptr<sf::Texture> &l2d_internal::Tile::getTexture() const {
     return this->_texture;
 }
 
@@ -463,893 +769,4020 @@ l2d_internal::Tileset::Tileset(int id, std::string path, sf::Vector2i size) :
 {}
 
 /*
- * Layer
+ * TilesetAtlas
  */
 
-l2d_internal::Layer::Layer() {
+l2d_internal::TilesetAtlas::TilesetAtlas() :
+        _version(0)
+{}
+
+// void build
+// Packs the images of the given tilesets into atlas pages using stb_rect_pack.
+// Each tileset gets a 1 pixel border copied from its own edge pixels so scaled tiles don't bleed into their neighbours.
+void l2d_internal::TilesetAtlas::build(std::shared_ptr<Graphics> &graphics, const std::vector<Tileset> &tilesets) {
+    this->clear();
+    if (graphics == nullptr) {
+        return;
+    }
+    const int padding = 1;
+    const int pageSize = static_cast<int>(std::min(sf::Texture::getMaximumSize(), 4096u));
+
+    std::vector<sf::Image> images;
+    std::vector<const sf::Texture*> sources;
+    std::vector<stbrp_rect> rects;
+    for (const Tileset &t : tilesets) {
+        const sf::Texture* source = graphics->loadImage(t.Path).get();
+        if (std::find(sources.begin(), sources.end(), source) != sources.end()) {
+            continue;
+        }
+        //The image failed to load
+        if (source->getSize().x == 0 || source->getSize().y == 0) {
+            continue;
+        }
+        stbrp_rect rect = {};
+        rect.id = static_cast<int>(images.size());
+        rect.w = static_cast<stbrp_coord>(source->getSize().x + padding * 2);
+        rect.h = static_cast<stbrp_coord>(source->getSize().y + padding * 2);
+        if (rect.w > pageSize || rect.h > pageSize) {
+            //Too big for any page. It keeps using its own texture.
+            continue;
+        }
+        //Read the pixels back from the texture loadImage already made instead of decoding the file again
+        images.push_back(source->copyToImage());
+        sources.push_back(source);
+        rects.push_back(rect);
+    }
+    //A single tileset isn't worth an extra copy of the image
+    if (rects.size() < 2) {
+        this->_version++;
+        return;
+    }
+
+    std::vector<stbrp_node> nodes(static_cast<unsigned int>(pageSize));
+    while (!rects.empty()) {
+        stbrp_context context;
+        stbrp_init_target(&context, pageSize, pageSize, nodes.data(), static_cast<int>(nodes.size()));
+        stbrp_pack_rects(&context, rects.data(), static_cast<int>(rects.size()));
+
+        //Shrink the page to what was actually used
+        unsigned int pageWidth = 0, pageHeight = 0;
+        for (const stbrp_rect &r : rects) {
+            if (r.was_packed) {
+                pageWidth = std::max(pageWidth, static_cast<unsigned int>(r.x + r.w));
+                pageHeight = std::max(pageHeight, static_cast<unsigned int>(r.y + r.h));
+            }
+        }
+        if (pageWidth == 0 || pageHeight == 0) {
+            break;
+        }
+
+        sf::Image pageImage;
+        pageImage.create(pageWidth, pageHeight, sf::Color::Transparent);
+        std::vector<stbrp_rect> remaining;
+        for (const stbrp_rect &r : rects) {
+            if (!r.was_packed) {
+                remaining.push_back(r);
+                continue;
+            }
+            const sf::Image &image = images[r.id];
+            const unsigned int x = r.x + padding, y = r.y + padding;
+            const unsigned int w = image.getSize().x, h = image.getSize().y;
+            pageImage.copy(image, x, y);
+            //Extrude the edges into the padding
+            for (unsigned int i = 0; i < w; ++i) {
+                pageImage.setPixel(x + i, y - 1, image.getPixel(i, 0));
+                pageImage.setPixel(x + i, y + h, image.getPixel(i, h - 1));
+            }
+            for (unsigned int j = 0; j < h; ++j) {
+                pageImage.setPixel(x - 1, y + j, image.getPixel(0, j));
+                pageImage.setPixel(x + w, y + j, image.getPixel(w - 1, j));
+            }
+            this->_entries[sources[r.id]] = Entry { static_cast<unsigned int>(this->_pages.size()),
+                                                    sf::Vector2f(static_cast<float>(x), static_cast<float>(y)) };
+        }
+        auto page = std::make_shared<sf::Texture>();
+        page->loadFromImage(pageImage);
+        this->_pages.push_back(page);
+        rects = remaining;
+    }
+    this->_version++;
+}
 
+void l2d_internal::TilesetAtlas::clear() {
+    this->_pages.clear();
+    this->_entries.clear();
+    this->_version++;
 }
 
-void l2d_internal::Layer::draw(sf::Shader* ambientLight) {
-    for (auto &t : this->Tiles) {
-        t->draw(ambientLight);
+// bool lookup
+// Finds where a tileset texture was packed. Returns false if it isn't in the atlas.
+bool l2d_internal::TilesetAtlas::lookup(const sf::Texture* source, const sf::Texture* &page, sf::Vector2f &offset) const {
+    auto it = this->_entries.find(source);
+    if (it == this->_entries.end()) {
+        return false;
     }
+    page = this->_pages[it->second.Page].get();
+    offset = it->second.Offset;
+    return true;
+}
+
+unsigned int l2d_internal::TilesetAtlas::getPageCount() const {
+    return static_cast<unsigned int>(this->_pages.size());
+}
+
+unsigned int l2d_internal::TilesetAtlas::getVersion() const {
+    return this->_version;
 }
 
 /*
- * BackgroundLayer
+ * PackedTiles
  */
-l2d_internal::BackgroundLayer::BackgroundLayer() {}
 
-l2d_internal::BackgroundLayer::BackgroundLayer(std::shared_ptr<Graphics> &graphics, sf::Vector2i size,
-                                               const std::string &filePath, sf::Vector2i levelSize,
-                                               sf::Vector2i tileSize) {
-    this->_filePath = filePath;
-    auto c = levelSize.x * std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) * tileSize.x /
-            std::stof(l2d_internal::utils::getConfigValue("screen_size_x"));
-    auto r = levelSize.y * std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) * tileSize.y /
-            std::stof(l2d_internal::utils::getConfigValue("screen_size_y"));
-    for (auto x = 0; x < c; ++x) {
-        for (auto y = 0; y < r; ++y) {
-            this->_sprites.push_back(std::make_shared<l2d_internal::Sprite>(graphics, filePath, sf::Vector2i(0, 0), size,
-                                                                            sf::Vector2f(x * std::stof(l2d_internal::utils::getConfigValue("screen_size_x")),
-                                                                                         y * std::stof(l2d_internal::utils::getConfigValue("screen_size_y")))));
+const unsigned int l2d_internal::PackedTiles::MAX_BITS;
+
+l2d_internal::PackedTiles::PackedTiles(unsigned int cellCount) :
+        _cellCount(cellCount),
+        _bits(1),
+        _palette(1),
+        _uses(1, cellCount),
+        _words((cellCount + 31) / 32, 0)
+{}
+
+// static PackedTiles &makeUnique
+// Returns tiles that can be changed without changing anyone else's, copying them first if they are shared.
+// A save snapshot on the worker thread only ever reads its chunks and drops them when it is done, so once
+// nothing else holds a chunk it is safe to change in place
+l2d_internal::PackedTiles &l2d_internal::PackedTiles::makeUnique(std::shared_ptr<PackedTiles> &tiles) {
+    if (tiles.use_count() > 1) {
+        tiles = std::make_shared<PackedTiles>(*tiles);
+    }
+    else {
+        //Pairs with the release done by the other thread dropping its reference, so its reads finish first
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *tiles;
+}
+
+// static std::shared_ptr<PackedTiles> fromPacked
+// Takes over a palette and packed indices the way getPalette and getWords return them, e.g. from a saved map,
+// instead of setting the cells one by one. Only the uses of each palette entry are counted.
+// Returns nullptr if they don't make up valid tiles
+std::shared_ptr<l2d_internal::PackedTiles> l2d_internal::PackedTiles::fromPacked(unsigned int cellCount, unsigned int bits,
+                                                                               std::vector<TileRecord> palette,
+                                                                               std::vector<std::uint32_t> words) {
+    if (bits == 0 || bits > MAX_BITS || (bits & (bits - 1)) != 0 || palette.empty() || palette.size() > (1u << bits) ||
+        palette[0] != TileRecord() || words.size() != (static_cast<std::size_t>(cellCount) * bits + 31) / 32) {
+        return nullptr;
+    }
+    std::shared_ptr<PackedTiles> tiles = std::make_shared<PackedTiles>(0);
+    tiles->_cellCount = cellCount;
+    tiles->_bits = bits;
+    tiles->_palette = std::move(palette);
+    tiles->_words = std::move(words);
+    tiles->_uses.assign(tiles->_palette.size(), 0);
+    for (unsigned int i = 0; i < cellCount; ++i) {
+        const unsigned int index = tiles->getIndex(i);
+        if (index >= tiles->_palette.size()) {
+            return nullptr;
         }
+        ++tiles->_uses[index];
     }
-    for (auto &s : this->_sprites) {
-        s->getSprite().setScale(1.25, 1.25);
+    //Only index 0 may be the empty tile, or the tile count would be off
+    for (std::size_t i = 1; i < tiles->_palette.size(); ++i) {
+        if (tiles->_uses[i] > 0 && tiles->_palette[i].isEmpty()) {
+            return nullptr;
+        }
     }
+    return tiles;
 }
 
-std::string l2d_internal::BackgroundLayer::getPath() const {
-    return this->_filePath;
+l2d_internal::TileRecord l2d_internal::PackedTiles::get(unsigned int cell) const {
+    return this->_palette[this->getIndex(cell)];
 }
 
-void l2d_internal::BackgroundLayer::draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics) {
-    for (auto &sp : this->_sprites) {
-        sp->draw(ambientLight);
+// void set
+// Stores a tile in a cell, adding it to the palette if the chunk doesn't use it yet
+void l2d_internal::PackedTiles::set(unsigned int cell, TileRecord tile) {
+    const unsigned int oldIndex = this->getIndex(cell);
+    if (this->_palette[oldIndex] == tile) {
+        return;
+    }
+    unsigned int index = 0;
+    if (!tile.isEmpty()) {
+        auto it = std::find(this->_palette.begin() + 1, this->_palette.end(), tile);
+        if (it != this->_palette.end() && this->_uses[it - this->_palette.begin()] > 0) {
+            index = static_cast<unsigned int>(it - this->_palette.begin());
+        }
+        else {
+            //Reuse an entry nothing points at anymore before growing the palette
+            auto unused = std::find(this->_uses.begin() + 1, this->_uses.end(), 0u);
+            if (unused != this->_uses.end()) {
+                index = static_cast<unsigned int>(unused - this->_uses.begin());
+                this->_palette[index] = tile;
+            }
+            else {
+                index = static_cast<unsigned int>(this->_palette.size());
+                this->_palette.push_back(tile);
+                this->_uses.push_back(0);
+                if (index >= (1u << this->_bits)) {
+                    this->widen(this->_bits * 2);
+                }
+            }
+        }
     }
+    --this->_uses[oldIndex];
+    ++this->_uses[index];
+    this->setIndex(cell, index);
 }
 
-void l2d_internal::BackgroundLayer::update(float elapsedTime) {
-    (void)elapsedTime;
+// unsigned int getIndex
+// Returns the palette index of a cell. Index 0 is the empty tile.
+unsigned int l2d_internal::PackedTiles::getIndex(unsigned int cell) const {
+    //Widths are powers of two, so a cell never straddles two words
+    const unsigned int perWord = 32 / this->_bits;
+    const unsigned int shift = (cell % perWord) * this->_bits;
+    return (this->_words[cell / perWord] >> shift) & ((1u << this->_bits) - 1);
+}
+
+const std::vector<l2d_internal::TileRecord> &l2d_internal::PackedTiles::getPalette() const {
+    return this->_palette;
+}
+
+unsigned int l2d_internal::PackedTiles::getTileCount() const {
+    return this->_cellCount - this->_uses[0];
+}
+
+unsigned int l2d_internal::PackedTiles::getBitsPerCell() const {
+    return this->_bits;
+}
+
+// const std::vector<std::uint32_t> &getWords
+// The palette index of every cell, getBitsPerCell bits each, packed from the lowest bit of each word up
+const std::vector<std::uint32_t> &l2d_internal::PackedTiles::getWords() const {
+    return this->_words;
+}
+
+void l2d_internal::PackedTiles::setIndex(unsigned int cell, unsigned int index) {
+    const unsigned int perWord = 32 / this->_bits;
+    const unsigned int shift = (cell % perWord) * this->_bits;
+    const std::uint32_t mask = ((1u << this->_bits) - 1) << shift;
+    std::uint32_t &word = this->_words[cell / perWord];
+    word = (word & ~mask) | ((static_cast<std::uint32_t>(index) << shift) & mask);
+}
+
+// void widen
+// Repacks every cell's index with more bits per cell
+void l2d_internal::PackedTiles::widen(unsigned int bits) {
+    bits = std::min(bits, MAX_BITS);
+    std::vector<unsigned int> indices(this->_cellCount);
+    for (unsigned int i = 0; i < this->_cellCount; ++i) {
+        indices[i] = this->getIndex(i);
+    }
+    this->_bits = bits;
+    this->_words.assign((this->_cellCount * bits + 31) / 32, 0);
+    for (unsigned int i = 0; i < this->_cellCount; ++i) {
+        this->setIndex(i, indices[i]);
+    }
 }
 
 /*
- * Background
+ * ChunkCache
  */
-l2d_internal::Background::Background() {
-    
+
+const unsigned int l2d_internal::ChunkCache::BUDGET;
+
+l2d_internal::ChunkCache::ChunkCache() :
+        _frame(0)
+{}
+
+// void beginFrame
+// Call once per frame before the layers are drawn. Chunks drawn during the frame can't be evicted until the next one
+void l2d_internal::ChunkCache::beginFrame() {
+    ++this->_frame;
 }
 
-void l2d_internal::Background::draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics) {
-    for (auto &l : this->_layers) {
-        l.second.draw(ambientLight, graphics);
+// bool reserve
+// Makes room for one more chunk, evicting the one drawn longest ago if the cache is full.
+// Returns false if every cached chunk was drawn this frame, since evicting one of those would only get it baked again
+bool l2d_internal::ChunkCache::reserve() {
+    if (this->_entries.size() < BUDGET) {
+        return true;
     }
+    if (this->_entries.empty() || this->_entries.front().LastDrawn == this->_frame) {
+        return false;
+    }
+    this->_entries.front().Texture->reset();
+    this->_entries.pop_front();
+    return true;
 }
 
-std::map<int, l2d_internal::BackgroundLayer> l2d_internal::Background::getLayers() const {
-    return this->_layers;
+// Handle add
+// Adds a chunk whose render texture was just created. texture must stay where it is until the chunk is removed
+l2d_internal::ChunkCache::Handle l2d_internal::ChunkCache::add(std::shared_ptr<sf::RenderTexture>* texture) {
+    return this->_entries.insert(this->_entries.end(), Entry { texture, this->_frame });
+}
+
+// void touch
+// Marks a cached chunk as drawn this frame, which moves it to the back of the list
+void l2d_internal::ChunkCache::touch(Handle handle) {
+    handle->LastDrawn = this->_frame;
+    this->_entries.splice(this->_entries.end(), this->_entries, handle);
+}
+
+// void remove
+// Forgets a chunk without touching its render texture, e.g. because the chunk is about to be freed
+void l2d_internal::ChunkCache::remove(Handle handle) {
+    this->_entries.erase(handle);
 }
 
-void l2d_internal::Background::addLayer(std::shared_ptr<Graphics> &graphics, sf::Vector2i size, const std::string &filePath, sf::Vector2i levelSize,
-                          sf::Vector2i tileSize) {
-    auto n = this->_layers.size() == 0 ? 0 : this->_layers.end()->first + 1;
-    this->_layers[n] = BackgroundLayer(graphics, size, filePath, levelSize, tileSize);
+std::size_t l2d_internal::ChunkCache::getSize() const {
+    return this->_entries.size();
+}
+
+// void clear
+// Frees the render texture of every cached chunk
+void l2d_internal::ChunkCache::clear() {
+    for (Entry &entry : this->_entries) {
+        entry.Texture->reset();
+    }
+    this->_entries.clear();
 }
 
 /*
- * Level
+ * Layer
  */
 
-l2d_internal::Level::Level(std::shared_ptr<Graphics> graphics, std::string name) {
-    this->_loaded = false;
-    this->loadMap(name);
-    this->_graphics = graphics;
-    this->_oldLayerList = std::stack<std::vector<std::shared_ptr<Layer>>>();
-    this->_redoList = std::stack<std::vector<std::shared_ptr<Layer>>>();
-    this->_ambientColor = sf::Color::White;
-    this->_ambientIntensity = 1.0f;
-}
+const int l2d_internal::Layer::CHUNK_SIZE;
 
-l2d_internal::Level::~Level() {
+l2d_internal::Layer::Layer(int id, sf::Vector2i size) :
+        Id(id),
+        _size(std::max(0, size.x), std::max(0, size.y)),
+        _rebuildAll(true),
+        _hasDirtyChunks(true),
+        _atlasVersion(0),
+        _sourcesVersion(0),
+        _cache(nullptr)
+{}
 
+//Copies only the tiles, which are shared until one of the layers changes them.
+//The vertices are rebuilt the first time the copy is drawn
+l2d_internal::Layer::Layer(const Layer &layer) :
+        Id(layer.Id),
+        _size(layer._size),
+        _rebuildAll(true),
+        _hasDirtyChunks(true),
+        _atlasVersion(0),
+        _sourcesVersion(0),
+        _cache(nullptr)
+{
+    for (const auto &chunk : layer._chunks) {
+        Chunk &c = this->_chunks[chunk.first];
+        c.Tiles = chunk.second.Tiles;
+    }
 }
 
-std::string l2d_internal::Level::getName() const {
-    return this->_name;
+l2d_internal::Layer::~Layer() {
+    this->releaseCaches();
 }
 
-sf::Vector2i l2d_internal::Level::getSize() const {
+sf::Vector2i l2d_internal::Layer::getSize() const {
     return this->_size;
 }
 
-void l2d_internal::Level::setSize(sf::Vector2i size) {
+// void resize
+// Changes the size of the layer. Only chunks on the new edge are touched: chunks past it are freed and
+// the cells past it in chunks that straddle it are cleared.
+void l2d_internal::Layer::resize(sf::Vector2i size) {
+    size = sf::Vector2i(std::max(0, size.x), std::max(0, size.y));
+    if (size == this->_size) {
+        return;
+    }
     this->_size = size;
+    for (auto it = this->_chunks.begin(); it != this->_chunks.end();) {
+        const int left = it->first.second * CHUNK_SIZE;
+        const int top = it->first.first * CHUNK_SIZE;
+        if (left >= size.x || top >= size.y) {
+            this->releaseCache(it->second);
+            it = this->_chunks.erase(it);
+            continue;
+        }
+        if (left + CHUNK_SIZE > size.x || top + CHUNK_SIZE > size.y) {
+            Chunk &chunk = it->second;
+            for (int y = 0; y < CHUNK_SIZE; ++y) {
+                for (int x = 0; x < CHUNK_SIZE; ++x) {
+                    const unsigned int cell = static_cast<unsigned int>(y * CHUNK_SIZE + x);
+                    if ((left + x >= size.x || top + y >= size.y) && chunk.Tiles->getIndex(cell) != 0) {
+                        PackedTiles::makeUnique(chunk.Tiles).set(cell, TileRecord());
+                        chunk.Dirty = true;
+                        this->_hasDirtyChunks = true;
+                    }
+                }
+            }
+            if (chunk.Tiles->getTileCount() == 0) {
+                this->releaseCache(chunk);
+                it = this->_chunks.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
 }
 
-void l2d_internal::Level::updateTileList() {
-    std::vector<std::shared_ptr<Tile>> allTiles;
-    for (std::shared_ptr<Layer> &layer : this->_layerList) {
-        allTiles.insert(allTiles.end(), layer.get()->Tiles.begin(), layer.get()->Tiles.end());
-    }
-    //Sort allTiles by y, then by x, then by layer
-    std::sort(allTiles.begin(), allTiles.end(), [&](const std::shared_ptr<Tile> &a, const std::shared_ptr<Tile> &b) {
-        return ((a.get()->getSprite().getPosition().y < b.get()->getSprite().getPosition().y) ||
-                ((a.get()->getSprite().getPosition().y == b.get()->getSprite().getPosition().y) &&
-                 a.get()->getSprite().getPosition().x < b.get()->getSprite().getPosition().x) ||
-                (((a.get()->getSprite().getPosition().y == b.get()->getSprite().getPosition().y) &&
-                  a.get()->getSprite().getPosition().x == b.get()->getSprite().getPosition().x) &&
-                 a.get()->getLayer() < b.get()->getLayer()));
-    });
-    for (std::shared_ptr<Tile> &tile : allTiles) {
-        float x = tile.get()->getSprite().getPosition().x / this->_tileSize.x /
-                  std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) + 1;
-        float y = tile.get()->getSprite().getPosition().y / this->_tileSize.y /
-                  std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) + 1;
+// const TileRecord &getTile
+// Returns the tile at the cell (x, y), starting from 0. Cells outside of the layer or in unpainted chunks are empty.
+l2d_internal::TileRecord l2d_internal::Layer::getTile(int x, int y) const {
+    if (x < 0 || y < 0 || x >= this->_size.x || y >= this->_size.y) {
+        return TileRecord();
+    }
+    auto it = this->_chunks.find(std::make_pair(y / CHUNK_SIZE, x / CHUNK_SIZE));
+    if (it == this->_chunks.end()) {
+        return TileRecord();
+    }
+    return it->second.Tiles->get(static_cast<unsigned int>((y % CHUNK_SIZE) * CHUNK_SIZE + x % CHUNK_SIZE));
+}
 
-        if (x > this->_size.x || y > this->_size.y) {
-            this->removeTile(tile->getLayer(), sf::Vector2f((x - 1) * this->_tileSize.x * std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")),
-                                                            (y - 1) * this->_tileSize.y * std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))), true);
+// bool setTile
+// Puts a tile in the cell (x, y) and marks its chunk for rebuilding. Returns false if nothing changed.
+// The chunk is allocated by its first tile and freed again when its last tile is erased.
+bool l2d_internal::Layer::setTile(int x, int y, TileRecord tile) {
+    if (x < 0 || y < 0 || x >= this->_size.x || y >= this->_size.y) {
+        return false;
+    }
+    const std::pair<int, int> key(y / CHUNK_SIZE, x / CHUNK_SIZE);
+    auto it = this->_chunks.find(key);
+    if (it == this->_chunks.end()) {
+        if (tile.isEmpty()) {
+            return false;
         }
+        it = this->_chunks.emplace(key, Chunk()).first;
+        it->second.Tiles = std::make_shared<PackedTiles>(CHUNK_SIZE * CHUNK_SIZE);
     }
+    Chunk &chunk = it->second;
+    const unsigned int cell = static_cast<unsigned int>((y % CHUNK_SIZE) * CHUNK_SIZE + x % CHUNK_SIZE);
+    if (chunk.Tiles->get(cell) == tile) {
+        return false;
+    }
+    PackedTiles::makeUnique(chunk.Tiles).set(cell, tile);
+    if (chunk.Tiles->getTileCount() == 0) {
+        this->releaseCache(chunk);
+        this->_chunks.erase(it);
+        return true;
+    }
+    chunk.Dirty = true;
+    this->_hasDirtyChunks = true;
+    return true;
 }
 
-sf::Vector2i l2d_internal::Level::getTileSize() const {
-    return this->_tileSize;
+bool l2d_internal::Layer::isEmpty() const {
+    return this->_chunks.empty();
 }
 
-std::vector<l2d_internal::Tileset> l2d_internal::Level::getTilesetList() {
-    return this->_tilesetList;
+// void forEachTile
+// Calls callback for every tile in the layer, chunk by chunk. Empty chunks are never visited.
+void l2d_internal::Layer::forEachTile(const std::function<void(int x, int y, const TileRecord &tile)> &callback) const {
+    for (const auto &chunk : this->_chunks) {
+        const int left = chunk.first.second * CHUNK_SIZE;
+        const int top = chunk.first.first * CHUNK_SIZE;
+        const std::vector<TileRecord> &palette = chunk.second.Tiles->getPalette();
+        for (unsigned int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; ++i) {
+            const unsigned int index = chunk.second.Tiles->getIndex(i);
+            if (index != 0) {
+                callback(left + static_cast<int>(i % CHUNK_SIZE), top + static_cast<int>(i / CHUNK_SIZE), palette[index]);
+            }
+        }
+    }
 }
 
-std::vector<std::shared_ptr<l2d_internal::Layer>> l2d_internal::Level::getLayerList() {
-    return this->_layerList;
+// void forEachChunkIn
+// Calls callback for every painted chunk in area, which is given in chunks. x and y are the chunk's first cell
+void l2d_internal::Layer::forEachChunkIn(const sf::IntRect &area, const std::function<void(int x, int y, const PackedTiles &tiles)> &callback) const {
+    visitChunks(this->_chunks, area, [&callback](std::map<std::pair<int, int>, Chunk>::const_iterator it) {
+        callback(it->first.second * CHUNK_SIZE, it->first.first * CHUNK_SIZE, *it->second.Tiles);
+    });
 }
 
-float l2d_internal::Level::getAmbientIntensity() const {
-    return this->_ambientIntensity;
+// TileChunkMap getTileChunks
+// Returns the tiles of every painted chunk. They are shared with the layer instead of copied, and the layer
+// copies a chunk before it changes it again, so what is returned stays as it is while the layer is edited
+l2d_internal::TileChunkMap l2d_internal::Layer::getTileChunks() const {
+    TileChunkMap chunks;
+    for (const auto &chunk : this->_chunks) {
+        chunks.emplace_hint(chunks.end(), chunk.first, chunk.second.Tiles);
+    }
+    return chunks;
+}
+
+// void setTileChunks
+// Replaces every tile in the layer with the given chunks, e.g. the ones of a loaded map.
+// The chunks are shared, not copied. Chunks past the edge of the layer and chunks without any tiles are skipped.
+void l2d_internal::Layer::setTileChunks(const TileChunkMap &chunks) {
+    this->releaseCaches();
+    this->_chunks.clear();
+    for (const auto &chunk : chunks) {
+        if (chunk.first.first < 0 || chunk.first.second < 0 || chunk.first.second * CHUNK_SIZE >= this->_size.x ||
+            chunk.first.first * CHUNK_SIZE >= this->_size.y || chunk.second == nullptr || chunk.second->getTileCount() == 0) {
+            continue;
+        }
+        this->_chunks[chunk.first].Tiles = chunk.second;
+    }
+    this->invalidateAll();
 }
 
-sf::Color l2d_internal::Level::getAmbientColor() const {
-    return this->_ambientColor;
+void l2d_internal::Layer::invalidateAll() {
+    this->_rebuildAll = true;
+    this->_hasDirtyChunks = true;
 }
 
-void l2d_internal::Level::setAmbientIntensity(float intensity) {
-    this->_ambientIntensity = intensity;
+// void invalidateCache
+// Forces every cached chunk to be baked again, e.g. after the ambient light changed
+void l2d_internal::Layer::invalidateCache() {
+    for (auto &chunk : this->_chunks) {
+        chunk.second.CacheDirty = true;
+    }
 }
 
-void l2d_internal::Level::setAmbientColor(sf::Color color) {
-    this->_ambientColor = color;
+// void buildChunk
+// Creates the vertices for every tile in one chunk.
+// Tiles whose tileset was packed into the atlas are batched under the atlas page instead of their own texture.
+void l2d_internal::Layer::buildChunk(Chunk &chunk, int chunkX, int chunkY, const TileSources &sources, const TilesetAtlas &atlas) {
+    chunk.Batches.clear();
+    chunk.CacheDirty = true;
+    chunk.Dirty = false;
+
+    const sf::Vector2f tileSize(sources.TileSize);
+    const sf::Vector2f worldSize(tileSize.x * sources.TileScale.x, tileSize.y * sources.TileScale.y);
+    //Remember the last tileset looked up, since neighbouring tiles almost always share one
+    int lastTileset = -1;
+    const TileSource* source = nullptr;
+    const sf::Texture* texture = nullptr;
+    sf::Vector2f offset;
+    sf::VertexArray* quads = nullptr;
+    const std::vector<TileRecord> &palette = chunk.Tiles->getPalette();
+    for (int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; ++i) {
+        const unsigned int index = chunk.Tiles->getIndex(static_cast<unsigned int>(i));
+        if (index == 0) {
+            continue;
+        }
+        const TileRecord &tile = palette[index];
+        if (tile.Tileset != lastTileset) {
+            lastTileset = tile.Tileset;
+            auto it = sources.Tilesets.find(tile.Tileset);
+            source = it == sources.Tilesets.end() || it->second.Texture == nullptr || it->second.Columns <= 0 ? nullptr : &it->second;
+            if (source != nullptr) {
+                texture = source->Texture.get();
+                offset = sf::Vector2f();
+                atlas.lookup(texture, texture, offset);
+                quads = &chunk.Batches[texture];
+                quads->setPrimitiveType(sf::Quads);
+            }
+        }
+        if (source == nullptr) {
+            continue;
+        }
+        const sf::Vector2f src(((tile.Tile - 1) % source->Columns) * tileSize.x + offset.x,
+                               ((tile.Tile - 1) / source->Columns) * tileSize.y + offset.y);
+        const sf::Vector2f dest((chunkX * CHUNK_SIZE + i % CHUNK_SIZE) * worldSize.x,
+                                (chunkY * CHUNK_SIZE + i / CHUNK_SIZE) * worldSize.y);
+        quads->append(sf::Vertex(dest, src));
+        quads->append(sf::Vertex(sf::Vector2f(dest.x + worldSize.x, dest.y), sf::Vector2f(src.x + tileSize.x, src.y)));
+        quads->append(sf::Vertex(dest + worldSize, src + tileSize));
+        quads->append(sf::Vertex(sf::Vector2f(dest.x, dest.y + worldSize.y), sf::Vector2f(src.x, src.y + tileSize.y)));
+    }
 }
 
-void l2d_internal::Level::addShape(std::shared_ptr<l2d_internal::Shape> shape) {
-    this->_shapeList.push_back(shape);
+// void rebuildChunks
+// Regenerates the vertex arrays of every dirty chunk, or of every chunk if everything was invalidated
+void l2d_internal::Layer::rebuildChunks(const TileSources &sources, const TilesetAtlas &atlas) {
+    for (auto &chunk : this->_chunks) {
+        if (this->_rebuildAll || chunk.second.Dirty) {
+            this->buildChunk(chunk.second, chunk.first.second, chunk.first.first, sources, atlas);
+        }
+    }
+    this->_rebuildAll = false;
+    this->_hasDirtyChunks = false;
+}
+
+// void bakeChunk
+// Renders the chunk's tiles, with the ambient light applied, into its render texture at the tileset's own resolution.
+// A chunk that isn't cached yet needs room in the cache, see ChunkCache::reserve
+void l2d_internal::Layer::bakeChunk(Chunk &chunk, const sf::FloatRect &bounds, sf::Vector2u size, sf::Shader* ambientLight) {
+    if (chunk.Cache == nullptr) {
+        chunk.Cache = std::make_shared<sf::RenderTexture>();
+        if (!chunk.Cache->create(size.x, size.y)) {
+            chunk.Cache = nullptr;
+            return;
+        }
+        chunk.CacheEntry = this->_cache->add(&chunk.Cache);
+    }
+    chunk.Cache->clear(sf::Color::Transparent);
+    chunk.Cache->setView(sf::View(bounds));
+    for (auto &batch : chunk.Batches) {
+        sf::RenderStates states(batch.first);
+        states.shader = ambientLight;
+        chunk.Cache->draw(&batch.second[0], batch.second.getVertexCount(), sf::Quads, states);
+    }
+    chunk.Cache->display();
+    chunk.CacheDirty = false;
 }
 
-std::vector<std::shared_ptr<l2d_internal::Shape>> l2d_internal::Level::getShapeList() {
-    return this->_shapeList;
+// void releaseCache
+// Frees the chunk's render texture and takes it out of the cache
+void l2d_internal::Layer::releaseCache(Chunk &chunk) {
+    if (chunk.Cache == nullptr) {
+        return;
+    }
+    this->_cache->remove(chunk.CacheEntry);
+    chunk.Cache = nullptr;
+    chunk.CacheDirty = true;
 }
 
-void l2d_internal::Level::createMap(std::string name, sf::Vector2i size, sf::Vector2i tileSize) {
-    this->_layerList.clear();
-    this->_shapeList.clear();
-    this->_oldLayerList = std::stack<std::vector<std::shared_ptr<Layer>>>();
-    this->_redoList = std::stack<std::vector<std::shared_ptr<Layer>>>();
-    this->_tilesetList.clear();
-    this->_ambientColor = sf::Color::White;
-    this->_ambientIntensity = 1.0f;
-    this->_name = name;
-    this->_size = size;
-    this->_tileSize = tileSize;
-    this->saveMap(name);
-    this->loadMap(name);
+void l2d_internal::Layer::releaseCaches() {
+    for (auto &chunk : this->_chunks) {
+        this->releaseCache(chunk.second);
+    }
 }
 
-std::string l2d_internal::Level::loadMap(std::string &name) {
-    if (name == "l2dSTART") {
-        return "";
+// void draw
+// Draws the chunks in view. With a cache, chunks are baked into render textures and drawn from those while they
+// are unchanged. Without one, the chunks' render textures are freed
+void l2d_internal::Layer::draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics, const TileSources &sources,
+                               const TilesetAtlas &atlas, ChunkCache* cache) {
+    if (cache != this->_cache) {
+        this->releaseCaches();
+        this->_cache = cache;
+    }
+    if (this->_atlasVersion != atlas.getVersion() || this->_sourcesVersion != sources.Version) {
+        this->_atlasVersion = atlas.getVersion();
+        this->_sourcesVersion = sources.Version;
+        this->invalidateAll();
+    }
+    if (this->_hasDirtyChunks) {
+        this->rebuildChunks(sources, atlas);
+    }
+    RenderStats &stats = graphics.getRenderStats();
+    const sf::FloatRect viewBounds = graphics.getViewBounds();
+    const sf::Vector2f chunkSize(sources.TileSize.x * sources.TileScale.x * CHUNK_SIZE, sources.TileSize.y * sources.TileScale.y * CHUNK_SIZE);
+    const sf::Vector2u cacheSize(static_cast<unsigned int>(sources.TileSize.x * CHUNK_SIZE), static_cast<unsigned int>(sources.TileSize.y * CHUNK_SIZE));
+    if (chunkSize.x <= 0.0f || chunkSize.y <= 0.0f) {
+        return;
+    }
+    //Only visit the chunks in the rows and columns the view covers instead of testing every chunk of the layer
+    const int firstRow = static_cast<int>(std::floor(viewBounds.top / chunkSize.y));
+    const int lastRow = static_cast<int>(std::floor((viewBounds.top + viewBounds.height) / chunkSize.y));
+    const int firstColumn = static_cast<int>(std::floor(viewBounds.left / chunkSize.x));
+    const int lastColumn = static_cast<int>(std::floor((viewBounds.left + viewBounds.width) / chunkSize.x));
+    std::vector<std::map<std::pair<int, int>, Chunk>::iterator> visible;
+    visitChunks(this->_chunks, sf::IntRect(firstColumn, firstRow, lastColumn - firstColumn + 1, lastRow - firstRow + 1),
+                [&visible](std::map<std::pair<int, int>, Chunk>::iterator it) {
+        visible.push_back(it);
+    });
+    stats.ChunksDrawn += static_cast<unsigned int>(visible.size());
+    stats.ChunksCulled += static_cast<unsigned int>(this->_chunks.size() - visible.size());
+    for (auto &chunk : visible) {
+        sf::FloatRect chunkBounds(chunk->first.second * chunkSize.x, chunk->first.first * chunkSize.y, chunkSize.x, chunkSize.y);
+        for (auto &batch : chunk->second.Batches) {
+            stats.TilesDrawn += static_cast<unsigned int>(batch.second.getVertexCount() / 4);
+        }
+
+        if (cache != nullptr) {
+            const bool cached = chunk->second.Cache != nullptr;
+            if (cached) {
+                cache->touch(chunk->second.CacheEntry);
+            }
+            //With more chunks on screen than the cache can hold, the ones that don't fit are drawn from their vertices
+            if (cached ? chunk->second.CacheDirty : cache->reserve()) {
+                this->bakeChunk(chunk->second, chunkBounds, cacheSize, ambientLight);
+                ++stats.ChunksBaked;
+            }
+        }
+        if (chunk->second.Cache != nullptr && !chunk->second.CacheDirty) {
+            //The cache already has the ambient light applied and holds premultiplied colours
+            const float right = chunkBounds.left + chunkBounds.width;
+            const float bottom = chunkBounds.top + chunkBounds.height;
+            const sf::Vector2f size(chunk->second.Cache->getSize());
+            sf::Vertex quad[4] = {
+                    sf::Vertex(sf::Vector2f(chunkBounds.left, chunkBounds.top), sf::Vector2f(0.0f, 0.0f)),
+                    sf::Vertex(sf::Vector2f(right, chunkBounds.top), sf::Vector2f(size.x, 0.0f)),
+                    sf::Vertex(sf::Vector2f(right, bottom), sf::Vector2f(size.x, size.y)),
+                    sf::Vertex(sf::Vector2f(chunkBounds.left, bottom), sf::Vector2f(0.0f, size.y))
+            };
+            sf::RenderStates states(&chunk->second.Cache->getTexture());
+            states.blendMode = sf::BlendMode(sf::BlendMode::One, sf::BlendMode::OneMinusSrcAlpha);
+            graphics.draw(quad, 4, sf::Quads, states, this->Id);
+            continue;
+        }
+        for (auto &batch : chunk->second.Batches) {
+            sf::RenderStates states(batch.first);
+            states.shader = ambientLight;
+            //Not copied: chunks are only rebuilt at the start of the next draw, and tiles aren't edited while a frame is rendered
+            graphics.drawBuffer(batch.second, states, this->Id);
+        }
+    }
+}
+
+/*
+ * BackgroundLayer
+ */
+l2d_internal::BackgroundLayer::BackgroundLayer() :
+        _scale(1.25f),
+        _parallax(1.0f, 1.0f)
+{}
+
+l2d_internal::BackgroundLayer::BackgroundLayer(std::shared_ptr<Graphics> &graphics, const std::string &filePath, sf::Vector2i levelSize,
+                                               sf::Vector2i tileSize, float scale, sf::Vector2f parallax) :
+        _filePath(filePath),
+        _scale(scale),
+        _parallax(parallax)
+{
+    this->_texture = graphics->loadImage(filePath);
+    this->_texture->setRepeated(true);
+    this->setLevelSize(levelSize, tileSize);
+}
+
+const std::string &l2d_internal::BackgroundLayer::getPath() const {
+    return this->_filePath;
+}
+
+float l2d_internal::BackgroundLayer::getScale() const {
+    return this->_scale;
+}
+
+sf::Vector2f l2d_internal::BackgroundLayer::getParallax() const {
+    return this->_parallax;
+}
+
+void l2d_internal::BackgroundLayer::setLevelSize(sf::Vector2i levelSize, sf::Vector2i tileSize) {
+    this->_levelBounds = sf::FloatRect(0.0f, 0.0f,
+                                       levelSize.x * tileSize.x * l2d_internal::Config::get().TileScale.x,
+                                       levelSize.y * tileSize.y * l2d_internal::Config::get().TileScale.y);
+}
+
+// void draw
+// layer is the draw order key of this background layer, so overlapping backgrounds keep their order when batched
+void l2d_internal::BackgroundLayer::draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics, int layer) {
+    RenderStats &stats = graphics.getRenderStats();
+    sf::FloatRect visible;
+    if (this->_texture == nullptr || this->_scale <= 0 || !this->_levelBounds.intersects(graphics.getViewBounds(), visible)) {
+        ++stats.SpritesCulled;
+        return;
+    }
+    ++stats.SpritesDrawn;
+
+    //The image scrolls with the camera by (1 - parallax), and the texture repeats every (texture size * scale) world units
+    const sf::Vector2f viewCenter = graphics.getView().getCenter();
+    const sf::Vector2f offset(viewCenter.x * (1.0f - this->_parallax.x), viewCenter.y * (1.0f - this->_parallax.y));
+    auto texCoords = [&](float x, float y) -> sf::Vector2f {
+        return sf::Vector2f((x - offset.x) / this->_scale, (y - offset.y) / this->_scale);
+    };
+    const float right = visible.left + visible.width;
+    const float bottom = visible.top + visible.height;
+    sf::Vertex quad[4] = {
+            sf::Vertex(sf::Vector2f(visible.left, visible.top), texCoords(visible.left, visible.top)),
+            sf::Vertex(sf::Vector2f(right, visible.top), texCoords(right, visible.top)),
+            sf::Vertex(sf::Vector2f(right, bottom), texCoords(right, bottom)),
+            sf::Vertex(sf::Vector2f(visible.left, bottom), texCoords(visible.left, bottom))
+    };
+    sf::RenderStates states(this->_texture.get());
+    states.shader = ambientLight;
+    graphics.draw(quad, 4, sf::Quads, states, layer);
+}
+
+void l2d_internal::BackgroundLayer::update(float elapsedTime) {
+    (void)elapsedTime;
+}
+
+/*
+ * Background
+ */
+l2d_internal::Background::Background() {
+    
+}
+
+void l2d_internal::Background::draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics) {
+    //Each background layer gets its own key so they are drawn in id order, whatever their textures
+    for (auto &l : this->_layers) {
+        l.second.draw(ambientLight, graphics, Graphics::BACKGROUND_LAYER + l.first);
+    }
+}
+
+const std::map<int, l2d_internal::BackgroundLayer> &l2d_internal::Background::getLayers() const {
+    return this->_layers;
+}
+
+void l2d_internal::Background::addLayer(std::shared_ptr<Graphics> &graphics, const std::string &filePath, sf::Vector2i levelSize,
+                                        sf::Vector2i tileSize, float scale, sf::Vector2f parallax) {
+    auto n = this->_layers.empty() ? 0 : this->_layers.rbegin()->first + 1;
+    this->_layers[n] = BackgroundLayer(graphics, filePath, levelSize, tileSize, scale, parallax);
+}
+
+void l2d_internal::Background::setLevelSize(sf::Vector2i levelSize, sf::Vector2i tileSize) {
+    for (auto &l : this->_layers) {
+        l.second.setLevelSize(levelSize, tileSize);
+    }
+}
+
+void l2d_internal::Background::clear() {
+    this->_layers.clear();
+}
+
+/*
+ * ShapeIndex
+ */
+
+l2d_internal::ShapeIndex::ShapeIndex(float cellSize) :
+        _cellSize(cellSize),
+        _nextOrder(0),
+        _queryStamp(0)
+{}
+
+void l2d_internal::ShapeIndex::clear() {
+    this->_items.clear();
+    this->_cells.clear();
+    this->_large.clear();
+}
+
+long long l2d_internal::ShapeIndex::getCellKey(int x, int y) {
+    return (static_cast<long long>(x) << 32) | static_cast<unsigned int>(y);
+}
+
+// void link
+// Works out which cells the item's bounds touch and adds it to each of them
+void l2d_internal::ShapeIndex::link(Item &item) {
+    item.Bounds = item.Target->getBounds();
+    const int left = static_cast<int>(std::floor(item.Bounds.left / this->_cellSize));
+    const int top = static_cast<int>(std::floor(item.Bounds.top / this->_cellSize));
+    const int right = static_cast<int>(std::floor((item.Bounds.left + item.Bounds.width) / this->_cellSize));
+    const int bottom = static_cast<int>(std::floor((item.Bounds.top + item.Bounds.height) / this->_cellSize));
+    item.Cells = sf::IntRect(left, top, right - left + 1, bottom - top + 1);
+    item.Large = item.Cells.width * item.Cells.height > MAX_CELLS_PER_SHAPE;
+    if (item.Large) {
+        this->_large.push_back(item.Target.get());
+        return;
+    }
+    for (int y = top; y <= bottom; ++y) {
+        for (int x = left; x <= right; ++x) {
+            this->_cells[getCellKey(x, y)].push_back(item.Target.get());
+        }
+    }
+}
+
+void l2d_internal::ShapeIndex::unlink(const Item &item) {
+    const l2d_internal::Shape* shape = item.Target.get();
+    if (item.Large) {
+        this->_large.erase(std::remove(this->_large.begin(), this->_large.end(), shape), this->_large.end());
+        return;
+    }
+    for (int y = item.Cells.top; y < item.Cells.top + item.Cells.height; ++y) {
+        for (int x = item.Cells.left; x < item.Cells.left + item.Cells.width; ++x) {
+            auto cell = this->_cells.find(getCellKey(x, y));
+            if (cell == this->_cells.end()) {
+                continue;
+            }
+            auto it = std::find(cell->second.begin(), cell->second.end(), shape);
+            if (it != cell->second.end()) {
+                //Order inside a cell doesn't matter, so swap with the last one instead of shifting
+                *it = cell->second.back();
+                cell->second.pop_back();
+            }
+            if (cell->second.empty()) {
+                this->_cells.erase(cell);
+            }
+        }
+    }
+}
+
+// void insert
+// Adds a shape in front of every shape already in the index
+void l2d_internal::ShapeIndex::insert(const std::shared_ptr<Shape> &shape) {
+    if (shape == nullptr || this->contains(shape)) {
+        return;
+    }
+    Item &item = this->_items[shape.get()];
+    item.Target = shape;
+    item.Order = this->_nextOrder++;
+    item.QueryStamp = 0;
+    this->link(item);
+}
+
+// void replace
+// Puts a shape in the place of another one, keeping its position in the back to front order
+void l2d_internal::ShapeIndex::replace(const std::shared_ptr<Shape> &from, const std::shared_ptr<Shape> &to) {
+    auto it = this->_items.find(from.get());
+    if (it == this->_items.end()) {
+        this->insert(to);
+        return;
+    }
+    const unsigned long long order = it->second.Order;
+    this->remove(from);
+    if (to == nullptr || this->contains(to)) {
+        return;
+    }
+    Item &item = this->_items[to.get()];
+    item.Target = to;
+    item.Order = order;
+    item.QueryStamp = 0;
+    this->link(item);
+}
+
+// void update
+// Call after a shape was moved or resized so it can be found at its new position
+void l2d_internal::ShapeIndex::update(const std::shared_ptr<Shape> &shape) {
+    auto it = this->_items.find(shape.get());
+    if (it == this->_items.end()) {
+        return;
+    }
+    if (it->second.Bounds == shape->getBounds()) {
+        return;
+    }
+    this->unlink(it->second);
+    this->link(it->second);
+}
+
+void l2d_internal::ShapeIndex::remove(const std::shared_ptr<Shape> &shape) {
+    auto it = this->_items.find(shape.get());
+    if (it == this->_items.end()) {
+        return;
+    }
+    this->unlink(it->second);
+    this->_items.erase(it);
+}
+
+bool l2d_internal::ShapeIndex::contains(const std::shared_ptr<Shape> &shape) const {
+    return this->_items.find(shape.get()) != this->_items.end();
+}
+
+// void collect
+// Finds every item whose bounds touch area, each one once, sorted back to front
+void l2d_internal::ShapeIndex::collect(const sf::FloatRect &area, std::vector<const Item*> &items) const {
+    //The stamp marks items already found by this query, since a shape can be in several cells
+    if (++this->_queryStamp == 0) {
+        for (auto &item : this->_items) {
+            item.second.QueryStamp = 0;
+        }
+        this->_queryStamp = 1;
+    }
+    auto visit = [&](const l2d_internal::Shape* shape) {
+        const Item &item = this->_items.find(shape)->second;
+        if (item.QueryStamp != this->_queryStamp) {
+            item.QueryStamp = this->_queryStamp;
+            //Zero sized bounds (e.g. a point query) still count when they touch
+            if (area.left <= item.Bounds.left + item.Bounds.width && item.Bounds.left <= area.left + area.width &&
+                area.top <= item.Bounds.top + item.Bounds.height && item.Bounds.top <= area.top + area.height) {
+                items.push_back(&item);
+            }
+        }
+    };
+    const int left = static_cast<int>(std::floor(area.left / this->_cellSize));
+    const int top = static_cast<int>(std::floor(area.top / this->_cellSize));
+    const int right = static_cast<int>(std::floor((area.left + area.width) / this->_cellSize));
+    const int bottom = static_cast<int>(std::floor((area.top + area.height) / this->_cellSize));
+    if (static_cast<long long>(right - left + 1) * (bottom - top + 1) > static_cast<long long>(this->_cells.size())) {
+        //The area covers more cells than are in use, so walking the used cells is cheaper
+        for (auto &cell : this->_cells) {
+            for (const l2d_internal::Shape* shape : cell.second) {
+                visit(shape);
+            }
+        }
+    }
+    else {
+        for (int y = top; y <= bottom; ++y) {
+            for (int x = left; x <= right; ++x) {
+                auto cell = this->_cells.find(getCellKey(x, y));
+                if (cell != this->_cells.end()) {
+                    for (const l2d_internal::Shape* shape : cell->second) {
+                        visit(shape);
+                    }
+                }
+            }
+        }
+    }
+    for (const l2d_internal::Shape* shape : this->_large) {
+        visit(shape);
+    }
+    std::sort(items.begin(), items.end(), [](const Item* a, const Item* b) {
+        return a->Order < b->Order;
+    });
+}
+
+// void query
+// Adds every shape whose bounds touch area to result, back to front
+void l2d_internal::ShapeIndex::query(const sf::FloatRect &area, std::vector<std::shared_ptr<Shape>> &result) const {
+    std::vector<const Item*> items;
+    this->collect(area, items);
+    for (const Item* item : items) {
+        result.push_back(item->Target);
+    }
+}
+
+// std::shared_ptr<Shape> queryPoint
+// Returns the front-most shape that point is inside of, or nullptr if there isn't one
+std::shared_ptr<l2d_internal::Shape> l2d_internal::ShapeIndex::queryPoint(sf::Vector2f point) const {
+    std::vector<const Item*> items;
+    this->collect(sf::FloatRect(point.x, point.y, 1.0f, 1.0f), items);
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+        if ((*it)->Target->isPointInside(point)) {
+            return (*it)->Target;
+        }
+    }
+    return nullptr;
+}
+
+std::size_t l2d_internal::ShapeIndex::size() const {
+    return this->_items.size();
+}
+
+/*
+ * UndoJournal
+ */
+
+bool l2d_internal::UndoJournal::Entry::isEmpty() const {
+    return this->Tiles.empty() && this->Shapes.empty() && !this->AmbientChanged;
+}
+
+// std::size_t getMemoryUsage
+// Roughly how many bytes the entry keeps alive. The copies of shapes are small next to the tiles, so only their pointers are counted.
+std::size_t l2d_internal::UndoJournal::Entry::getMemoryUsage() const {
+    return sizeof(Entry) + this->Tiles.capacity() * sizeof(TileChange) + this->Shapes.capacity() * sizeof(ShapeChange);
+}
+
+l2d_internal::UndoJournal::UndoJournal(std::size_t budget) :
+        _budget(budget),
+        _strokeActive(false),
+        _strokeOpen(false)
+{}
+
+// void beginStroke
+// Starts grouping every change into a single entry until endStroke. If the last stroke never got its
+// endStroke (e.g. the button was released outside of the window), it is finished here instead
+void l2d_internal::UndoJournal::beginStroke() {
+    this->closeEntry();
+    this->_strokeActive = true;
+}
+
+void l2d_internal::UndoJournal::endStroke() {
+    if (!this->_strokeActive) {
+        return;
+    }
+    this->_strokeActive = false;
+    this->closeEntry();
+}
+
+// Entry &getOpenEntry
+// Returns the entry that changes are being added to, starting a new one if needed.
+// Any change throws away what could have been redone.
+l2d_internal::UndoJournal::Entry &l2d_internal::UndoJournal::getOpenEntry() {
+    if (!this->_strokeOpen) {
+        this->_undo.emplace_back();
+        this->_strokeOpen = true;
+        this->_strokeCells.clear();
+    }
+    this->_redo.clear();
+    return this->_undo.back();
+}
+
+// void closeEntry
+// Finishes the open entry. Entries that ended up changing nothing are dropped.
+void l2d_internal::UndoJournal::closeEntry() {
+    if (!this->_strokeOpen) {
+        return;
+    }
+    this->_strokeOpen = false;
+    this->_strokeCells.clear();
+    Entry &entry = this->_undo.back();
+    //Cells that were painted and then painted back to what they were don't need undoing
+    entry.Tiles.erase(std::remove_if(entry.Tiles.begin(), entry.Tiles.end(), [](const TileChange &change) {
+        return change.Before == change.After;
+    }), entry.Tiles.end());
+    if (entry.AmbientChanged && entry.AmbientColorBefore == entry.AmbientColorAfter && entry.AmbientIntensityBefore == entry.AmbientIntensityAfter) {
+        entry.AmbientChanged = false;
+    }
+    if (entry.isEmpty()) {
+        this->_undo.pop_back();
+    }
+    this->enforceBudget();
+}
+
+void l2d_internal::UndoJournal::recordTile(int layer, sf::Vector2i cell, TileRecord before, TileRecord after) {
+    if (before == after) {
+        return;
+    }
+    Entry &entry = this->getOpenEntry();
+    auto key = std::make_tuple(layer, cell.x, cell.y);
+    auto it = this->_strokeCells.find(key);
+    if (it != this->_strokeCells.end()) {
+        //Same cell again in this stroke. Keep what it was before the stroke started
+        entry.Tiles[it->second].After = after;
+    }
+    else {
+        this->_strokeCells[key] = entry.Tiles.size();
+        entry.Tiles.push_back(TileChange{layer, cell, before, after});
+    }
+    if (!this->_strokeActive) {
+        this->closeEntry();
+    }
+}
+
+void l2d_internal::UndoJournal::recordShape(std::shared_ptr<Shape> before, std::shared_ptr<Shape> after) {
+    if (before == after) {
+        return;
+    }
+    Entry &entry = this->getOpenEntry();
+    entry.Shapes.push_back(ShapeChange{before, after});
+    if (!this->_strokeActive) {
+        this->closeEntry();
+    }
+}
+
+// void recordAmbient
+// Only the ambient light from before the first change and after the last change of an entry are kept,
+// so dragging a slider is a single undo step
+void l2d_internal::UndoJournal::recordAmbient(sf::Color colorBefore, float intensityBefore, sf::Color colorAfter, float intensityAfter) {
+    if (colorBefore == colorAfter && intensityBefore == intensityAfter) {
+        return;
+    }
+    Entry &entry = this->getOpenEntry();
+    if (!entry.AmbientChanged) {
+        entry.AmbientChanged = true;
+        entry.AmbientColorBefore = colorBefore;
+        entry.AmbientIntensityBefore = intensityBefore;
+    }
+    entry.AmbientColorAfter = colorAfter;
+    entry.AmbientIntensityAfter = intensityAfter;
+    if (!this->_strokeActive) {
+        this->closeEntry();
+    }
+}
+
+// const Entry* undo
+// Moves the newest entry to the redo list and returns it so its changes can be reverted.
+// Returns nullptr if there is nothing to undo.
+const l2d_internal::UndoJournal::Entry* l2d_internal::UndoJournal::undo() {
+    this->closeEntry();
+    if (this->_undo.empty()) {
+        return nullptr;
+    }
+    this->_redo.push_back(std::move(this->_undo.back()));
+    this->_undo.pop_back();
+    return &this->_redo.back();
+}
+
+// void forEachTileChange
+// Calls callback for every tile change that can still be undone or redone
+void l2d_internal::UndoJournal::forEachTileChange(const std::function<void(const TileChange &change)> &callback) const {
+    for (const std::deque<Entry>* entries : { &this->_undo, &this->_redo }) {
+        for (const Entry &entry : *entries) {
+            for (const TileChange &change : entry.Tiles) {
+                callback(change);
+            }
+        }
+    }
+}
+
+// const Entry* redo
+// Moves the newest undone entry back to the undo list and returns it so its changes can be applied again.
+// Returns nullptr if there is nothing to redo.
+const l2d_internal::UndoJournal::Entry* l2d_internal::UndoJournal::redo() {
+    this->closeEntry();
+    if (this->_redo.empty()) {
+        return nullptr;
+    }
+    this->_undo.push_back(std::move(this->_redo.back()));
+    this->_redo.pop_back();
+    return &this->_undo.back();
+}
+
+bool l2d_internal::UndoJournal::canUndo() const {
+    return !this->_undo.empty();
+}
+
+bool l2d_internal::UndoJournal::canRedo() const {
+    return !this->_redo.empty();
+}
+
+void l2d_internal::UndoJournal::clear() {
+    this->_undo.clear();
+    this->_redo.clear();
+    this->_strokeCells.clear();
+    this->_strokeActive = false;
+    this->_strokeOpen = false;
+}
+
+void l2d_internal::UndoJournal::setBudget(std::size_t budget) {
+    this->_budget = budget;
+    this->enforceBudget();
+}
+
+// std::size_t getMemoryUsage
+// Roughly how many bytes the undo and redo entries take
+std::size_t l2d_internal::UndoJournal::getMemoryUsage() const {
+    std::size_t usage = 0;
+    for (const Entry &entry : this->_undo) {
+        usage += entry.getMemoryUsage();
+    }
+    for (const Entry &entry : this->_redo) {
+        usage += entry.getMemoryUsage();
+    }
+    return usage;
+}
+
+// void enforceBudget
+// Forgets the oldest entries until the journal fits in its budget again. The newest entry is always kept.
+void l2d_internal::UndoJournal::enforceBudget() {
+    std::size_t usage = this->getMemoryUsage();
+    while (usage > this->_budget && !this->_redo.empty()) {
+        usage -= this->_redo.front().getMemoryUsage();
+        this->_redo.pop_front();
+    }
+    while (usage > this->_budget && this->_undo.size() > 1) {
+        usage -= this->_undo.front().getMemoryUsage();
+        this->_undo.pop_front();
+    }
+}
+
+/*
+ * ShapePool
+ */
+
+l2d_internal::ShapePool::ShapePool() :
+    _liveCount(0)
+{}
+
+// std::size_t getBlockSize
+// Rounds a request up so every block stays aligned for any type
+std::size_t l2d_internal::ShapePool::getBlockSize(std::size_t size) {
+    const std::size_t alignment = alignof(std::max_align_t);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Slot &getSlot
+// Every type of shape has its own slot, so all blocks of a slot are the same size and no lookup is needed
+l2d_internal::ShapePool::Slot &l2d_internal::ShapePool::getSlot(DrawShapes shapeType) {
+    return this->_slots[static_cast<std::size_t>(shapeType) - static_cast<std::size_t>(DrawShapes::Rectangle)];
+}
+
+// void* allocate
+// shapeType is the type of shape the memory is for. The first allocation of a slot decides its block size,
+// which is the size of that shape's std::allocate_shared control block. Anything else goes to the heap
+void* l2d_internal::ShapePool::allocate(DrawShapes shapeType, std::size_t size) {
+    Slot &slot = this->getSlot(shapeType);
+    std::size_t blockSize = getBlockSize(size);
+    if (slot.BlockSize == 0) {
+        slot.BlockSize = blockSize;
+    }
+    ++this->_liveCount;
+    if (blockSize != slot.BlockSize) {
+        return ::operator new(size);
+    }
+    if (!slot.FreeBlocks.empty()) {
+        void* block = slot.FreeBlocks.back();
+        slot.FreeBlocks.pop_back();
+        return block;
+    }
+    if (slot.NextBlock == BLOCKS_PER_SLAB) {
+        ++slot.NextSlab;
+        slot.NextBlock = 0;
+    }
+    if (slot.NextSlab == slot.Slabs.size()) {
+        slot.Slabs.emplace_back(new char[blockSize * BLOCKS_PER_SLAB]);
+    }
+    void* block = slot.Slabs[slot.NextSlab].get() + slot.NextBlock * blockSize;
+    ++slot.NextBlock;
+    return block;
+}
+
+void l2d_internal::ShapePool::deallocate(DrawShapes shapeType, void* p, std::size_t size) {
+    if (p == nullptr) {
+        return;
+    }
+    Slot &slot = this->getSlot(shapeType);
+    if (getBlockSize(size) != slot.BlockSize) {
+        ::operator delete(p);
+    }
+    else {
+        slot.FreeBlocks.push_back(p);
+    }
+    --this->_liveCount;
+}
+
+// void reset
+// Forgets every block at once so the next allocations start from the front of the first slab again.
+// The slabs themselves are kept for the next map. Does nothing while a block is still in use.
+void l2d_internal::ShapePool::reset() {
+    if (this->_liveCount > 0) {
+        return;
+    }
+    for (Slot &slot : this->_slots) {
+        slot.FreeBlocks.clear();
+        slot.NextSlab = 0;
+        slot.NextBlock = 0;
+    }
+}
+
+std::size_t l2d_internal::ShapePool::getLiveCount() const {
+    return this->_liveCount;
+}
+
+std::size_t l2d_internal::ShapePool::getReservedBytes() const {
+    std::size_t bytes = 0;
+    for (const Slot &slot : this->_slots) {
+        bytes += slot.BlockSize * BLOCKS_PER_SLAB * slot.Slabs.size();
+    }
+    return bytes;
+}
+
+/*
+ * MappedFile
+ */
+
+l2d_internal::MappedFile::MappedFile() :
+    _data(nullptr),
+    _size(0),
+#ifdef _WIN32
+    _file(INVALID_HANDLE_VALUE),
+    _mapping(nullptr)
+#else
+    _file(-1)
+#endif
+{}
+
+l2d_internal::MappedFile::~MappedFile() {
+    this->close();
+}
+
+// bool open
+// Maps filePath into memory. Returns false if the file can't be opened or is empty
+bool l2d_internal::MappedFile::open(const std::string &filePath) {
+    this->close();
+#ifdef _WIN32
+    this->_file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (this->_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(this->_file, &size) || size.QuadPart == 0) {
+        this->close();
+        return false;
+    }
+    this->_mapping = CreateFileMappingA(this->_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (this->_mapping == nullptr) {
+        this->close();
+        return false;
+    }
+    this->_data = static_cast<const char*>(MapViewOfFile(this->_mapping, FILE_MAP_READ, 0, 0, 0));
+    this->_size = static_cast<std::size_t>(size.QuadPart);
+#else
+    this->_file = ::open(filePath.c_str(), O_RDONLY);
+    if (this->_file < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(this->_file, &info) != 0 || info.st_size == 0) {
+        this->close();
+        return false;
+    }
+    void* data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, this->_file, 0);
+    this->_data = data == MAP_FAILED ? nullptr : static_cast<const char*>(data);
+    this->_size = static_cast<std::size_t>(info.st_size);
+#endif
+    if (this->_data == nullptr) {
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+void l2d_internal::MappedFile::close() {
+#ifdef _WIN32
+    if (this->_data != nullptr) {
+        UnmapViewOfFile(this->_data);
+    }
+    if (this->_mapping != nullptr) {
+        CloseHandle(this->_mapping);
+    }
+    if (this->_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->_file);
+    }
+    this->_mapping = nullptr;
+    this->_file = INVALID_HANDLE_VALUE;
+#else
+    if (this->_data != nullptr) {
+        munmap(const_cast<char*>(this->_data), this->_size);
+    }
+    if (this->_file >= 0) {
+        ::close(this->_file);
+    }
+    this->_file = -1;
+#endif
+    this->_data = nullptr;
+    this->_size = 0;
+}
+
+const char* l2d_internal::MappedFile::getData() const {
+    return this->_data;
+}
+
+std::size_t l2d_internal::MappedFile::getSize() const {
+    return this->_size;
+}
+
+/*
+ * XmlPullParser
+ */
+
+l2d_internal::XmlPullParser::XmlPullParser(const char* data, std::size_t size) :
+    _pos(data),
+    _end(data + size),
+    _name { data, data },
+    _text { data, data },
+    _rawText(false),
+    _pendingEnd(false)
+{}
+
+l2d_internal::XmlPullParser::Event l2d_internal::XmlPullParser::fail(const std::string &error) {
+    this->_error = error;
+    this->_pos = this->_end;
+    return Event::Error;
+}
+
+// const char* find
+// Returns where pattern next appears from the current position on, or nullptr if it doesn't
+const char* l2d_internal::XmlPullParser::find(const char* pattern) const {
+    const char* found = std::search(this->_pos, this->_end, pattern, pattern + std::strlen(pattern));
+    return found == this->_end ? nullptr : found;
+}
+
+// Event next
+// Moves on to the next element start, element end or piece of text. Declarations, comments and text
+// that is only whitespace are skipped.
+l2d_internal::XmlPullParser::Event l2d_internal::XmlPullParser::next() {
+    if (this->_pendingEnd) {
+        this->_pendingEnd = false;
+        return Event::EndElement;
+    }
+    while (this->_pos < this->_end) {
+        //Text
+        if (*this->_pos != '<') {
+            const char* lt = static_cast<const char*>(std::memchr(this->_pos, '<', static_cast<std::size_t>(this->_end - this->_pos)));
+            this->_text = Span { this->_pos, lt == nullptr ? this->_end : lt };
+            this->_rawText = false;
+            this->_pos = this->_text.End;
+            if (std::any_of(this->_text.Begin, this->_text.End, [](char c) { return !std::isspace(static_cast<unsigned char>(c)); })) {
+                return Event::Text;
+            }
+            continue;
+        }
+        const std::size_t left = static_cast<std::size_t>(this->_end - this->_pos);
+        //Declarations, comments, CDATA and doctypes
+        if (left >= 2 && this->_pos[1] == '?') {
+            const char* close = this->find("?>");
+            if (close == nullptr) {
+                return this->fail("Unterminated declaration");
+            }
+            this->_pos = close + 2;
+            continue;
+        }
+        if (left >= 4 && std::strncmp(this->_pos, "<!--", 4) == 0) {
+            const char* close = this->find("-->");
+            if (close == nullptr) {
+                return this->fail("Unterminated comment");
+            }
+            this->_pos = close + 3;
+            continue;
+        }
+        if (left >= 9 && std::strncmp(this->_pos, "<![CDATA[", 9) == 0) {
+            const char* close = this->find("]]>");
+            if (close == nullptr) {
+                return this->fail("Unterminated CDATA section");
+            }
+            this->_text = Span { this->_pos + 9, close };
+            this->_rawText = true;
+            this->_pos = close + 3;
+            return Event::Text;
+        }
+        if (left >= 2 && this->_pos[1] == '!') {
+            const char* close = this->find(">");
+            if (close == nullptr) {
+                return this->fail("Unterminated doctype");
+            }
+            this->_pos = close + 1;
+            continue;
+        }
+
+        //Element start or end
+        auto isNameEnd = [](char c) {
+            return std::isspace(static_cast<unsigned char>(c)) || c == '/' || c == '>' || c == '=';
+        };
+        const bool isEnd = left >= 2 && this->_pos[1] == '/';
+        const char* p = this->_pos + (isEnd ? 2 : 1);
+        this->_name.Begin = p;
+        while (p < this->_end && !isNameEnd(*p)) {
+            ++p;
+        }
+        this->_name.End = p;
+        if (this->_name.Begin == this->_name.End) {
+            return this->fail("Element without a name");
+        }
+        if (isEnd) {
+            this->_pos = this->find(">");
+            if (this->_pos == nullptr) {
+                return this->fail("Unterminated element end");
+            }
+            ++this->_pos;
+            return Event::EndElement;
+        }
+        this->_attributes.clear();
+        while (true) {
+            while (p < this->_end && std::isspace(static_cast<unsigned char>(*p))) {
+                ++p;
+            }
+            if (p >= this->_end) {
+                return this->fail("Unterminated element");
+            }
+            if (*p == '>') {
+                ++p;
+                break;
+            }
+            if (*p == '/') {
+                if (p + 1 >= this->_end || p[1] != '>') {
+                    return this->fail("Unexpected '/' in element");
+                }
+                p += 2;
+                this->_pendingEnd = true;
+                break;
+            }
+            Attribute attribute;
+            attribute.Name.Begin = p;
+            while (p < this->_end && !isNameEnd(*p)) {
+                ++p;
+            }
+            attribute.Name.End = p;
+            while (p < this->_end && std::isspace(static_cast<unsigned char>(*p))) {
+                ++p;
+            }
+            if (attribute.Name.Begin == attribute.Name.End || p >= this->_end || *p != '=') {
+                return this->fail("Malformed attribute");
+            }
+            ++p;
+            while (p < this->_end && std::isspace(static_cast<unsigned char>(*p))) {
+                ++p;
+            }
+            if (p >= this->_end || (*p != '"' && *p != '\'')) {
+                return this->fail("Attribute value without quotes");
+            }
+            const char quote = *p++;
+            const char* close = static_cast<const char*>(std::memchr(p, quote, static_cast<std::size_t>(this->_end - p)));
+            if (close == nullptr) {
+                return this->fail("Unterminated attribute value");
+            }
+            attribute.Value = Span { p, close };
+            this->_attributes.push_back(attribute);
+            p = close + 1;
+        }
+        this->_pos = p;
+        return Event::StartElement;
+    }
+    return Event::End;
+}
+
+bool l2d_internal::XmlPullParser::isElement(const char* name) const {
+    const std::size_t length = static_cast<std::size_t>(this->_name.End - this->_name.Begin);
+    return std::strlen(name) == length && std::strncmp(this->_name.Begin, name, length) == 0;
+}
+
+const l2d_internal::XmlPullParser::Span* l2d_internal::XmlPullParser::findAttribute(const char* name) const {
+    const std::size_t length = std::strlen(name);
+    for (const Attribute &attribute : this->_attributes) {
+        if (static_cast<std::size_t>(attribute.Name.End - attribute.Name.Begin) == length &&
+            std::strncmp(attribute.Name.Begin, name, length) == 0) {
+            return &attribute.Value;
+        }
+    }
+    return nullptr;
+}
+
+// static bool parseInteger
+// Parses a whole span as a decimal integer, without going through a string or the C locale
+bool l2d_internal::XmlPullParser::parseInteger(Span span, long long &value) {
+    const char* p = span.Begin;
+    while (p < span.End && std::isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    const bool negative = p < span.End && *p == '-';
+    if (p < span.End && (*p == '-' || *p == '+')) {
+        ++p;
+    }
+    if (p == span.End) {
+        return false;
+    }
+    long long result = 0;
+    for (; p < span.End && *p >= '0' && *p <= '9'; ++p) {
+        result = result * 10 + (*p - '0');
+        if (result > 0xFFFFFFFFLL) {
+            return false;
+        }
+    }
+    while (p < span.End && std::isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    if (p != span.End) {
+        return false;
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+bool l2d_internal::XmlPullParser::getAttribute(const char* name, int &value) const {
+    const Span* span = this->findAttribute(name);
+    long long result;
+    if (span == nullptr || !parseInteger(*span, result)) {
+        return false;
+    }
+    value = static_cast<int>(result);
+    return true;
+}
+
+// bool getAttribute
+// Negative values are wrapped around, the same way tinyxml2 reads them
+bool l2d_internal::XmlPullParser::getAttribute(const char* name, unsigned int &value) const {
+    const Span* span = this->findAttribute(name);
+    long long result;
+    if (span == nullptr || !parseInteger(*span, result)) {
+        return false;
+    }
+    value = static_cast<unsigned int>(result);
+    return true;
+}
+
+bool l2d_internal::XmlPullParser::getAttribute(const char* name, float &value) const {
+    const Span* span = this->findAttribute(name);
+    if (span == nullptr) {
+        return false;
+    }
+    //The value ends at its closing quote, which strtof stops at on its own
+    char* end = nullptr;
+    const float result = std::strtof(span->Begin, &end);
+    if (end == span->Begin || end > span->End) {
+        return false;
+    }
+    value = result;
+    return true;
+}
+
+bool l2d_internal::XmlPullParser::getAttribute(const char* name, std::string &value) const {
+    const Span* span = this->findAttribute(name);
+    if (span == nullptr) {
+        return false;
+    }
+    value = decode(*span);
+    return true;
+}
+
+bool l2d_internal::XmlPullParser::getTextInt(int &value) const {
+    long long result;
+    if (!parseInteger(this->_text, result)) {
+        return false;
+    }
+    value = static_cast<int>(result);
+    return true;
+}
+
+std::string l2d_internal::XmlPullParser::getText() const {
+    return this->_rawText ? std::string(this->_text.Begin, this->_text.End) : decode(this->_text);
+}
+
+const std::string &l2d_internal::XmlPullParser::getError() const {
+    return this->_error;
+}
+
+// static std::string decode
+// Copies a span out, replacing the predefined entities and character references
+std::string l2d_internal::XmlPullParser::decode(Span span) {
+    std::string result;
+    result.reserve(static_cast<std::size_t>(span.End - span.Begin));
+    const char* p = span.Begin;
+    while (p < span.End) {
+        const char* amp = static_cast<const char*>(std::memchr(p, '&', static_cast<std::size_t>(span.End - p)));
+        if (amp == nullptr) {
+            result.append(p, span.End);
+            break;
+        }
+        result.append(p, amp);
+        const char* semicolon = static_cast<const char*>(std::memchr(amp, ';', static_cast<std::size_t>(span.End - amp)));
+        if (semicolon == nullptr) {
+            result.append(amp, span.End);
+            break;
+        }
+        const std::string entity(amp + 1, semicolon);
+        if (entity == "lt") result += '<';
+        else if (entity == "gt") result += '>';
+        else if (entity == "amp") result += '&';
+        else if (entity == "quot") result += '"';
+        else if (entity == "apos") result += '\'';
+        else if (entity.size() > 1 && entity[0] == '#') {
+            unsigned long code = entity[1] == 'x' ? std::strtoul(entity.c_str() + 2, nullptr, 16) : std::strtoul(entity.c_str() + 1, nullptr, 10);
+            //Encode the character as UTF-8
+            if (code < 0x80) {
+                result += static_cast<char>(code);
+            }
+            else if (code < 0x800) {
+                result += static_cast<char>(0xC0 | (code >> 6));
+                result += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else if (code < 0x10000) {
+                result += static_cast<char>(0xE0 | (code >> 12));
+                result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else {
+                result += static_cast<char>(0xF0 | (code >> 18));
+                result += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+        else {
+            result.append(amp, semicolon + 1);
+        }
+        p = semicolon + 1;
+    }
+    return result;
+}
+
+/*
+ * MapData
+ */
+
+namespace {
+    //Section ids of the binary map format
+    const std::uint32_t SECTION_META = 0x4154454D; //"META"
+    const std::uint32_t SECTION_TILESETS = 0x54455354; //"TSET"
+    const std::uint32_t SECTION_BACKGROUND = 0x444E4742; //"BGND"
+    const std::uint32_t SECTION_LAYERS = 0x5259414C; //"LAYR"
+    const std::uint32_t SECTION_TILE_TYPES = 0x50595454; //"TTYP"
+    const std::uint32_t SECTION_LIGHTS = 0x4554494C; //"LITE"
+    const std::uint32_t SECTION_SHAPES = 0x50414853; //"SHAP"
+    const char BINARY_MAGIC[4] = { 'L', '2', 'D', 'M' };
+
+    //Header: magic, version, section count, reserved. Each section table entry: id, reserved, offset, size.
+    //Every value in the file is little endian
+    const std::size_t HEADER_SIZE = 16;
+    const std::size_t SECTION_ENTRY_SIZE = 24;
+
+    bool isLittleEndian() {
+        const std::uint16_t one = 1;
+        unsigned char first = 0;
+        std::memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    //Turns the bytes of a value from the machine's byte order into little endian or back
+    void swapLittleEndian(char* bytes, std::size_t size) {
+        if (!isLittleEndian()) {
+            std::reverse(bytes, bytes + size);
+        }
+    }
+
+    // Appends plain values to a byte buffer, in little endian whatever the machine's byte order is.
+    class BinaryWriter {
+    public:
+        std::string Buffer;
+        template<class T>
+        void write(const T &value) {
+            static_assert(std::is_arithmetic<T>::value, "Only numbers have a byte order to write them in");
+            char bytes[sizeof(T)];
+            std::memcpy(bytes, &value, sizeof(T));
+            swapLittleEndian(bytes, sizeof(T));
+            this->Buffer.append(bytes, sizeof(T));
+        }
+        void writeWords(const std::vector<std::uint32_t> &words) {
+            if (isLittleEndian()) {
+                this->writeBytes(words.data(), words.size() * sizeof(std::uint32_t));
+                return;
+            }
+            for (std::uint32_t word : words) {
+                this->write(word);
+            }
+        }
+        void writeString(const std::string &str) {
+            this->write(static_cast<std::uint32_t>(str.size()));
+            this->Buffer.append(str);
+        }
+        void writeBytes(const void* data, std::size_t size) {
+            this->Buffer.append(static_cast<const char*>(data), size);
+        }
+    };
+
+    // Reads plain values out of a block of memory. Reading past the end sets Failed instead of crashing,
+    // so a truncated file is reported as an error.
+    class BinaryReader {
+    public:
+        BinaryReader(const char* data, std::size_t size) : _data(data), _size(size), _pos(0), Failed(false) {}
+        template<class T>
+        T read() {
+            static_assert(std::is_arithmetic<T>::value, "Only numbers have a byte order to read them in");
+            T value = T();
+            if (this->canRead(sizeof(T))) {
+                char bytes[sizeof(T)];
+                std::memcpy(bytes, this->_data + this->_pos, sizeof(T));
+                swapLittleEndian(bytes, sizeof(T));
+                std::memcpy(&value, bytes, sizeof(T));
+                this->_pos += sizeof(T);
+            }
+            return value;
+        }
+        //Reads count words into words with a single copy on little endian machines
+        bool readWords(std::vector<std::uint32_t> &words, std::size_t count) {
+            if (count > this->_size / sizeof(std::uint32_t)) {
+                this->Failed = true;
+                return false;
+            }
+            const char* bytes = this->readBytes(count * sizeof(std::uint32_t));
+            if (bytes == nullptr) {
+                return false;
+            }
+            words.resize(count);
+            std::memcpy(words.data(), bytes, count * sizeof(std::uint32_t));
+            if (!isLittleEndian()) {
+                for (std::uint32_t &word : words) {
+                    swapLittleEndian(reinterpret_cast<char*>(&word), sizeof(word));
+                }
+            }
+            return true;
+        }
+        std::string readString() {
+            const std::uint32_t size = this->read<std::uint32_t>();
+            if (!this->canRead(size)) {
+                return "";
+            }
+            std::string str(this->_data + this->_pos, size);
+            this->_pos += size;
+            return str;
+        }
+        const char* readBytes(std::size_t size) {
+            if (!this->canRead(size)) {
+                return nullptr;
+            }
+            const char* bytes = this->_data + this->_pos;
+            this->_pos += size;
+            return bytes;
+        }
+        bool Failed;
+    private:
+        const char* _data;
+        std::size_t _size;
+        std::size_t _pos;
+        bool canRead(std::size_t size) {
+            if (this->Failed || size > this->_size - this->_pos) {
+                this->Failed = true;
+                return false;
+            }
+            return true;
+        }
+    };
+
+    //CustomProperty keeps its strings in fixed size buffers
+    l2d_internal::CustomProperty makeProperty(int id, const std::string &name, const std::string &value) {
+        return l2d_internal::CustomProperty(id, name.substr(0, 99), value.substr(0, 99));
+    }
+
+    //Tile records of the version 1 and 2 layer sections are two little endian 16 bit values
+    l2d_internal::TileRecord readTileRecord(const char* bytes) {
+        const unsigned char* b = reinterpret_cast<const unsigned char*>(bytes);
+        l2d_internal::TileRecord tile;
+        tile.Tileset = static_cast<std::uint16_t>(b[0] | (b[1] << 8));
+        tile.Tile = static_cast<std::uint16_t>(b[2] | (b[3] << 8));
+        return tile;
+    }
+
+    //A chunk is its position followed by its palette and packed cells exactly as PackedTiles keeps them,
+    //so loading it copies them instead of setting every cell
+    void writeChunk(BinaryWriter &writer, std::pair<int, int> key, const l2d_internal::PackedTiles &tiles) {
+        writer.write(static_cast<std::int32_t>(key.first));
+        writer.write(static_cast<std::int32_t>(key.second));
+        writer.write(static_cast<std::uint32_t>(tiles.getBitsPerCell()));
+        const std::vector<l2d_internal::TileRecord> &palette = tiles.getPalette();
+        writer.write(static_cast<std::uint32_t>(palette.size()));
+        for (const l2d_internal::TileRecord &tile : palette) {
+            writer.write(tile.Tileset);
+            writer.write(tile.Tile);
+        }
+        writer.writeWords(tiles.getWords());
+    }
+
+    //Returns nullptr for a chunk that doesn't make up valid tiles. If even its size can't be trusted, reader fails too
+    std::shared_ptr<l2d_internal::PackedTiles> readChunk(BinaryReader &reader, std::pair<int, int> &key) {
+        const unsigned int cellCount = l2d_internal::Layer::CHUNK_SIZE * l2d_internal::Layer::CHUNK_SIZE;
+        key.first = reader.read<std::int32_t>();
+        key.second = reader.read<std::int32_t>();
+        const std::uint32_t bits = reader.read<std::uint32_t>();
+        const std::uint32_t paletteSize = reader.read<std::uint32_t>();
+        if (bits == 0 || bits > 32 || paletteSize > 65536) {
+            reader.Failed = true;
+            return nullptr;
+        }
+        std::vector<l2d_internal::TileRecord> palette(paletteSize);
+        for (l2d_internal::TileRecord &tile : palette) {
+            tile.Tileset = reader.read<std::uint16_t>();
+            tile.Tile = reader.read<std::uint16_t>();
+        }
+        std::vector<std::uint32_t> words;
+        if (!reader.readWords(words, (static_cast<std::size_t>(cellCount) * bits + 31) / 32)) {
+            return nullptr;
+        }
+        return l2d_internal::PackedTiles::fromPacked(cellCount, bits, std::move(palette), std::move(words));
+    }
+
+    //Flushes a finished temporary file to the disk and moves it over the target in one step,
+    //so a crash part way through a save leaves either the old file or the new one
+    bool commitFile(FILE* pFile, const std::string &tempPath, const std::string &targetPath) {
+        bool ok = std::fflush(pFile) == 0 && std::ferror(pFile) == 0;
+#ifdef _WIN32
+        ok = ok && _commit(_fileno(pFile)) == 0;
+        ok = std::fclose(pFile) == 0 && ok;
+        ok = ok && MoveFileExA(tempPath.c_str(), targetPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        ok = ok && fsync(fileno(pFile)) == 0;
+        ok = std::fclose(pFile) == 0 && ok;
+        ok = ok && std::rename(tempPath.c_str(), targetPath.c_str()) == 0;
+#endif
+        if (!ok) {
+            std::remove(tempPath.c_str());
+        }
+        return ok;
+    }
+
+    const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string encodeBase64(const std::vector<std::uint8_t> &bytes) {
+        std::string result;
+        result.reserve((bytes.size() + 2) / 3 * 4);
+        std::size_t i = 0;
+        for (; i + 2 < bytes.size(); i += 3) {
+            const std::uint32_t group = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+            result += BASE64_ALPHABET[(group >> 18) & 0x3F];
+            result += BASE64_ALPHABET[(group >> 12) & 0x3F];
+            result += BASE64_ALPHABET[(group >> 6) & 0x3F];
+            result += BASE64_ALPHABET[group & 0x3F];
+        }
+        if (i < bytes.size()) {
+            const std::uint32_t group = (bytes[i] << 16) | (i + 1 < bytes.size() ? bytes[i + 1] << 8 : 0);
+            result += BASE64_ALPHABET[(group >> 18) & 0x3F];
+            result += BASE64_ALPHABET[(group >> 12) & 0x3F];
+            result += i + 1 < bytes.size() ? BASE64_ALPHABET[(group >> 6) & 0x3F] : '=';
+            result += '=';
+        }
+        return result;
+    }
+
+    //Whitespace is skipped and decoding stops at the first '='. Returns false on any other character
+    bool decodeBase64(const std::string &text, std::vector<std::uint8_t> &bytes) {
+        static std::int8_t values[256];
+        static bool hasValues = false;
+        if (!hasValues) {
+            std::fill(std::begin(values), std::end(values), static_cast<std::int8_t>(-1));
+            for (int i = 0; i < 64; ++i) {
+                values[static_cast<unsigned char>(BASE64_ALPHABET[i])] = static_cast<std::int8_t>(i);
+            }
+            hasValues = true;
+        }
+        bytes.clear();
+        bytes.reserve(text.size() / 4 * 3);
+        std::uint32_t group = 0;
+        int bits = 0;
+        for (const char c : text) {
+            if (c == '=') {
+                break;
+            }
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                continue;
+            }
+            const std::int8_t value = values[static_cast<unsigned char>(c)];
+            if (value < 0) {
+                return false;
+            }
+            group = (group << 6) | static_cast<std::uint32_t>(value);
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                bytes.push_back(static_cast<std::uint8_t>(group >> bits));
+            }
+        }
+        return true;
+    }
+}
+
+const std::uint32_t l2d_internal::MapData::BINARY_VERSION;
+const char* l2d_internal::MapData::BINARY_EXTENSION = ".l2dm";
+
+l2d_internal::MapData::MapData() :
+    TileTypeNames(1, "")
+{}
+
+// static std::string getMapFilePath
+// Returns the file a map should be loaded from: its binary file if that is at least as new as its XML file
+std::string l2d_internal::MapData::getMapFilePath(const std::string &mapName) {
+    const std::string xmlPath = l2d_internal::Config::get().MapPath + mapName + ".xml";
+    const std::string binaryPath = l2d_internal::Config::get().MapPath + mapName + BINARY_EXTENSION;
+    std::error_code xmlError, binaryError;
+    auto xmlTime = std::experimental::filesystem::last_write_time(xmlPath, xmlError);
+    auto binaryTime = std::experimental::filesystem::last_write_time(binaryPath, binaryError);
+    if (!binaryError && (xmlError || binaryTime >= xmlTime)) {
+        return binaryPath;
+    }
+    return xmlPath;
+}
+
+bool l2d_internal::MapData::isBinaryPath(const std::string &filePath) {
+    const std::string extension(BINARY_EXTENSION);
+    return filePath.size() >= extension.size() && filePath.compare(filePath.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// std::string load
+// Reads a map in whichever format its extension says. Returns an empty string on success, otherwise the error
+std::string l2d_internal::MapData::load(const std::string &filePath) {
+    return isBinaryPath(filePath) ? this->loadBinary(filePath) : this->loadXml(filePath);
+}
+
+std::string l2d_internal::MapData::save(const std::string &filePath) const {
+    return isBinaryPath(filePath) ? this->saveBinary(filePath) : this->saveXml(filePath);
+}
+
+// LayerEntry &getLayer
+// Returns the layer with the given id, adding an empty one if there isn't one yet
+l2d_internal::MapData::LayerEntry &l2d_internal::MapData::getLayer(int id) {
+    for (LayerEntry &layer : this->Layers) {
+        if (layer.Id == id) {
+            return layer;
+        }
+    }
+    this->Layers.push_back(LayerEntry { id, TileChunkMap() });
+    return this->Layers.back();
+}
+
+// void setTile
+// Puts a tile in the cell (x, y) of a layer's chunks (or the tile types), starting from 0, allocating its chunk
+// if it doesn't have one yet. Cells outside of the map are ignored
+void l2d_internal::MapData::setTile(TileChunkMap &chunks, int x, int y, TileRecord tile) const {
+    if (x < 0 || y < 0 || x >= this->Size.x || y >= this->Size.y) {
+        return;
+    }
+    const int chunkSize = Layer::CHUNK_SIZE;
+    const std::pair<int, int> key(y / chunkSize, x / chunkSize);
+    auto it = chunks.find(key);
+    if (it == chunks.end()) {
+        if (tile.isEmpty()) {
+            return;
+        }
+        it = chunks.emplace(key, std::make_shared<PackedTiles>(chunkSize * chunkSize)).first;
+    }
+    PackedTiles::makeUnique(it->second).set(static_cast<unsigned int>((y % chunkSize) * chunkSize + x % chunkSize), tile);
+    if (it->second->getTileCount() == 0) {
+        chunks.erase(it);
+    }
+}
+
+// sf::IntRect getChunkArea
+// Returns the cells a chunk covers, cut off at the edge of the map
+sf::IntRect l2d_internal::MapData::getChunkArea(std::pair<int, int> chunk) const {
+    const int left = chunk.second * Layer::CHUNK_SIZE;
+    const int top = chunk.first * Layer::CHUNK_SIZE;
+    return sf::IntRect(left, top, std::max(0, std::min(Layer::CHUNK_SIZE, this->Size.x - left)),
+                       std::max(0, std::min(Layer::CHUNK_SIZE, this->Size.y - top)));
+}
+
+// void encodeRuns
+// Run-length encodes the tile type of every cell, row by row, as "count*id" pairs separated by commas, where a
+// lone id is a run of one. Only painted chunks are looked at; the cells between them are counted as empty runs.
+// The text is passed to write a few kilobytes at a time instead of being built up in one string
+void l2d_internal::MapData::encodeRuns(const std::function<void(const std::string&)> &write) const {
+    const std::size_t pieceSize = 4096;
+    std::string text;
+    text.reserve(pieceSize + 64);
+    std::uint16_t runId = 0;
+    unsigned long long runLength = 0;
+    bool first = true;
+    auto flush = [&]() {
+        char buffer[48];
+        const int length = runLength > 1 ?
+                std::snprintf(buffer, sizeof(buffer), "%s%llu*%d", first ? "" : ",", runLength, static_cast<int>(runId)) :
+                std::snprintf(buffer, sizeof(buffer), "%s%d", first ? "" : ",", static_cast<int>(runId));
+        text.append(buffer, static_cast<std::size_t>(length));
+        first = false;
+        if (text.size() >= pieceSize) {
+            write(text);
+            text.clear();
+        }
+    };
+    auto add = [&](std::uint16_t id, unsigned long long count) {
+        if (count == 0) {
+            return;
+        }
+        if (runLength > 0 && id != runId) {
+            flush();
+            runLength = 0;
+        }
+        runId = id;
+        runLength += count;
+    };
+    const int chunkSize = Layer::CHUNK_SIZE;
+    auto chunk = this->TileTypes.begin();
+    for (int top = 0; top < this->Size.y; top += chunkSize) {
+        const int chunkRow = top / chunkSize;
+        const int height = std::min(chunkSize, this->Size.y - top);
+        while (chunk != this->TileTypes.end() && chunk->first.first < chunkRow) {
+            ++chunk;
+        }
+        if (chunk == this->TileTypes.end() || chunk->first.first != chunkRow) {
+            add(0, static_cast<unsigned long long>(this->Size.x) * height);
+            continue;
+        }
+        const auto rowBegin = chunk;
+        for (int y = 0; y < height; ++y) {
+            int x = 0;
+            for (chunk = rowBegin; chunk != this->TileTypes.end() && chunk->first.first == chunkRow; ++chunk) {
+                const int left = chunk->first.second * chunkSize;
+                if (left >= this->Size.x) {
+                    break;
+                }
+                if (left < x) {
+                    continue;
+                }
+                add(0, static_cast<unsigned long long>(left - x));
+                const std::vector<TileRecord> &palette = chunk->second->getPalette();
+                for (x = left; x < std::min(left + chunkSize, this->Size.x); ++x) {
+                    add(palette[chunk->second->getIndex(static_cast<unsigned int>(y * chunkSize + x - left))].Tile, 1);
+                }
+            }
+            add(0, static_cast<unsigned long long>(this->Size.x - x));
+        }
+        while (chunk != this->TileTypes.end() && chunk->first.first == chunkRow) {
+            ++chunk;
+        }
+    }
+    if (runLength > 0) {
+        flush();
+    }
+    if (!text.empty()) {
+        write(text);
+    }
+}
+
+// void decodeRuns
+// Fills TileTypes from the output of encodeRuns. Runs past the end are cut off and ids without a name become empty.
+// Empty runs are skipped over without touching any cells
+void l2d_internal::MapData::decodeRuns(const char* text) {
+    this->TileTypes.clear();
+    const unsigned long long cellCount = static_cast<unsigned long long>(this->Size.x) * static_cast<unsigned long long>(this->Size.y);
+    unsigned long long cell = 0;
+    const char* p = text;
+    while (*p != '\0' && cell < cellCount) {
+        char* next = nullptr;
+        long long count = 1;
+        long long id = std::strtoll(p, &next, 10);
+        if (next == p) {
+            break;
+        }
+        if (*next == '*') {
+            count = id;
+            p = next + 1;
+            id = std::strtoll(p, &next, 10);
+        }
+        if (id < 0 || static_cast<unsigned long long>(id) >= this->TileTypeNames.size()) {
+            id = 0;
+        }
+        const unsigned long long end = count <= 0 ? cell : std::min(cellCount, cell + static_cast<unsigned long long>(count));
+        for (; id != 0 && cell < end; ++cell) {
+            this->setTile(this->TileTypes, static_cast<int>(cell % this->Size.x), static_cast<int>(cell / this->Size.x),
+                          TileRecord { 0, static_cast<std::uint16_t>(id) });
+        }
+        cell = end;
+        p = next;
+        while (*p == ',' || std::isspace(static_cast<unsigned char>(*p))) {
+            ++p;
+        }
+    }
+}
+
+// static TileEncoding getTileEncoding
+// Returns the encoding with the given name, or Verbose if there isn't one
+l2d_internal::MapData::TileEncoding l2d_internal::MapData::getTileEncoding(const std::string &name) {
+    for (TileEncoding encoding : { TileEncoding::Csv, TileEncoding::Base64, TileEncoding::Base64Zlib }) {
+        if (name == getTileEncodingName(encoding)) {
+            return encoding;
+        }
+    }
+    return TileEncoding::Verbose;
+}
+
+const char* l2d_internal::MapData::getTileEncodingName(TileEncoding encoding) {
+    switch (encoding) {
+        case TileEncoding::Csv:
+            return "csv";
+        case TileEncoding::Base64:
+            return "base64";
+        case TileEncoding::Base64Zlib:
+            return "base64-zlib";
+        default:
+            return "verbose";
+    }
+}
+
+// static std::string encodeChunk
+// Writes a tile id per cell of the top left size.x * size.y cells of a chunk, where the id is (tileset << 16) | tile
+// and 0 is an empty cell. CSV puts each row on its own line. Base64 encodes the ids as little endian 32 bit integers
+std::string l2d_internal::MapData::encodeChunk(const PackedTiles &tiles, sf::Vector2i size, TileEncoding encoding) {
+    const std::vector<TileRecord> &palette = tiles.getPalette();
+    auto getId = [&](int x, int y) -> std::uint32_t {
+        const TileRecord &tile = palette[tiles.getIndex(static_cast<unsigned int>(y * Layer::CHUNK_SIZE + x))];
+        return tile.isEmpty() ? 0 : (static_cast<std::uint32_t>(tile.Tileset) << 16) | tile.Tile;
+    };
+    if (encoding == TileEncoding::Csv) {
+        std::string text = "\n";
+        char buffer[16];
+        for (int y = 0; y < size.y; ++y) {
+            for (int x = 0; x < size.x; ++x) {
+                const int length = std::snprintf(buffer, sizeof(buffer), "%u", getId(x, y));
+                text.append(buffer, static_cast<std::size_t>(length));
+                if (x + 1 < size.x || y + 1 < size.y) {
+                    text += ',';
+                }
+            }
+            text += '\n';
+        }
+        return text;
+    }
+    std::vector<std::uint8_t> bytes;
+    bytes.reserve(static_cast<std::size_t>(size.x * size.y) * 4);
+    for (int y = 0; y < size.y; ++y) {
+        for (int x = 0; x < size.x; ++x) {
+            const std::uint32_t id = getId(x, y);
+            bytes.push_back(static_cast<std::uint8_t>(id));
+            bytes.push_back(static_cast<std::uint8_t>(id >> 8));
+            bytes.push_back(static_cast<std::uint8_t>(id >> 16));
+            bytes.push_back(static_cast<std::uint8_t>(id >> 24));
+        }
+    }
+#ifdef LIME2D_ZLIB
+    if (encoding == TileEncoding::Base64Zlib) {
+        uLongf compressedSize = compressBound(static_cast<uLong>(bytes.size()));
+        std::vector<std::uint8_t> compressed(compressedSize);
+        if (compress(compressed.data(), &compressedSize, bytes.data(), static_cast<uLong>(bytes.size())) == Z_OK) {
+            compressed.resize(compressedSize);
+            bytes.swap(compressed);
+        }
+    }
+#endif
+    return encodeBase64(bytes);
+}
+
+// std::string decodeTiles
+// Puts the tiles written by encodeChunk into the cells of area, row by row. The area may be a single chunk
+// or, for maps saved before layers were split into chunks, the whole map.
+// Returns an empty string on success, otherwise the error
+std::string l2d_internal::MapData::decodeTiles(const std::string &text, TileEncoding encoding, LayerEntry &layer, sf::IntRect area) const {
+    const std::string sizeError = "layer " + std::to_string(layer.Id) + " does not match the size of the map";
+    //Anything outside of the map would be thrown away anyway, and checking it first keeps a damaged file from allocating too much
+    if (area.left < 0 || area.top < 0 || area.width < 0 || area.height < 0 ||
+        area.width > this->Size.x - area.left || area.height > this->Size.y - area.top) {
+        return sizeError;
+    }
+    const std::size_t cellCount = static_cast<std::size_t>(area.width) * static_cast<std::size_t>(area.height);
+    auto setTile = [&](std::size_t cell, std::uint32_t id) {
+        if ((id & 0xFFFF) != 0) {
+            this->setTile(layer.Chunks, area.left + static_cast<int>(cell % area.width), area.top + static_cast<int>(cell / area.width),
+                          TileRecord { static_cast<std::uint16_t>(id >> 16), static_cast<std::uint16_t>(id & 0xFFFF) });
+        }
+    };
+    if (encoding == TileEncoding::Csv) {
+        std::size_t cell = 0;
+        const char* p = text.c_str();
+        while (*p != '\0') {
+            if (*p == ',' || std::isspace(static_cast<unsigned char>(*p))) {
+                ++p;
+                continue;
+            }
+            if (*p < '0' || *p > '9' || cell >= cellCount) {
+                return sizeError;
+            }
+            std::uint32_t id = 0;
+            for (; *p >= '0' && *p <= '9'; ++p) {
+                id = id * 10 + static_cast<std::uint32_t>(*p - '0');
+            }
+            setTile(cell++, id);
+        }
+        return cell == cellCount ? "" : sizeError;
+    }
+    std::vector<std::uint8_t> bytes;
+    if (!decodeBase64(text, bytes)) {
+        return "layer " + std::to_string(layer.Id) + " is not valid base64";
+    }
+    if (encoding == TileEncoding::Base64Zlib) {
+#ifdef LIME2D_ZLIB
+        std::vector<std::uint8_t> uncompressed(cellCount * 4);
+        uLongf uncompressedSize = static_cast<uLongf>(uncompressed.size());
+        if (uncompress(uncompressed.data(), &uncompressedSize, bytes.data(), static_cast<uLong>(bytes.size())) != Z_OK) {
+            return "layer " + std::to_string(layer.Id) + " could not be decompressed";
+        }
+        uncompressed.resize(uncompressedSize);
+        bytes.swap(uncompressed);
+#else
+        return "layer " + std::to_string(layer.Id) + " is compressed with zlib, which this build of Lime2D does not support";
+#endif
+    }
+    if (bytes.size() != cellCount * 4) {
+        return sizeError;
+    }
+    for (std::size_t cell = 0; cell < cellCount; ++cell) {
+        const std::uint8_t* b = &bytes[cell * 4];
+        setTile(cell, static_cast<std::uint32_t>(b[0]) | (static_cast<std::uint32_t>(b[1]) << 8) |
+                      (static_cast<std::uint32_t>(b[2]) << 16) | (static_cast<std::uint32_t>(b[3]) << 24));
+    }
+    return "";
+}
+
+// std::string loadXml
+// Reads a map from the XML format. The file is mapped into memory and read with a pull parser, so no
+// document is built and tiles go straight into their layer as they are read.
+std::string l2d_internal::MapData::loadXml(const std::string &filePath) {
+    *this = MapData();
+    l2d_internal::MappedFile file;
+    if (!file.open(filePath)) {
+        return "Could not open map " + filePath;
+    }
+    l2d_internal::XmlPullParser parser(file.getData(), file.getSize());
+
+    //Where in the document the parser is. Elements that don't mean anything at their position are Other
+    enum class Tag {
+        Other, Map, Background, BackgroundLayers, Tiles, Data, Chunk, Pos, Tile, TileTypes, Cells, Objects, Lights, Shapes,
+        ShapeGroup, Shape, LinePoints, LinePoint, Properties
+    };
+    std::vector<Tag> tags;
+    bool hasMap = false;
+    sf::Vector2i tilePos;
+    int tileLayer = 0;
+    int tileTileset = 0;
+    TileEncoding dataEncoding = TileEncoding::Verbose;
+    sf::IntRect chunkArea;
+    DrawShapes groupKind = DrawShapes::None;
+    ShapeEntry shape;
+    ShapeEntry linePoint;
+
+    //Reads the id, name and color that every shape has
+    auto readShape = [&parser](ShapeEntry &entry, DrawShapes kind) {
+        entry = ShapeEntry();
+        entry.Kind = kind;
+        parser.getAttribute("id", entry.Id);
+        parser.getAttribute("name", entry.Name);
+        unsigned int color = 0;
+        parser.getAttribute("color", color);
+        entry.Color = color;
+    };
+    auto readPosition = [&parser](sf::Vector2f &position) {
+        parser.getAttribute("x", position.x);
+        parser.getAttribute("y", position.y);
+    };
+
+    for (XmlPullParser::Event event = parser.next(); event != XmlPullParser::Event::End; event = parser.next()) {
+        if (event == XmlPullParser::Event::Error) {
+            return "The map " + filePath + " is damaged: " + parser.getError();
+        }
+        if (event == XmlPullParser::Event::EndElement) {
+            if (tags.empty()) {
+                return "The map " + filePath + " is damaged: unexpected element end";
+            }
+            if (tags.back() == Tag::Shape) {
+                this->Shapes.push_back(shape);
+            }
+            else if (tags.back() == Tag::LinePoint) {
+                shape.Points.push_back(linePoint);
+            }
+            tags.pop_back();
+            continue;
+        }
+        if (event == XmlPullParser::Event::Text) {
+            if (!tags.empty() && tags.back() == Tag::Tile) {
+                //Positions in the file start at 1. Anything outside of the map is ignored
+                int tile = 0;
+                if (parser.getTextInt(tile) && tile > 0) {
+                    this->setTile(this->getLayer(tileLayer).Chunks, tilePos.x - 1, tilePos.y - 1,
+                                  TileRecord { static_cast<std::uint16_t>(tileTileset), static_cast<std::uint16_t>(tile) });
+                }
+            }
+            else if (!tags.empty() && (tags.back() == Tag::Data || tags.back() == Tag::Chunk)) {
+                //Text straight inside the data element holds the whole map, from before layers were written in chunks
+                const sf::IntRect area = tags.back() == Tag::Chunk ? chunkArea : sf::IntRect(0, 0, this->Size.x, this->Size.y);
+                const std::string error = this->decodeTiles(parser.getText(), dataEncoding, this->getLayer(tileLayer), area);
+                if (!error.empty()) {
+                    return "The map " + filePath + " is damaged: " + error;
+                }
+            }
+            else if (!tags.empty() && tags.back() == Tag::Cells) {
+                this->decodeRuns(parser.getText().c_str());
+            }
+            continue;
+        }
+
+        //Element start
+        Tag tag = Tag::Other;
+        const Tag parent = tags.empty() ? Tag::Other : tags.back();
+        if (tags.empty()) {
+            if (parser.isElement("map")) {
+                tag = Tag::Map;
+                hasMap = true;
+                parser.getAttribute("name", this->Name);
+                parser.getAttribute("width", this->Size.x);
+                parser.getAttribute("height", this->Size.y);
+                parser.getAttribute("tileWidth", this->TileSize.x);
+                parser.getAttribute("tileHeight", this->TileSize.y);
+                this->Size = sf::Vector2i(std::max(0, this->Size.x), std::max(0, this->Size.y));
+            }
+        }
+        else if (parent == Tag::Map) {
+            if (parser.isElement("tileset")) {
+                Tileset tileset(0, "", sf::Vector2i(0, 0));
+                parser.getAttribute("id", tileset.Id);
+                parser.getAttribute("path", tileset.Path);
+                parser.getAttribute("width", tileset.Size.x);
+                parser.getAttribute("height", tileset.Size.y);
+                this->Tilesets.push_back(tileset);
+            }
+            else if (parser.isElement("background")) {
+                tag = Tag::Background;
+            }
+            else if (parser.isElement("tiles")) {
+                tag = Tag::Tiles;
+            }
+            else if (parser.isElement("tileTypes")) {
+                tag = Tag::TileTypes;
+            }
+            else if (parser.isElement("objects")) {
+                tag = Tag::Objects;
+            }
+        }
+        else if (parent == Tag::Background && parser.isElement("layers")) {
+            tag = Tag::BackgroundLayers;
+        }
+        else if (parent == Tag::BackgroundLayers && parser.isElement("layer")) {
+            //Scale and parallax are optional
+            BackgroundEntry background { 0, "", 1.25f, sf::Vector2f(1.0f, 1.0f) };
+            parser.getAttribute("id", background.Id);
+            parser.getAttribute("path", background.Path);
+            parser.getAttribute("scale", background.Scale);
+            parser.getAttribute("parallaxX", background.Parallax.x);
+            parser.getAttribute("parallaxY", background.Parallax.y);
+            this->Backgrounds.push_back(background);
+        }
+        else if (parent == Tag::Tiles && parser.isElement("data")) {
+            tag = Tag::Data;
+            std::string encoding;
+            std::string compression;
+            tileLayer = 0;
+            parser.getAttribute("layer", tileLayer);
+            this->getLayer(tileLayer);
+            parser.getAttribute("encoding", encoding);
+            parser.getAttribute("compression", compression);
+            if (encoding == "csv" && compression.empty()) {
+                dataEncoding = TileEncoding::Csv;
+            }
+            else if (encoding == "base64" && (compression.empty() || compression == "zlib")) {
+                dataEncoding = compression.empty() ? TileEncoding::Base64 : TileEncoding::Base64Zlib;
+            }
+            else {
+                return "The map " + filePath + " is damaged: unknown tile encoding " + encoding + " " + compression;
+            }
+            //The map is saved back the way it was read unless told otherwise
+            this->Encoding = dataEncoding;
+        }
+        else if (parent == Tag::Data && parser.isElement("chunk")) {
+            tag = Tag::Chunk;
+            chunkArea = sf::IntRect(0, 0, 0, 0);
+            parser.getAttribute("x", chunkArea.left);
+            parser.getAttribute("y", chunkArea.top);
+            parser.getAttribute("width", chunkArea.width);
+            parser.getAttribute("height", chunkArea.height);
+        }
+        else if (parent == Tag::Tiles && parser.isElement("pos")) {
+            tag = Tag::Pos;
+            tilePos = sf::Vector2i(0, 0);
+            parser.getAttribute("x", tilePos.x);
+            parser.getAttribute("y", tilePos.y);
+        }
+        else if (parent == Tag::Pos && parser.isElement("tile")) {
+            tag = Tag::Tile;
+            tileLayer = 0;
+            tileTileset = 0;
+            parser.getAttribute("layer", tileLayer);
+            parser.getAttribute("tileset", tileTileset);
+        }
+        else if (parent == Tag::TileTypes) {
+            if (parser.isElement("type")) {
+                int id = 0;
+                std::string name;
+                if (parser.getAttribute("id", id) && parser.getAttribute("name", name) && id > 0 && id <= 255) {
+                    if (static_cast<std::size_t>(id) >= this->TileTypeNames.size()) {
+                        this->TileTypeNames.resize(static_cast<std::size_t>(id) + 1);
+                    }
+                    this->TileTypeNames[id] = name;
+                }
+            }
+            else if (parser.isElement("cells")) {
+                tag = Tag::Cells;
+            }
+        }
+        else if (parent == Tag::Objects) {
+            if (parser.isElement("lights")) {
+                tag = Tag::Lights;
+            }
+            else if (parser.isElement("shapes")) {
+                tag = Tag::Shapes;
+            }
+        }
+        else if (parent == Tag::Lights && parser.isElement("ambient")) {
+            unsigned int color = 0;
+            this->HasAmbientLight = true;
+            parser.getAttribute("color", color);
+            this->AmbientColor = color;
+            this->AmbientIntensity = 0.0f;
+            parser.getAttribute("intensity", this->AmbientIntensity);
+        }
+        else if (parent == Tag::Shapes) {
+            groupKind = parser.isElement("rectangles") ? DrawShapes::Rectangle :
+                        parser.isElement("points") ? DrawShapes::Point :
+                        parser.isElement("lines") ? DrawShapes::Line : DrawShapes::None;
+            tag = groupKind == DrawShapes::None ? Tag::Other : Tag::ShapeGroup;
+        }
+        else if (parent == Tag::ShapeGroup) {
+            if ((groupKind == DrawShapes::Rectangle && parser.isElement("rectangle")) ||
+                (groupKind == DrawShapes::Point && parser.isElement("point")) ||
+                (groupKind == DrawShapes::Line && parser.isElement("line"))) {
+                tag = Tag::Shape;
+                readShape(shape, groupKind);
+                parser.getAttribute("type", shape.ObjectType);
+            }
+        }
+        else if (parent == Tag::Shape) {
+            if (parser.isElement("pos")) {
+                readPosition(shape.Position);
+            }
+            else if (parser.isElement("size")) {
+                parser.getAttribute("w", shape.Size.x);
+                parser.getAttribute("h", shape.Size.y);
+            }
+            else if (parser.isElement("properties")) {
+                tag = Tag::Properties;
+            }
+            else if (shape.Kind == DrawShapes::Line && parser.isElement("points")) {
+                tag = Tag::LinePoints;
+            }
+        }
+        else if (parent == Tag::LinePoints && parser.isElement("point")) {
+            tag = Tag::LinePoint;
+            readShape(linePoint, DrawShapes::Point);
+        }
+        else if (parent == Tag::LinePoint && parser.isElement("pos")) {
+            readPosition(linePoint.Position);
+        }
+        else if (parent == Tag::Properties && parser.isElement("property")) {
+            int id = 0;
+            std::string name;
+            std::string value;
+            parser.getAttribute("id", id);
+            parser.getAttribute("name", name);
+            parser.getAttribute("value", value);
+            shape.Properties.push_back(makeProperty(id, name, value));
+        }
+        tags.push_back(tag);
+    }
+    if (!hasMap) {
+        return "The file " + filePath + " is not a Lime2D map.";
+    }
+    if (!tags.empty()) {
+        return "The map " + filePath + " is damaged: it ends before all of its elements are closed";
+    }
+    return "";
+}
+
+// std::string saveXml
+// Writes the map in the XML format, streaming it to the file as it goes.
+// progress, if given, is called with how much of the tiles have been written, from 0 to 1
+std::string l2d_internal::MapData::saveXml(const std::string &filePath, const std::function<void(float)> &progress) const {
+    //The map is written element by element straight to a temporary file. Tiles go out one chunk at a time and
+    //tile types a few kilobytes at a time, so besides the map itself only that much is held in memory.
+    //The temporary file replaces the map once it is complete
+    const std::string tempPath = filePath + ".tmp";
+    FILE* pFile = std::fopen(tempPath.c_str(), "w");
+    if (pFile == nullptr) {
+        return "Could not save map " + filePath;
+    }
+    tx2::XMLPrinter printer(pFile);
+    printer.PushDeclaration("xml version=\"1.0\" encoding=\"UTF-8\"");
+
+    //XMLPrinter only takes doubles, which would write floats with more digits than they have
+    auto pushFloat = [&printer](const char* name, float value) {
+        char buffer[32];
+        tx2::XMLUtil::ToStr(value, buffer, sizeof(buffer));
+        printer.PushAttribute(name, buffer);
+    };
+
+    //Map node
+    printer.OpenElement("map");
+    printer.PushAttribute("name", this->Name.c_str());
+    printer.PushAttribute("width", this->Size.x);
+    printer.PushAttribute("height", this->Size.y);
+    printer.PushAttribute("tileWidth", this->TileSize.x);
+    printer.PushAttribute("tileHeight", this->TileSize.y);
+
+    //Tilesets
+    for (const Tileset &t : this->Tilesets) {
+        printer.OpenElement("tileset");
+        printer.PushAttribute("id", t.Id);
+        printer.PushAttribute("path", t.Path.c_str());
+        printer.PushAttribute("width", t.Size.x);
+        printer.PushAttribute("height", t.Size.y);
+        printer.CloseElement();
+    }
+
+    //Background
+    printer.OpenElement("background");
+    printer.OpenElement("layers");
+    for (const BackgroundEntry &background : this->Backgrounds) {
+        printer.OpenElement("layer");
+        printer.PushAttribute("id", background.Id);
+        printer.PushAttribute("path", background.Path.c_str());
+        pushFloat("scale", background.Scale);
+        pushFloat("parallaxX", background.Parallax.x);
+        pushFloat("parallaxY", background.Parallax.y);
+        printer.CloseElement();
+    }
+    printer.CloseElement();
+    printer.CloseElement();
+
+    //Tiles
+    //Encoded layers get a data element each, with a chunk element per painted chunk. Otherwise every pos element
+    //holds the tiles of all layers at that position, with the layers in order. Either way only painted chunks are
+    //visited and each is written as soon as it is encoded, so empty parts of the map cost nothing
+    std::vector<const LayerEntry*> layers;
+    for (const LayerEntry &layer : this->Layers) {
+        layers.push_back(&layer);
+    }
+    std::sort(layers.begin(), layers.end(), [](const LayerEntry* a, const LayerEntry* b) {
+        return a->Id < b->Id;
+    });
+    printer.OpenElement("tiles");
+    TileEncoding encoding = this->Encoding;
+#ifndef LIME2D_ZLIB
+    //Without zlib the layers are still written compactly, just not compressed
+    if (encoding == TileEncoding::Base64Zlib) {
+        encoding = TileEncoding::Base64;
+    }
+#endif
+    if (encoding != TileEncoding::Verbose) {
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            const LayerEntry* layer = layers[i];
+            if (progress) {
+                progress(static_cast<float>(i) / layers.size());
+            }
+            printer.OpenElement("data");
+            printer.PushAttribute("layer", layer->Id);
+            printer.PushAttribute("encoding", encoding == TileEncoding::Csv ? "csv" : "base64");
+            if (encoding == TileEncoding::Base64Zlib) {
+                printer.PushAttribute("compression", "zlib");
+            }
+            for (const auto &chunk : layer->Chunks) {
+                const sf::IntRect area = this->getChunkArea(chunk.first);
+                if (area.width <= 0 || area.height <= 0) {
+                    continue;
+                }
+                printer.OpenElement("chunk");
+                printer.PushAttribute("x", area.left);
+                printer.PushAttribute("y", area.top);
+                printer.PushAttribute("width", area.width);
+                printer.PushAttribute("height", area.height);
+                printer.PushText(encodeChunk(*chunk.second, sf::Vector2i(area.width, area.height), encoding).c_str());
+                printer.CloseElement();
+            }
+            printer.CloseElement();
+        }
+    }
+    else {
+        //Positions have to come out sorted, so the map is walked one row of chunks at a time.
+        //columns holds the painted chunk columns of the row, each with its chunk in every layer (or nullptr)
+        std::set<std::pair<int, int>> keys;
+        for (const LayerEntry* layer : layers) {
+            for (const auto &chunk : layer->Chunks) {
+                keys.insert(chunk.first);
+            }
+        }
+        std::vector<std::pair<int, std::vector<const PackedTiles*>>> columns;
+        for (auto it = keys.begin(); it != keys.end();) {
+            const int chunkRow = it->first;
+            columns.clear();
+            for (; it != keys.end() && it->first == chunkRow; ++it) {
+                std::vector<const PackedTiles*> chunks;
+                for (const LayerEntry* layer : layers) {
+                    auto chunk = layer->Chunks.find(*it);
+                    chunks.push_back(chunk == layer->Chunks.end() ? nullptr : chunk->second.get());
+                }
+                columns.emplace_back(it->second, chunks);
+            }
+            const int top = chunkRow * Layer::CHUNK_SIZE;
+            if (progress) {
+                progress(static_cast<float>(top) / std::max(1, this->Size.y));
+            }
+            for (int y = top; y < std::min(top + Layer::CHUNK_SIZE, this->Size.y); ++y) {
+                for (const auto &column : columns) {
+                    const int left = column.first * Layer::CHUNK_SIZE;
+                    for (int x = left; x < std::min(left + Layer::CHUNK_SIZE, this->Size.x); ++x) {
+                        const unsigned int cell = static_cast<unsigned int>((y - top) * Layer::CHUNK_SIZE + (x - left));
+                        bool hasPos = false;
+                        for (std::size_t l = 0; l < layers.size(); ++l) {
+                            const PackedTiles* chunk = column.second[l];
+                            const unsigned int index = chunk == nullptr ? 0 : chunk->getIndex(cell);
+                            if (index == 0) {
+                                continue;
+                            }
+                            const TileRecord &tile = chunk->getPalette()[index];
+                            if (!hasPos) {
+                                hasPos = true;
+                                printer.OpenElement("pos");
+                                printer.PushAttribute("x", x + 1);
+                                printer.PushAttribute("y", y + 1);
+                            }
+                            printer.OpenElement("tile");
+                            printer.PushAttribute("layer", layers[l]->Id);
+                            printer.PushAttribute("tileset", static_cast<int>(tile.Tileset));
+                            printer.PushText(static_cast<int>(tile.Tile));
+                            printer.CloseElement();
+                        }
+                        if (hasPos) {
+                            printer.CloseElement();
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printer.CloseElement();
+
+    //Tile types
+    if (!this->TileTypes.empty() && this->TileTypeNames.size() > 1) {
+        printer.OpenElement("tileTypes");
+        for (unsigned int i = 1; i < this->TileTypeNames.size(); ++i) {
+            printer.OpenElement("type");
+            printer.PushAttribute("id", i);
+            printer.PushAttribute("name", this->TileTypeNames[i].c_str());
+            printer.CloseElement();
+        }
+        printer.OpenElement("cells");
+        this->encodeRuns([&printer](const std::string &text) {
+            printer.PushText(text.c_str());
+        });
+        printer.CloseElement();
+        printer.CloseElement();
+    }
+
+    //Objects
+    printer.OpenElement("objects");
+    //Lights
+    printer.OpenElement("lights");
+    if (this->HasAmbientLight) {
+        printer.OpenElement("ambient");
+        printer.PushAttribute("color", static_cast<unsigned>(this->AmbientColor));
+        pushFloat("intensity", this->AmbientIntensity);
+        printer.CloseElement();
+    }
+    printer.CloseElement();
+
+    //Opens a shape element and writes the id, name and color that every shape has
+    auto writeShape = [&printer](const ShapeEntry &shape, const char* element, bool withId) {
+        printer.OpenElement(element);
+        if (withId) {
+            printer.PushAttribute("id", shape.Id);
+        }
+        printer.PushAttribute("name", shape.Name.c_str());
+        printer.PushAttribute("color", static_cast<unsigned>(shape.Color));
+    };
+    auto writePosition = [&printer, &pushFloat](sf::Vector2f position) {
+        printer.OpenElement("pos");
+        pushFloat("x", position.x);
+        pushFloat("y", position.y);
+        printer.CloseElement();
+    };
+    auto writeProperties = [&printer](const std::vector<CustomProperty> &properties) {
+        printer.OpenElement("properties");
+        for (const CustomProperty &pr : properties) {
+            printer.OpenElement("property");
+            printer.PushAttribute("id", pr.Id);
+            printer.PushAttribute("name", pr.Name);
+            printer.PushAttribute("value", pr.Value);
+            printer.CloseElement();
+        }
+        printer.CloseElement();
+    };
+
+    //Shapes
+    //Each kind has its own group, so the list is walked once per kind
+    printer.OpenElement("shapes");
+    printer.OpenElement("rectangles");
+    for (const ShapeEntry &shape : this->Shapes) {
+        if (shape.Kind == DrawShapes::Rectangle) {
+            writeShape(shape, "rectangle", true);
+            printer.PushAttribute("type", shape.ObjectType);
+            writePosition(shape.Position);
+            printer.OpenElement("size");
+            pushFloat("w", shape.Size.x);
+            pushFloat("h", shape.Size.y);
+            printer.CloseElement();
+            writeProperties(shape.Properties);
+            printer.CloseElement();
+        }
+    }
+    printer.CloseElement();
+    printer.OpenElement("points");
+    for (const ShapeEntry &shape : this->Shapes) {
+        if (shape.Kind == DrawShapes::Point) {
+            writeShape(shape, "point", true);
+            writePosition(shape.Position);
+            writeProperties(shape.Properties);
+            printer.CloseElement();
+        }
+    }
+    printer.CloseElement();
+    printer.OpenElement("lines");
+    for (const ShapeEntry &shape : this->Shapes) {
+        if (shape.Kind == DrawShapes::Line) {
+            writeShape(shape, "line", true);
+            printer.OpenElement("points");
+            for (const ShapeEntry &point : shape.Points) {
+                writeShape(point, "point", false);
+                writePosition(point.Position);
+                printer.CloseElement();
+            }
+            printer.CloseElement();
+            writeProperties(shape.Properties);
+            printer.CloseElement();
+        }
+    }
+    printer.CloseElement();
+    printer.CloseElement();
+    printer.CloseElement();
+    printer.CloseElement();
+
+    if (!commitFile(pFile, tempPath, filePath)) {
+        return "Could not save map " + filePath;
+    }
+    return "";
+}
+
+// std::string saveBinary
+// Writes the map in the binary format
+std::string l2d_internal::MapData::saveBinary(const std::string &filePath) const {
+    std::vector<std::pair<std::uint32_t, BinaryWriter>> sections;
+
+    //Header values of the map
+    sections.emplace_back(SECTION_META, BinaryWriter());
+    BinaryWriter &meta = sections.back().second;
+    meta.writeString(this->Name);
+    meta.write(static_cast<std::int32_t>(this->Size.x));
+    meta.write(static_cast<std::int32_t>(this->Size.y));
+    meta.write(static_cast<std::int32_t>(this->TileSize.x));
+    meta.write(static_cast<std::int32_t>(this->TileSize.y));
+
+    sections.emplace_back(SECTION_TILESETS, BinaryWriter());
+    BinaryWriter &tilesets = sections.back().second;
+    tilesets.write(static_cast<std::uint32_t>(this->Tilesets.size()));
+    for (const Tileset &t : this->Tilesets) {
+        tilesets.write(static_cast<std::int32_t>(t.Id));
+        tilesets.writeString(t.Path);
+        tilesets.write(static_cast<std::int32_t>(t.Size.x));
+        tilesets.write(static_cast<std::int32_t>(t.Size.y));
+    }
+
+    sections.emplace_back(SECTION_BACKGROUND, BinaryWriter());
+    BinaryWriter &backgrounds = sections.back().second;
+    backgrounds.write(static_cast<std::uint32_t>(this->Backgrounds.size()));
+    for (const BackgroundEntry &background : this->Backgrounds) {
+        backgrounds.write(static_cast<std::int32_t>(background.Id));
+        backgrounds.writeString(background.Path);
+        backgrounds.write(background.Scale);
+        backgrounds.write(background.Parallax.x);
+        backgrounds.write(background.Parallax.y);
+    }
+
+    //Every layer is a list of its painted chunks, see writeChunk
+    sections.emplace_back(SECTION_LAYERS, BinaryWriter());
+    BinaryWriter &layers = sections.back().second;
+    layers.write(static_cast<std::uint32_t>(this->Layers.size()));
+    for (const LayerEntry &layer : this->Layers) {
+        layers.write(static_cast<std::int32_t>(layer.Id));
+        layers.write(static_cast<std::uint32_t>(layer.Chunks.size()));
+        for (const auto &chunk : layer.Chunks) {
+            writeChunk(layers, chunk.first, *chunk.second);
+        }
+    }
+
+    if (!this->TileTypes.empty() && this->TileTypeNames.size() > 1) {
+        sections.emplace_back(SECTION_TILE_TYPES, BinaryWriter());
+        BinaryWriter &tileTypes = sections.back().second;
+        tileTypes.write(static_cast<std::uint32_t>(this->TileTypeNames.size()));
+        for (const std::string &name : this->TileTypeNames) {
+            tileTypes.writeString(name);
+        }
+        //Painted chunks the same way as layers
+        tileTypes.write(static_cast<std::uint32_t>(this->TileTypes.size()));
+        for (const auto &chunk : this->TileTypes) {
+            writeChunk(tileTypes, chunk.first, *chunk.second);
+        }
+    }
+
+    sections.emplace_back(SECTION_LIGHTS, BinaryWriter());
+    BinaryWriter &lights = sections.back().second;
+    lights.write(static_cast<std::uint8_t>(this->HasAmbientLight ? 1 : 0));
+    lights.write(static_cast<std::uint32_t>(this->AmbientColor));
+    lights.write(this->AmbientIntensity);
+
+    sections.emplace_back(SECTION_SHAPES, BinaryWriter());
+    BinaryWriter &shapes = sections.back().second;
+    std::function<void(const ShapeEntry&)> writeShape = [&](const ShapeEntry &shape) {
+        shapes.write(static_cast<std::uint8_t>(shape.Kind));
+        shapes.write(static_cast<std::int32_t>(shape.Id));
+        shapes.writeString(shape.Name);
+        shapes.write(static_cast<std::uint32_t>(shape.Color));
+        shapes.write(static_cast<std::int32_t>(shape.ObjectType));
+        shapes.write(shape.Position.x);
+        shapes.write(shape.Position.y);
+        shapes.write(shape.Size.x);
+        shapes.write(shape.Size.y);
+        shapes.write(static_cast<std::uint32_t>(shape.Properties.size()));
+        for (const CustomProperty &pr : shape.Properties) {
+            shapes.write(static_cast<std::int32_t>(pr.Id));
+            shapes.writeString(pr.Name);
+            shapes.writeString(pr.Value);
+        }
+        shapes.write(static_cast<std::uint32_t>(shape.Points.size()));
+        for (const ShapeEntry &point : shape.Points) {
+            writeShape(point);
+        }
+    };
+    shapes.write(static_cast<std::uint32_t>(this->Shapes.size()));
+    for (const ShapeEntry &shape : this->Shapes) {
+        writeShape(shape);
+    }
+
+    //Header and section table, followed by the sections in the same order
+    BinaryWriter header;
+    header.writeBytes(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.write(BINARY_VERSION);
+    header.write(static_cast<std::uint32_t>(sections.size()));
+    header.write(static_cast<std::uint32_t>(0));
+    std::uint64_t offset = HEADER_SIZE + SECTION_ENTRY_SIZE * sections.size();
+    for (auto &section : sections) {
+        header.write(section.first);
+        header.write(static_cast<std::uint32_t>(0));
+        header.write(offset);
+        header.write(static_cast<std::uint64_t>(section.second.Buffer.size()));
+        offset += section.second.Buffer.size();
+    }
+
+    //Written to a temporary file that replaces the map once it is complete
+    const std::string tempPath = filePath + ".tmp";
+    FILE* pFile = std::fopen(tempPath.c_str(), "wb");
+    if (pFile == nullptr) {
+        return "Could not save map " + filePath;
+    }
+    std::fwrite(header.Buffer.data(), 1, header.Buffer.size(), pFile);
+    for (auto &section : sections) {
+        std::fwrite(section.second.Buffer.data(), 1, section.second.Buffer.size(), pFile);
+    }
+    return commitFile(pFile, tempPath, filePath) ? "" : "Could not save map " + filePath;
+}
+
+// std::string loadBinary
+// Reads a map from the binary format. The file is mapped into memory and the sections are read in place.
+// Version 1 files, which store every layer as a full grid, and version 2 files, which store full chunks of
+// tile records instead of packed ones, are still read.
+// Sections this version doesn't know about are skipped, so newer files with extra sections still load.
+std::string l2d_internal::MapData::loadBinary(const std::string &filePath) {
+    *this = MapData();
+    l2d_internal::MappedFile file;
+    if (!file.open(filePath)) {
+        return "Could not open map " + filePath;
+    }
+    BinaryReader header(file.getData(), file.getSize());
+    const char* magic = header.readBytes(sizeof(BINARY_MAGIC));
+    if (magic == nullptr || std::memcmp(magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) {
+        return "The file " + filePath + " is not a Lime2D map.";
+    }
+    const std::uint32_t version = header.read<std::uint32_t>();
+    if (version == 0 || version > BINARY_VERSION) {
+        return "The map " + filePath + " was saved by a newer version of Lime2D.";
+    }
+    const std::uint32_t sectionCount = header.read<std::uint32_t>();
+    header.read<std::uint32_t>();
+
+    //Checked before a chunk's position is worked out, so a damaged chunk key can't overflow it
+    auto isChunkInMap = [this](std::pair<int, int> key) {
+        return key.first >= 0 && key.second >= 0 && key.first < (this->Size.y + Layer::CHUNK_SIZE - 1) / Layer::CHUNK_SIZE &&
+               key.second < (this->Size.x + Layer::CHUNK_SIZE - 1) / Layer::CHUNK_SIZE;
+    };
+    //Empties the cells of a chunk read from the file that are past the edge of the map or hold a tile isValid rejects.
+    //Chunks inside the map with only valid tiles in their palette aren't looked at cell by cell
+    auto clearInvalidCells = [this](PackedTiles &chunk, std::pair<int, int> key, const std::function<bool(const TileRecord&)> &isValid) {
+        const sf::IntRect area = this->getChunkArea(key);
+        const std::vector<TileRecord> &palette = chunk.getPalette();
+        if (area.width == Layer::CHUNK_SIZE && area.height == Layer::CHUNK_SIZE && std::all_of(palette.begin() + 1, palette.end(), isValid)) {
+            return;
+        }
+        for (unsigned int cell = 0; cell < static_cast<unsigned int>(Layer::CHUNK_SIZE * Layer::CHUNK_SIZE); ++cell) {
+            const unsigned int index = chunk.getIndex(cell);
+            if (index != 0 && (static_cast<int>(cell % Layer::CHUNK_SIZE) >= area.width || static_cast<int>(cell / Layer::CHUNK_SIZE) >= area.height ||
+                               !isValid(palette[index]))) {
+                chunk.set(cell, TileRecord());
+            }
+        }
+    };
+    bool hasMeta = false;
+    for (std::uint32_t i = 0; i < sectionCount && !header.Failed; ++i) {
+        const std::uint32_t id = header.read<std::uint32_t>();
+        header.read<std::uint32_t>();
+        const std::uint64_t offset = header.read<std::uint64_t>();
+        const std::uint64_t size = header.read<std::uint64_t>();
+        if (header.Failed || offset > file.getSize() || size > file.getSize() - offset) {
+            return "The map " + filePath + " is damaged.";
+        }
+        BinaryReader section(file.getData() + offset, static_cast<std::size_t>(size));
+        const std::size_t cellCount = static_cast<std::size_t>(this->Size.x) * static_cast<std::size_t>(this->Size.y);
+        if (id == SECTION_META) {
+            this->Name = section.readString();
+            this->Size.x = std::max(0, section.read<std::int32_t>());
+            this->Size.y = std::max(0, section.read<std::int32_t>());
+            this->TileSize.x = section.read<std::int32_t>();
+            this->TileSize.y = section.read<std::int32_t>();
+            hasMeta = true;
+        }
+        else if (!hasMeta) {
+            //Every other section depends on the map size, so META has to come first
+            return "The map " + filePath + " is damaged.";
+        }
+        else if (id == SECTION_TILESETS) {
+            const std::uint32_t count = section.read<std::uint32_t>();
+            for (std::uint32_t t = 0; t < count && !section.Failed; ++t) {
+                const int tilesetId = section.read<std::int32_t>();
+                const std::string path = section.readString();
+                const int width = section.read<std::int32_t>();
+                const int height = section.read<std::int32_t>();
+                this->Tilesets.push_back(Tileset(tilesetId, path, sf::Vector2i(width, height)));
+            }
+        }
+        else if (id == SECTION_BACKGROUND) {
+            const std::uint32_t count = section.read<std::uint32_t>();
+            for (std::uint32_t b = 0; b < count && !section.Failed; ++b) {
+                BackgroundEntry background;
+                background.Id = section.read<std::int32_t>();
+                background.Path = section.readString();
+                background.Scale = section.read<float>();
+                background.Parallax.x = section.read<float>();
+                background.Parallax.y = section.read<float>();
+                this->Backgrounds.push_back(background);
+            }
+        }
+        else if (id == SECTION_LAYERS) {
+            const std::uint32_t count = section.read<std::uint32_t>();
+            const unsigned int chunkCells = Layer::CHUNK_SIZE * Layer::CHUNK_SIZE;
+            for (std::uint32_t l = 0; l < count && !section.Failed; ++l) {
+                LayerEntry &layer = this->getLayer(section.read<std::int32_t>());
+                if (version == 1) {
+                    const char* tiles = section.readBytes(cellCount * 4);
+                    for (std::size_t cell = 0; tiles != nullptr && cell < cellCount; ++cell) {
+                        const TileRecord tile = readTileRecord(tiles + cell * 4);
+                        if (!tile.isEmpty()) {
+                            this->setTile(layer.Chunks, static_cast<int>(cell % this->Size.x), static_cast<int>(cell / this->Size.x), tile);
+                        }
+                    }
+                    continue;
+                }
+                const std::uint32_t chunkCount = section.read<std::uint32_t>();
+                for (std::uint32_t c = 0; c < chunkCount && !section.Failed; ++c) {
+                    std::pair<int, int> key;
+                    std::shared_ptr<PackedTiles> chunk;
+                    if (version == 2) {
+                        //A full chunk of tile records
+                        const int chunkRow = section.read<std::int32_t>();
+                        key = std::make_pair(chunkRow, section.read<std::int32_t>());
+                        const char* tiles = section.readBytes(chunkCells * 4);
+                        if (tiles == nullptr || !isChunkInMap(key)) {
+                            continue;
+                        }
+                        chunk = std::make_shared<PackedTiles>(chunkCells);
+                        for (unsigned int cell = 0; cell < chunkCells; ++cell) {
+                            chunk->set(cell, readTileRecord(tiles + cell * 4));
+                        }
+                    }
+                    else {
+                        chunk = readChunk(section, key);
+                        if (chunk == nullptr || !isChunkInMap(key)) {
+                            continue;
+                        }
+                    }
+                    clearInvalidCells(*chunk, key, [](const TileRecord&) { return true; });
+                    if (chunk->getTileCount() > 0) {
+                        layer.Chunks[key] = chunk;
+                    }
+                }
+            }
+        }
+        else if (id == SECTION_TILE_TYPES) {
+            const std::uint32_t count = std::min<std::uint32_t>(section.read<std::uint32_t>(), 256);
+            this->TileTypeNames.clear();
+            for (std::uint32_t n = 0; n < count && !section.Failed; ++n) {
+                this->TileTypeNames.push_back(section.readString());
+            }
+            if (this->TileTypeNames.empty()) {
+                this->TileTypeNames.push_back("");
+            }
+            //Ids without a name become empty
+            auto setType = [this](int x, int y, std::uint8_t id) {
+                if (id != 0 && id < this->TileTypeNames.size()) {
+                    this->setTile(this->TileTypes, x, y, TileRecord { 0, id });
+                }
+            };
+            if (version == 1) {
+                const char* cells = section.readBytes(cellCount);
+                for (std::size_t cell = 0; cells != nullptr && cell < cellCount; ++cell) {
+                    setType(static_cast<int>(cell % this->Size.x), static_cast<int>(cell / this->Size.x), static_cast<std::uint8_t>(cells[cell]));
+                }
+            }
+            else if (version == 2) {
+                //A byte per cell of each chunk
+                const unsigned int chunkCells = Layer::CHUNK_SIZE * Layer::CHUNK_SIZE;
+                const std::uint32_t chunkCount = section.read<std::uint32_t>();
+                for (std::uint32_t c = 0; c < chunkCount && !section.Failed; ++c) {
+                    const int chunkRow = section.read<std::int32_t>();
+                    const std::pair<int, int> key(chunkRow, section.read<std::int32_t>());
+                    const char* cells = section.readBytes(chunkCells);
+                    if (cells == nullptr || !isChunkInMap(key)) {
+                        continue;
+                    }
+                    const sf::IntRect area = this->getChunkArea(key);
+                    for (unsigned int cell = 0; cell < chunkCells; ++cell) {
+                        const int x = static_cast<int>(cell % Layer::CHUNK_SIZE);
+                        const int y = static_cast<int>(cell / Layer::CHUNK_SIZE);
+                        if (x < area.width && y < area.height) {
+                            setType(area.left + x, area.top + y, static_cast<std::uint8_t>(cells[cell]));
+                        }
+                    }
+                }
+            }
+            else {
+                const std::uint32_t chunkCount = section.read<std::uint32_t>();
+                for (std::uint32_t c = 0; c < chunkCount && !section.Failed; ++c) {
+                    std::pair<int, int> key;
+                    std::shared_ptr<PackedTiles> chunk = readChunk(section, key);
+                    if (chunk == nullptr || !isChunkInMap(key)) {
+                        continue;
+                    }
+                    clearInvalidCells(*chunk, key, [this](const TileRecord &tile) {
+                        return tile.Tileset == 0 && tile.Tile < this->TileTypeNames.size();
+                    });
+                    if (chunk->getTileCount() > 0) {
+                        this->TileTypes[key] = chunk;
+                    }
+                }
+            }
+        }
+        else if (id == SECTION_LIGHTS) {
+            this->HasAmbientLight = section.read<std::uint8_t>() != 0;
+            this->AmbientColor = section.read<std::uint32_t>();
+            this->AmbientIntensity = section.read<float>();
+        }
+        else if (id == SECTION_SHAPES) {
+            std::function<ShapeEntry(int)> readShape = [&](int depth) {
+                ShapeEntry shape;
+                shape.Kind = static_cast<DrawShapes>(section.read<std::uint8_t>());
+                shape.Id = section.read<std::int32_t>();
+                shape.Name = section.readString();
+                shape.Color = section.read<std::uint32_t>();
+                shape.ObjectType = section.read<std::int32_t>();
+                shape.Position.x = section.read<float>();
+                shape.Position.y = section.read<float>();
+                shape.Size.x = section.read<float>();
+                shape.Size.y = section.read<float>();
+                const std::uint32_t propertyCount = section.read<std::uint32_t>();
+                for (std::uint32_t p = 0; p < propertyCount && !section.Failed; ++p) {
+                    const int propertyId = section.read<std::int32_t>();
+                    const std::string name = section.readString();
+                    const std::string value = section.readString();
+                    shape.Properties.push_back(makeProperty(propertyId, name, value));
+                }
+                const std::uint32_t pointCount = section.read<std::uint32_t>();
+                //Only lines have points, and those points don't have any of their own
+                if (depth > 0 && pointCount > 0) {
+                    section.Failed = true;
+                }
+                for (std::uint32_t p = 0; p < pointCount && !section.Failed; ++p) {
+                    shape.Points.push_back(readShape(depth + 1));
+                }
+                return shape;
+            };
+            const std::uint32_t count = section.read<std::uint32_t>();
+            for (std::uint32_t s = 0; s < count && !section.Failed; ++s) {
+                this->Shapes.push_back(readShape(0));
+            }
+        }
+        if (section.Failed) {
+            return "The map " + filePath + " is damaged.";
+        }
     }
-    if (name.length() <= 0) {
-        this->_name = "l2dSTART";
-        return "You cannot open a map that has no name!";
+    if (header.Failed || !hasMeta) {
+        return "The map " + filePath + " is damaged.";
     }
-    this->_name = name;
-    this->_layerList.clear();
-    this->_tilesetList.clear();
-    this->_shapeList.clear();
-    this->_oldLayerList = std::stack<std::vector<std::shared_ptr<Layer>>>();
-    this->_redoList = std::stack<std::vector<std::shared_ptr<Layer>>>();
+    return "";
+}
+
+
+/*
+ * MapSaver
+ */
+
+l2d_internal::MapSaver::MapSaver() :
+    _running(false),
+    _progress(0.0f)
+{}
+
+l2d_internal::MapSaver::~MapSaver() {
+    this->wait();
+    if (this->_thread.joinable()) {
+        this->_thread.join();
+    }
+}
+
+// void save
+// Queues data to be written to xmlPath, and to binaryPath too unless it is empty, then returns right away.
+// A save of the same file that is still waiting is replaced, keeping its place in the queue.
+// The worker thread is started if it isn't already running
+void l2d_internal::MapSaver::save(l2d_internal::MapData data, const std::string &xmlPath, const std::string &binaryPath) {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    auto it = std::find_if(this->_pending.begin(), this->_pending.end(), [&](const std::unique_ptr<Job> &job) {
+        return job->XmlPath == xmlPath;
+    });
+    if (it != this->_pending.end()) {
+        it->reset(new Job { std::move(data), xmlPath, binaryPath });
+    }
+    else {
+        this->_pending.emplace_back(new Job { std::move(data), xmlPath, binaryPath });
+    }
+    if (!this->_running) {
+        //A thread that is no longer running has already given up the lock for good, so this doesn't block
+        if (this->_thread.joinable()) {
+            this->_thread.join();
+        }
+        this->_running = true;
+        this->_progress = 0.0f;
+        this->_thread = std::thread(&l2d_internal::MapSaver::run, this);
+    }
+}
+
+// void wait
+// Blocks until every queued save has been written
+void l2d_internal::MapSaver::wait() {
+    std::unique_lock<std::mutex> lock(this->_mutex);
+    this->_idle.wait(lock, [this]() { return !this->_running; });
+}
+
+bool l2d_internal::MapSaver::isSaving() const {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    return this->_running;
+}
+
+float l2d_internal::MapSaver::getProgress() const {
+    return this->_progress;
+}
+
+// bool takeResult
+// If a save has finished that wasn't reported yet, sets error to how the oldest of them went ("" on success) and returns true
+bool l2d_internal::MapSaver::takeResult(std::string &error) {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    if (this->_results.empty()) {
+        return false;
+    }
+    error = std::move(this->_results.front());
+    this->_results.pop_front();
+    return true;
+}
+
+// void run
+// The worker thread. Writes queued saves until there are none left
+void l2d_internal::MapSaver::run() {
+    while (true) {
+        std::unique_ptr<Job> job;
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            if (this->_pending.empty()) {
+                this->_running = false;
+                this->_idle.notify_all();
+                return;
+            }
+            job = std::move(this->_pending.front());
+            this->_pending.pop_front();
+        }
+        //The XML file is most of the work, so it gets most of the progress bar
+        this->_progress = 0.0f;
+        std::string error = job->Data.saveXml(job->XmlPath, [this](float progress) {
+            this->_progress = progress * 0.9f;
+        });
+        if (error.empty() && !job->BinaryPath.empty()) {
+            error = job->Data.saveBinary(job->BinaryPath);
+        }
+        this->_progress = 1.0f;
+        //Dropped before the result is reported, so the level's chunks are no longer shared once the save is done
+        job.reset();
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_results.push_back(error);
+    }
+}
+
+/*
+ * Level
+ */
+
+l2d_internal::Level::Level(std::shared_ptr<Graphics> graphics, std::string name) {
+    this->_loaded = false;
+    this->_graphics = graphics;
+    this->_shapePool = std::make_shared<l2d_internal::ShapePool>();
+    this->_saver = std::make_shared<l2d_internal::MapSaver>();
+    this->loadMap(name);
+    this->_journal.setBudget(l2d_internal::Config::get().UndoMemoryBudget * static_cast<std::size_t>(1024));
     this->_ambientColor = sf::Color::White;
     this->_ambientIntensity = 1.0f;
+}
 
-    tx2::XMLDocument document;
-    std::stringstream ss;
-    ss << l2d_internal::utils::getConfigValue("map_path") << name << ".xml";
-    document.LoadFile(ss.str().c_str());
-
-    tx2::XMLElement* pMap = document.FirstChildElement("map");
-
-    //Get the width and height of the map
-    int width, height;
-    pMap->QueryIntAttribute("width", &width);
-    pMap->QueryIntAttribute("height", &height);
-    this->_size = sf::Vector2i(width, height);
-
-    //Get the width and height of the tiles
-    int tWidth, tHeight;
-    pMap->QueryIntAttribute("tileWidth", &tWidth);
-    pMap->QueryIntAttribute("tileHeight", &tHeight);
-    this->_tileSize = sf::Vector2i(tWidth, tHeight);
-
-    //Loading the tilesets
-    tx2::XMLElement* pTileset = pMap->FirstChildElement("tileset");
-    if (pTileset != nullptr) {
-        while (pTileset) {
-            int tsId, tsWidth, tsHeight;
-            std::string tsPath;
-            pTileset->QueryIntAttribute("id", &tsId);
-            pTileset->QueryIntAttribute("width", &tsWidth);
-            pTileset->QueryIntAttribute("height", &tsHeight);
-            tsPath = pTileset->Attribute("path");
-            this->_tilesetList.push_back(Tileset(tsId, tsPath, sf::Vector2i(tsWidth, tsHeight)));
-            pTileset = pTileset->NextSiblingElement("tileset");
+l2d_internal::Level::~Level() {
+
+}
+
+std::string l2d_internal::Level::getName() const {
+    return this->_name;
+}
+
+sf::Vector2i l2d_internal::Level::getSize() const {
+    return this->_size;
+}
+
+void l2d_internal::Level::setSize(sf::Vector2i size) {
+    this->_size = size;
+    //Tile types outside of the new size are dropped
+    this->_tileTypes.resize(this->_size);
+    this->_background.setLevelSize(this->_size, this->_tileSize);
+}
+
+// void updateTileList
+// Resizes every layer to the size of the level. Tiles that fall outside of it are dropped.
+void l2d_internal::Level::updateTileList() {
+    for (std::shared_ptr<Layer> &layer : this->_layerList) {
+        layer->resize(this->_size);
+    }
+}
+
+sf::Vector2i l2d_internal::Level::getTileSize() const {
+    return this->_tileSize;
+}
+
+const std::vector<l2d_internal::Tileset> &l2d_internal::Level::getTilesetList() const {
+    return this->_tilesetList;
+}
+
+const std::vector<std::shared_ptr<l2d_internal::Layer>> &l2d_internal::Level::getLayerList() const {
+    return this->_layerList;
+}
+
+float l2d_internal::Level::getAmbientIntensity() const {
+    return this->_ambientIntensity;
+}
+
+sf::Color l2d_internal::Level::getAmbientColor() const {
+    return this->_ambientColor;
+}
+
+void l2d_internal::Level::setAmbientIntensity(float intensity) {
+    if (this->_ambientIntensity == intensity) {
+        return;
+    }
+    this->_journal.recordAmbient(this->_ambientColor, this->_ambientIntensity, this->_ambientColor, intensity);
+    this->applyAmbient(this->_ambientColor, intensity);
+}
+
+void l2d_internal::Level::setAmbientColor(sf::Color color) {
+    if (this->_ambientColor == color) {
+        return;
+    }
+    this->_journal.recordAmbient(this->_ambientColor, this->_ambientIntensity, color, this->_ambientIntensity);
+    this->applyAmbient(color, this->_ambientIntensity);
+}
+
+// void applyAmbient
+// Sets the ambient light without recording it for undo
+void l2d_internal::Level::applyAmbient(sf::Color color, float intensity) {
+    if (this->_ambientColor == color && this->_ambientIntensity == intensity) {
+        return;
+    }
+    this->_ambientColor = color;
+    this->_ambientIntensity = intensity;
+    for (auto &layer : this->_layerList) {
+        layer->invalidateCache();
+    }
+}
+
+bool l2d_internal::Level::isChunkCacheEnabled() const {
+    return this->_chunkCacheEnabled;
+}
+
+// void setChunkCacheEnabled
+// When enabled, each visible layer chunk is rendered once into a render texture and reused until it changes
+// Turning it off frees the render textures of every layer right away, not only of the chunks in view
+void l2d_internal::Level::setChunkCacheEnabled(bool enabled) {
+    this->_chunkCacheEnabled = enabled;
+    if (!enabled) {
+        this->_chunkCache.clear();
+    }
+}
+
+// void addShape
+// Adds a shape to the level. A shape without an id, or with one that is already taken, is given a new id.
+void l2d_internal::Level::addShape(std::shared_ptr<l2d_internal::Shape> shape) {
+    if (shape->getId() <= 0 || this->_shapeHandles.count(shape->getId()) > 0) {
+        shape->setId(this->_nextShapeId);
+    }
+    this->insertShape(shape);
+    this->_journal.recordShape(nullptr, this->copyShape(shape));
+}
+
+const std::vector<std::shared_ptr<l2d_internal::Shape>> &l2d_internal::Level::getShapeList() const {
+    return this->_shapeList;
+}
+
+// std::shared_ptr<Shape> getShape
+// Returns the shape with the given id, or nullptr if the level has no such shape
+std::shared_ptr<l2d_internal::Shape> l2d_internal::Level::getShape(int id) const {
+    auto it = this->_shapeHandles.find(id);
+    return it == this->_shapeHandles.end() ? nullptr : this->_shapeList[it->second];
+}
+
+// std::vector<std::shared_ptr<Shape>> getShapesInArea
+// Returns every shape whose bounds touch area, back to front
+std::vector<std::shared_ptr<l2d_internal::Shape>> l2d_internal::Level::getShapesInArea(const sf::FloatRect &area) const {
+    std::vector<std::shared_ptr<l2d_internal::Shape>> shapes;
+    this->_shapeIndex.query(area, shapes);
+    return shapes;
+}
+
+// std::shared_ptr<Shape> getShapeAt
+// Returns the front-most shape under point, or nullptr if there isn't one
+std::shared_ptr<l2d_internal::Shape> l2d_internal::Level::getShapeAt(sf::Vector2f point) const {
+    return this->_shapeIndex.queryPoint(point);
+}
+
+// void refreshShape
+// Call after moving or resizing a shape so it is found at its new position.
+// The points of a line aren't in the level's shape list themselves, so for those the line is refreshed.
+void l2d_internal::Level::refreshShape(std::shared_ptr<l2d_internal::Shape> shape) {
+    std::shared_ptr<l2d_internal::Shape> owner = this->getOwningShape(shape);
+    if (owner != nullptr) {
+        this->_shapeIndex.update(owner);
+    }
+}
+
+// std::shared_ptr<Shape> getOwningShape
+// Returns the shape in the level's shape list that shape belongs to: the shape itself, or the line if shape is one of its points.
+// Returns nullptr if shape isn't part of the level
+std::shared_ptr<l2d_internal::Shape> l2d_internal::Level::getOwningShape(std::shared_ptr<l2d_internal::Shape> shape) const {
+    if (shape == nullptr) {
+        return nullptr;
+    }
+    if (this->_shapeIndex.contains(shape)) {
+        return shape;
+    }
+    for (auto &s : this->_shapeList) {
+        auto line = std::dynamic_pointer_cast<l2d_internal::Line>(s);
+        if (line != nullptr && utils::contains(line->getPoints(), shape)) {
+            return line;
         }
     }
-    
-    //Loading the background
-    tx2::XMLElement* pBackground = pMap->FirstChildElement("background");
-    if (pBackground != nullptr) {
-        while (pBackground) {
-            tx2::XMLElement* pLayers = pBackground->FirstChildElement("layers");
-            if (pLayers != nullptr) {
-                while (pLayers) {
-                    tx2::XMLElement* pLayer = pLayers->FirstChildElement("layer");
-                    if (pLayer != nullptr) {
-                        while (pLayer) {
-                            // int id = pLayer->IntAttribute("id");
-                            std::string path = pLayer->Attribute("path");
-                            this->_background.addLayer(this->_graphics, sf::Vector2i(640, 480), path,
-                                                       this->_size, this->_tileSize);
-                            pLayer = pLayer->NextSiblingElement("layer");
-                        }
+    return nullptr;
+}
+
+// std::shared_ptr<Shape> copyShape
+// Makes a copy of a shape that shares nothing with it, the points of a line included, so changing one never changes the other.
+// The copy keeps the id and custom properties but isn't selected. Returns nullptr for nullptr.
+std::shared_ptr<l2d_internal::Shape> l2d_internal::Level::copyShape(std::shared_ptr<l2d_internal::Shape> shape) {
+    std::shared_ptr<l2d_internal::Shape> copy = nullptr;
+    if (auto rect = std::dynamic_pointer_cast<l2d_internal::Rectangle>(shape)) {
+        copy = this->makeShape<l2d_internal::Rectangle>(*rect);
+    }
+    else if (auto point = std::dynamic_pointer_cast<l2d_internal::Point>(shape)) {
+        copy = this->makeShape<l2d_internal::Point>(*point);
+    }
+    else if (auto line = std::dynamic_pointer_cast<l2d_internal::Line>(shape)) {
+        std::vector<std::shared_ptr<l2d_internal::Point>> points;
+        for (auto &p : line->getPoints()) {
+            points.push_back(std::static_pointer_cast<l2d_internal::Point>(this->copyShape(p)));
+        }
+        copy = this->makeShape<l2d_internal::Line>(line->getName(), line->getColor(), points);
+        copy->setId(line->getId());
+        std::vector<l2d_internal::CustomProperty> properties = line->getCustomProperties();
+        copy->setCustomProperties(properties);
+    }
+    if (copy != nullptr) {
+        copy->unselect();
+    }
+    return copy;
+}
+
+// void refreshShapes
+// Rebuilds the shape index from scratch, e.g. after every shape was moved to fit a resized level
+void l2d_internal::Level::refreshShapes() {
+    this->_shapeIndex.clear();
+    for (auto &shape : this->_shapeList) {
+        this->_shapeIndex.insert(shape);
+    }
+}
+
+// void drawShapes
+// Batches every shape that is in view and draws them all with the shape renderer
+void l2d_internal::Level::drawShapes() {
+    RenderStats &stats = this->_graphics->getRenderStats();
+    this->_shapeRenderer.clear();
+    std::vector<std::shared_ptr<l2d_internal::Shape>> shapes;
+    this->_shapeIndex.query(this->_graphics->getViewBounds(), shapes);
+    stats.ShapesDrawn += static_cast<unsigned int>(shapes.size());
+    stats.ShapesCulled += static_cast<unsigned int>(this->_shapeList.size() - shapes.size());
+    for (auto &shape : shapes) {
+        shape->addToBatch(this->_shapeRenderer);
+    }
+    this->_shapeRenderer.draw(*this->_graphics);
+}
+
+// std::string getTileType
+// Returns the name of the tile type painted on a cell, or an empty string if there isn't one. pos starts at 1
+std::string l2d_internal::Level::getTileType(sf::Vector2i pos) const {
+    const std::size_t id = this->_tileTypes.getTile(pos.x - 1, pos.y - 1).Tile;
+    return id < this->_tileTypeNames.size() ? this->_tileTypeNames[id] : "";
+}
+
+// bool setTileType
+// Paints a tile type on a cell, or clears it when name is empty. pos starts at 1.
+// Returns false if the cell is outside of the map or the map already uses 255 other tile types.
+bool l2d_internal::Level::setTileType(sf::Vector2i pos, const std::string &name) {
+    if (pos.x < 1 || pos.y < 1 || pos.x > this->_size.x || pos.y > this->_size.y) {
+        return false;
+    }
+    if (this->_tileTypeNames.empty()) {
+        this->_tileTypeNames.push_back("");
+    }
+    std::size_t id = 0;
+    if (!name.empty()) {
+        auto it = std::find(this->_tileTypeNames.begin() + 1, this->_tileTypeNames.end(), name);
+        id = static_cast<std::size_t>(std::distance(this->_tileTypeNames.begin(), it));
+        if (it == this->_tileTypeNames.end()) {
+            if (this->_tileTypeNames.size() > 255) {
+                //Every id is taken, so look for a name that isn't painted anywhere anymore.
+                //Ids the journal could still bring back stay taken, or undo would paint the new name
+                std::vector<bool> used(this->_tileTypeNames.size(), false);
+                this->_tileTypes.forEachTile([&used](int, int, const TileRecord &tile) {
+                    used[tile.Tile] = true;
+                });
+                this->_journal.forEachTileChange([&used](const UndoJournal::TileChange &change) {
+                    if (change.Layer == TILE_TYPE_LAYER) {
+                        used[change.Before.Tile] = true;
+                        used[change.After.Tile] = true;
                     }
-                    pLayers = pLayers->NextSiblingElement("layers");
+                });
+                id = static_cast<std::size_t>(std::find(used.begin() + 1, used.end(), false) - used.begin());
+                if (id == used.size()) {
+                    return false;
                 }
+                this->_tileTypeNames[id] = name;
             }
-            pBackground = pBackground->NextSiblingElement("background");
-        }
-    }
-
-    tx2::XMLElement* pTiles = pMap->FirstChildElement("tiles");
-    if (pTiles != nullptr) {
-        while (pTiles) {
-            tx2::XMLElement* pPos = pTiles->FirstChildElement("pos");
-            if (pPos != nullptr) {
-                while (pPos) {
-                    int posX = pPos->IntAttribute("x");
-                    int posY = pPos->IntAttribute("y");
-                    tx2::XMLElement* pTile = pPos->FirstChildElement("tile");
-                    if (pTile != nullptr) {
-                        while (pTile) {
-                            int layer = pTile->IntAttribute("layer");
-                            int tileset = pTile->IntAttribute("tileset");
-                            int tile = std::stoi(pTile->GetText());
-                            if (tile == 0) {
-                                pTile = pTile->NextSiblingElement("tile");
-                                continue;
-                            }
-                            //Get the layer or start a new one
-                            std::shared_ptr<Layer> l;
-                            for (unsigned int i = 0; i < this->_layerList.size(); ++i) {
-                                if (this->_layerList[i]->Id == layer) {
-                                    l = this->_layerList[i];
-                                    break;
-                                }
-                            }
-                            if (l == nullptr) {
-                                l = std::make_shared<Layer>();
-                                l->Id = layer;
-                                this->_layerList.push_back(l);
-                            }
+            else {
+                this->_tileTypeNames.push_back(name);
+            }
+        }
+    }
+    const TileRecord before = this->_tileTypes.getTile(pos.x - 1, pos.y - 1);
+    const TileRecord after { 0, static_cast<std::uint16_t>(id) };
+    this->_tileTypes.setTile(pos.x - 1, pos.y - 1, after);
+    this->_journal.recordTile(TILE_TYPE_LAYER, sf::Vector2i(pos.x - 1, pos.y - 1), before, after);
+    return true;
+}
 
-                            //Get the tileset
-                            std::string tlsPath = "";
-                            sf::Vector2i tlsSize;
-                            for (auto &tls : this->_tilesetList) {
-                                if (tls.Id == tileset) {
-                                    tlsPath = tls.Path;
-                                    tlsSize = tls.Size;
-                                    break;
-                                }
-                            }
-                            sf::Vector2i srcPos(((tile - 1) % tlsSize.x) * this->_tileSize.x, tile <= tlsSize.x ? 0 : (tile - 1)  / tlsSize.x *  this->_tileSize.y);
-                            sf::Vector2f destPos((posX - 1) * this->_tileSize.x * std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")),
-                                                 (posY - 1) * this->_tileSize.y * std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")));
-                            l->Tiles.push_back(std::make_shared<Tile>(this->_graphics, tlsPath, srcPos, this->_tileSize, destPos, tileset, layer));
-                            pTile = pTile->NextSiblingElement("tile");
-                        }
-                    }
-                    pPos = pPos->NextSiblingElement("pos");
-                }
+// void drawTileTypes
+// Tints every visible cell that has a tile type with that type's color. Neighbouring cells of the same type
+// in a row of a chunk become one rectangle, and everything goes out in a single batch.
+void l2d_internal::Level::drawTileTypes(const std::vector<l2d_internal::TileType> &types) {
+    if (this->_tileTypes.isEmpty()) {
+        return;
+    }
+    //Look the colors up once per name instead of once per cell
+    std::vector<sf::Color> colors(this->_tileTypeNames.size(), sf::Color::Transparent);
+    for (std::size_t i = 1; i < this->_tileTypeNames.size(); ++i) {
+        for (const l2d_internal::TileType &type : types) {
+            if (type.Name == this->_tileTypeNames[i]) {
+                colors[i] = sf::Color(type.Color.r, type.Color.g, type.Color.b, 110);
+                break;
             }
-            pTiles = pTiles->NextSiblingElement("tiles");
         }
     }
-    //Objects
-    tx2::XMLElement* pObjects = pMap->FirstChildElement("objects");
-    if (pObjects != nullptr) {
-        while (pObjects) {
-            //Lights
-            tx2::XMLElement* pLights = pObjects->FirstChildElement("lights");
-            if (pLights != nullptr) {
-                while (pLights) {
-                    //Ambient light
-                    tx2::XMLElement* pAmbientLight = pLights->FirstChildElement("ambient");
-                    if (pAmbientLight != nullptr) {
-                        this->_ambientColor = sf::Color(static_cast<sf::Uint32>(pAmbientLight->IntAttribute("color")));
-                        this->_ambientIntensity = pAmbientLight->FloatAttribute("intensity");
-                    }
-                    pLights = pLights->NextSiblingElement("lights");
+    const sf::Vector2f cellSize(this->_tileSize.x * l2d_internal::Config::get().TileScale.x,
+                                this->_tileSize.y * l2d_internal::Config::get().TileScale.y);
+    const sf::FloatRect view = this->_graphics->getViewBounds();
+    const int firstCol = std::max(0, static_cast<int>(std::floor(view.left / cellSize.x)));
+    const int firstRow = std::max(0, static_cast<int>(std::floor(view.top / cellSize.y)));
+    const int lastCol = std::min(this->_size.x - 1, static_cast<int>(std::floor((view.left + view.width) / cellSize.x)));
+    const int lastRow = std::min(this->_size.y - 1, static_cast<int>(std::floor((view.top + view.height) / cellSize.y)));
+    this->_tileTypeRenderer.clear();
+    if (firstCol > lastCol || firstRow > lastRow) {
+        return;
+    }
+    //Only the painted chunks in view are visited, so empty parts of the map cost nothing
+    const int chunkSize = l2d_internal::Layer::CHUNK_SIZE;
+    const sf::IntRect chunks(firstCol / chunkSize, firstRow / chunkSize, lastCol / chunkSize - firstCol / chunkSize + 1,
+                             lastRow / chunkSize - firstRow / chunkSize + 1);
+    this->_tileTypes.forEachChunkIn(chunks, [&](int left, int top, const PackedTiles &tiles) {
+        const std::vector<TileRecord> &palette = tiles.getPalette();
+        const int startX = std::max(firstCol, left);
+        const int endX = std::min(lastCol, left + chunkSize - 1);
+        for (int y = std::max(firstRow, top); y <= std::min(lastRow, top + chunkSize - 1); ++y) {
+            //Cell x of this row is at row + x in the chunk
+            const int row = (y - top) * chunkSize - left;
+            int x = startX;
+            while (x <= endX) {
+                const std::size_t id = palette[tiles.getIndex(static_cast<unsigned int>(row + x))].Tile;
+                int end = x + 1;
+                while (end <= endX && palette[tiles.getIndex(static_cast<unsigned int>(row + end))].Tile == id) {
+                    ++end;
                 }
-            }
-            //Shapes
-            tx2::XMLElement* pShapes = pObjects->FirstChildElement("shapes");
-            if (pShapes != nullptr) {
-                while (pShapes) {
-                    //Rectangles
-                    tx2::XMLElement* pRectangles = pShapes->FirstChildElement("rectangles");
-                    if (pRectangles != nullptr) {
-                        while (pRectangles) {
-                            tx2::XMLElement* pRectangle = pRectangles->FirstChildElement("rectangle");
-                            if (pRectangle != nullptr) {
-                                while (pRectangle) {
-                                    std::string name = pRectangle->Attribute("name");
-                                    sf::Color color = sf::Color(
-                                            static_cast<sf::Uint32>(pRectangle->IntAttribute("color")));
-                                    l2d_internal::ObjectTypes type = static_cast<l2d_internal::ObjectTypes>(pRectangle->IntAttribute(
-                                            "type"));
-                                    sf::Vector2f position;
-                                    sf::Vector2f size;
-                                    std::vector<l2d_internal::CustomProperty> properties;
-                                    tx2::XMLElement* pRectanglePosition = pRectangle->FirstChildElement("pos");
-                                    if (pRectanglePosition != nullptr) {
-                                        position.x = pRectanglePosition->FloatAttribute("x");
-                                        position.y = pRectanglePosition->FloatAttribute("y");
-                                    }
-                                    tx2::XMLElement* pRectangleSize = pRectangle->FirstChildElement("size");
-                                    if (pRectangleSize != nullptr) {
-                                        size.x = pRectangleSize->FloatAttribute("w");
-                                        size.y = pRectangleSize->FloatAttribute("h");
-                                    }
-                                    tx2::XMLElement* pProperties = pRectangle->FirstChildElement("properties");
-                                    if (pProperties != nullptr) {
-                                        tx2::XMLElement* pProperty = pProperties->FirstChildElement("property");
-                                        if (pProperty != nullptr) {
-                                            while (pProperty) {
-                                                int pid = pProperty->IntAttribute("id");
-                                                std::string pname = pProperty->Attribute("name");
-                                                std::string pvalue = pProperty->Attribute("value");
-                                                properties.push_back(l2d_internal::CustomProperty(pid, pname, pvalue));
-                                                pProperty = pProperty->NextSiblingElement("property");
-                                            }
-                                        }
-                                    }
-                                    sf::RectangleShape rect;
-                                    rect.setPosition(position);
-                                    rect.setSize(size);
-                                    rect.setFillColor(color);
-                                    rect.setOutlineThickness(2.0f);
-                                    rect.setOutlineColor(sf::Color(color.r, color.g, color.b, 160));
-                                    auto rectangle = std::make_shared<l2d_internal::Rectangle>(name, color, type, rect);
-                                    rectangle->setCustomProperties(properties);
-                                    this->_shapeList.push_back(rectangle);
-                                    pRectangle = pRectangle->NextSiblingElement("rectangle");
-                                }
-                            }
-                            pRectangles = pRectangles->NextSiblingElement("rectangles");
-                        }
-                    }
-                    //Points
-                    tx2::XMLElement* pPoints = pShapes->FirstChildElement("points");
-                    if (pPoints != nullptr) {
-                        while (pPoints) {
-                            tx2::XMLElement* pPoint = pPoints->FirstChildElement("point");
-                            if (pPoint != nullptr) {
-                                while (pPoint) {
-                                    std::string name = pPoint->Attribute("name");
-                                    sf::Color color = sf::Color(static_cast<sf::Uint32>(pPoint->IntAttribute("color")));
-                                    sf::Vector2f position;
-                                    std::vector<l2d_internal::CustomProperty> properties;
-                                    tx2::XMLElement* pPointPosition = pPoint->FirstChildElement("pos");
-                                    if (pPointPosition != nullptr) {
-                                        position.x = pPointPosition->FloatAttribute("x");
-                                        position.y = pPointPosition->FloatAttribute("y");
-                                    }
-                                    tx2::XMLElement* pProperties = pPoint->FirstChildElement("properties");
-                                    if (pProperties != nullptr) {
-                                        tx2::XMLElement* pProperty = pProperties->FirstChildElement("property");
-                                        if (pProperty != nullptr) {
-                                            while (pProperty) {
-                                                int pid = pProperty->IntAttribute("id");
-                                                std::string pname = pProperty->Attribute("name");
-                                                std::string pvalue = pProperty->Attribute("value");
-                                                properties.push_back(l2d_internal::CustomProperty(pid, pname, pvalue));
-                                                pProperty = pProperty->NextSiblingElement("property");
-                                            }
-                                        }
-                                    }
-                                    sf::CircleShape dot;
-                                    dot.setPosition(position);
-                                    dot.setFillColor(sf::Color(color.r, color.g, color.b, 80));
-                                    dot.setOutlineColor(sf::Color(color.r, color.g, color.b, 160));
-                                    dot.setOutlineThickness(2.0f);
-                                    dot.setRadius(6.0f);
-                                    auto point = std::make_shared<l2d_internal::Point>(name, color, dot);
-                                    point->setCustomProperties(properties);
-                                    this->_shapeList.push_back(point);
-                                    pPoint = pPoint->NextSiblingElement("point");
-                                }
-                            }
-                            pPoints = pPoints->NextSiblingElement("points");
-                        }
-                    }
-                    //Lines
-                    tx2::XMLElement* pLines = pShapes->FirstChildElement("lines");
-                    if (pLines != nullptr) {
-                        while (pLines) {
-                            tx2::XMLElement* pLine = pLines->FirstChildElement("line");
-                            if (pLine != nullptr) {
-                                while (pLine) {
-                                    std::string name = pLine->Attribute("name");
-                                    sf::Color color = sf::Color(static_cast<sf::Uint32>(pLine->IntAttribute("color")));
-                                    std::vector<std::shared_ptr<l2d_internal::Point>> points;
-                                    std::vector<l2d_internal::CustomProperty> properties;
-                                    tx2::XMLElement* pLinePoints = pLine->FirstChildElement("points");
-                                    if (pLinePoints != nullptr) {
-                                        while (pLinePoints) {
-                                            tx2::XMLElement* pPoint = pLinePoints->FirstChildElement("point");
-                                            if (pPoint != nullptr) {
-                                                while (pPoint) {
-                                                    std::string pointName = pPoint->Attribute("name");
-                                                    sf::Color pointColor = sf::Color(static_cast<sf::Uint32>(pPoint->IntAttribute("color")));
-                                                    sf::Vector2f position;
-                                                    std::vector<l2d_internal::CustomProperty> props;
-                                                    tx2::XMLElement* pLinePointPosition = pPoint->FirstChildElement("pos");
-                                                    if (pLinePointPosition != nullptr) {
-                                                        position.x = pLinePointPosition->FloatAttribute("x");
-                                                        position.y = pLinePointPosition->FloatAttribute("y");
-                                                    }
-                                                    tx2::XMLElement* pProperties = pLine->FirstChildElement("properties");
-                                                    if (pProperties != nullptr) {
-                                                        tx2::XMLElement* pProperty = pProperties->FirstChildElement("property");
-                                                        if (pProperty != nullptr) {
-                                                            while (pProperty) {
-                                                                int pid = pProperty->IntAttribute("id");
-                                                                std::string pname = pProperty->Attribute("name");
-                                                                std::string pvalue = pProperty->Attribute("value");
-                                                                props.push_back(l2d_internal::CustomProperty(pid, pname, pvalue));
-                                                                pProperty = pProperty->NextSiblingElement("property");
-                                                            }
-                                                        }
-                                                    }
-                                                    sf::CircleShape dot;
-                                                    dot.setPosition(position);
-                                                    dot.setFillColor(sf::Color(pointColor.r, pointColor.g, pointColor.b, 80));
-                                                    dot.setOutlineColor(sf::Color(pointColor.r, pointColor.g, pointColor.b, 160));
-                                                    dot.setOutlineThickness(2.0f);
-                                                    dot.setRadius(6.0f);
-                                                    auto point = std::make_shared<l2d_internal::Point>(pointName, pointColor, dot);
-                                                    point->setCustomProperties(props);
-                                                    points.push_back(point);
-                                                    pPoint = pPoint->NextSiblingElement("point");
-                                                }
-                                            }
-                                            pLinePoints = pLinePoints->NextSiblingElement("points");
-                                        }
-                                    }
-                                    tx2::XMLElement* pProperties = pLine->FirstChildElement("properties");
-                                    if (pProperties != nullptr) {
-                                        tx2::XMLElement* pProperty = pProperties->FirstChildElement("property");
-                                        if (pProperty != nullptr) {
-                                            while (pProperty) {
-                                                int pid = pProperty->IntAttribute("id");
-                                                std::string pname = pProperty->Attribute("name");
-                                                std::string pvalue = pProperty->Attribute("value");
-                                                properties.push_back(l2d_internal::CustomProperty(pid, pname, pvalue));
-                                                pProperty = pProperty->NextSiblingElement("property");
-                                            }
-                                        }
-                                    }
-                                    auto line = std::make_shared<l2d_internal::Line>(name, color, points);
-                                    line->setCustomProperties(properties);
-                                    this->_shapeList.push_back(line);
-                                    pLine = pLine->NextSiblingElement("lines");
-                                }
-                            }
-                            pLines = pLines->NextSiblingElement("lines");
-                        }
-                    }
-                    pShapes = pShapes->NextSiblingElement("shapes");
+                if (id != 0 && id < colors.size() && colors[id].a > 0) {
+                    this->_tileTypeRenderer.addRectangle(sf::FloatRect(x * cellSize.x, y * cellSize.y, (end - x) * cellSize.x, cellSize.y),
+                                                         colors[id], sf::Color::Transparent, 0.0f);
                 }
+                x = end;
             }
-            pObjects = pObjects->NextSiblingElement("objects");
         }
+    });
+    this->_tileTypeRenderer.draw(*this->_graphics);
+}
+
+void l2d_internal::Level::createMap(std::string name, sf::Vector2i size, sf::Vector2i tileSize) {
+    this->_layerList.clear();
+    this->clearShapes();
+    this->_journal.clear();
+    this->_shapeEdits.clear();
+    this->_tilesetList.clear();
+    this->_tileTypes.setTileChunks(l2d_internal::TileChunkMap());
+    this->_tileTypeNames.clear();
+    this->_ambientColor = sf::Color::White;
+    this->_ambientIntensity = 1.0f;
+    this->_name = name;
+    this->_size = size;
+    this->_tileSize = tileSize;
+    this->saveMap(name);
+    this->loadMap(name);
+}
+
+std::string l2d_internal::Level::loadMap(std::string &name) {
+    if (name == "l2dSTART") {
+        return "";
     }
+    if (name.length() <= 0) {
+        this->_name = "l2dSTART";
+        return "You cannot open a map that has no name!";
+    }
+    //A save still being written could be this map, so let it finish first
+    this->_saver->wait();
+    l2d_internal::MapData data;
+    std::string error = data.load(l2d_internal::MapData::getMapFilePath(name));
+    if (!error.empty()) {
+        return error;
+    }
+    this->_name = name;
+    this->_layerList.clear();
+    this->_tilesetList.clear();
+    this->clearShapes();
+    this->_background.clear();
+    this->_journal.clear();
+    this->_shapeEdits.clear();
+    //Every shape of the old map is gone now, as the editor lets go of its shapes before loading, so the pool can start over
+    this->_shapePool->reset();
+    this->_journal.setBudget(l2d_internal::Config::get().UndoMemoryBudget * static_cast<std::size_t>(1024));
+    this->applyMapData(data);
+    this->rebuildTileSources();
+    this->assignShapeIds();
+    this->refreshShapes();
     this->_loaded = true;
     return "";
 }
 
+// void saveMap
+// Saves the map as XML, with its tiles in the encoding set in the config. If the map also has a binary file,
+// that is written too so it doesn't go stale.
+// Only the snapshot is taken here. The files are written in the background, see takeSaveResult
 void l2d_internal::Level::saveMap(std::string name) {
     this->_name = name;
-    tx2::XMLDocument document;
-    std::stringstream ss;
-    ss << l2d_internal::utils::getConfigValue("map_path") << name << ".xml";
-    document.LoadFile(ss.str().c_str());
-    document.Clear();
-    tx2::XMLDeclaration* pDeclaration = document.NewDeclaration("xml version=\"1.0\" encoding=\"UTF-8\"");
-    document.InsertFirstChild(pDeclaration);
+    l2d_internal::MapData data;
+    this->fillMapData(data);
+    data.Encoding = l2d_internal::MapData::getTileEncoding(l2d_internal::Config::get().MapEncoding);
+    const std::string path = l2d_internal::Config::get().MapPath + name;
+    std::error_code error;
+    const bool hasBinary = std::experimental::filesystem::exists(path + l2d_internal::MapData::BINARY_EXTENSION, error);
+    this->_saver->save(std::move(data), path + ".xml", hasBinary ? path + l2d_internal::MapData::BINARY_EXTENSION : "");
+}
 
-    //Map node
-    tx2::XMLElement* pMap = document.NewElement("map");
-    pMap->SetAttribute("name", name.c_str());
-    pMap->SetAttribute("width", this->_size.x);
-    pMap->SetAttribute("height", this->_size.y);
-    pMap->SetAttribute("tileWidth", this->_tileSize.x);
-    pMap->SetAttribute("tileHeight", this->_tileSize.y);
+bool l2d_internal::Level::isSaving() const {
+    return this->_saver->isSaving();
+}
 
-    //Tilesets
-    for (Tileset &t : this->_tilesetList) {
-        tx2::XMLElement* pTileset = document.NewElement("tileset");
-        pTileset->SetAttribute("id", t.Id);
-        pTileset->SetAttribute("path", t.Path.c_str());
-        pTileset->SetAttribute("width", t.Size.x);
-        pTileset->SetAttribute("height", t.Size.y);
-        pMap->InsertEndChild(pTileset);
+float l2d_internal::Level::getSaveProgress() const {
+    return this->_saver->getProgress();
+}
+
+// bool takeSaveResult
+// If a save has finished that wasn't reported yet, sets error to how it went ("" on success) and returns true.
+// With several finished saves, each call reports the next one
+bool l2d_internal::Level::takeSaveResult(std::string &error) {
+    return this->_saver->takeResult(error);
+}
+
+// void applyMapData
+// Fills the level with the contents of a map file. Expects the level to have been cleared first
+void l2d_internal::Level::applyMapData(const l2d_internal::MapData &data) {
+    this->_size = data.Size;
+    this->_tileSize = data.TileSize;
+    this->_tilesetList = data.Tilesets;
+    for (const l2d_internal::MapData::BackgroundEntry &background : data.Backgrounds) {
+        this->_background.addLayer(this->_graphics, background.Path, this->_size, this->_tileSize, background.Scale, background.Parallax);
     }
-    
-    //Background
-    tx2::XMLElement* pBackground = document.NewElement("background");
-    tx2::XMLElement* pBackgroundLayers = document.NewElement("layers");
-    for (unsigned int i = 0; i < this->_background.getLayers().size(); ++i) {
-        tx2::XMLElement* pBackgroundLayer = document.NewElement("layer");
-        pBackgroundLayer->SetAttribute("id", i);
-        pBackgroundLayer->SetAttribute("path", this->_background.getLayers()[i].getPath().c_str());
-        pBackgroundLayers->InsertEndChild(pBackgroundLayer);
+    for (const l2d_internal::MapData::LayerEntry &entry : data.Layers) {
+        auto layer = std::make_shared<Layer>(entry.Id, this->_size);
+        layer->setTileChunks(entry.Chunks);
+        if (!layer->isEmpty()) {
+            this->_layerList.push_back(layer);
+        }
     }
-    pBackground->InsertEndChild(pBackgroundLayers);
-    pMap->InsertEndChild(pBackground);
+    this->_tileTypeNames = data.TileTypeNames;
+    this->_tileTypes.resize(this->_size);
+    this->_tileTypes.setTileChunks(data.TileTypes);
+    this->_ambientColor = data.HasAmbientLight ? sf::Color(data.AmbientColor) : sf::Color::White;
+    this->_ambientIntensity = data.HasAmbientLight ? data.AmbientIntensity : 1.0f;
 
-    //Tiles
-    tx2::XMLElement* pTiles = document.NewElement("tiles");
-
-    //Pos nodes
-    std::vector<std::shared_ptr<Tile>> allTiles;
-    for (std::shared_ptr<Layer> &layer : this->_layerList) {
-        allTiles.insert(allTiles.end(), layer.get()->Tiles.begin(), layer.get()->Tiles.end());
-    }
-    //Sort allTiles by y, then by x, then by layer
-    std::sort(allTiles.begin(), allTiles.end(), [&](const std::shared_ptr<Tile> &a, const std::shared_ptr<Tile> &b) {
-        return ((a.get()->getSprite().getPosition().y < b.get()->getSprite().getPosition().y) ||
-                ((a.get()->getSprite().getPosition().y == b.get()->getSprite().getPosition().y) &&
-                 a.get()->getSprite().getPosition().x < b.get()->getSprite().getPosition().x) ||
-                (((a.get()->getSprite().getPosition().y == b.get()->getSprite().getPosition().y) &&
-                  a.get()->getSprite().getPosition().x == b.get()->getSprite().getPosition().x) &&
-                 a.get()->getLayer() < b.get()->getLayer()));
-    });
-    for (std::shared_ptr<Tile> &tile : allTiles) {
-        float x = tile.get()->getSprite().getPosition().x / this->_tileSize.x / std::stof(l2d_internal::utils::getConfigValue("tile_scale_x")) + 1;
-        float y = tile.get()->getSprite().getPosition().y / this->_tileSize.y / std::stof(l2d_internal::utils::getConfigValue("tile_scale_y")) + 1;
-
-        //If the pos was already created previously, use it instead of creating a new one
-        //This will group all tiles from all layers that exist in one pos together
-        tx2::XMLElement* lastPosX = pTiles->LastChildElement("pos");
-        tx2::XMLElement* lastPosY = pTiles->LastChildElement("pos");
-        tx2::XMLElement* pPos;
-        if (lastPosX == nullptr || lastPosY == nullptr) {
-            pPos = document.NewElement("pos");
+    //Shapes
+    auto createPoint = [this](const l2d_internal::MapData::ShapeEntry &entry) {
+        const sf::Color color(entry.Color);
+        sf::CircleShape dot;
+        dot.setPosition(entry.Position);
+        dot.setFillColor(sf::Color(color.r, color.g, color.b, 80));
+        dot.setOutlineColor(sf::Color(color.r, color.g, color.b, 160));
+        dot.setOutlineThickness(2.0f);
+        dot.setRadius(6.0f);
+        return this->makeShape<l2d_internal::Point>(entry.Name, color, dot);
+    };
+    for (const l2d_internal::MapData::ShapeEntry &entry : data.Shapes) {
+        std::shared_ptr<l2d_internal::Shape> shape;
+        const sf::Color color(entry.Color);
+        if (entry.Kind == l2d_internal::DrawShapes::Rectangle) {
+            sf::RectangleShape rect;
+            rect.setPosition(entry.Position);
+            rect.setSize(entry.Size);
+            rect.setFillColor(color);
+            rect.setOutlineThickness(2.0f);
+            rect.setOutlineColor(sf::Color(color.r, color.g, color.b, 160));
+            shape = this->makeShape<l2d_internal::Rectangle>(entry.Name, color, static_cast<l2d_internal::ObjectTypes>(entry.ObjectType), rect);
         }
-        else {
-            pPos = pTiles->LastChildElement("pos")->FloatAttribute("x") == x &&
-                   pTiles->LastChildElement("pos")->FloatAttribute("y") == y ?
-                   pTiles->LastChildElement("pos") : document.NewElement("pos");
-        }
-        pPos->SetAttribute("x", x);
-        pPos->SetAttribute("y", y);
-
-        //Tile elements
-        tx2::XMLElement *pTile = document.NewElement("tile");
-        pTile->SetAttribute("layer", tile.get()->getLayer());
-        pTile->SetAttribute("tileset", tile.get()->getTilesetId());
-        int tileNumber;
-        if (tile.get()->getSprite().getTextureRect().top == 0) {
-            //First row in tileset
-            tileNumber = (tile.get()->getSprite().getTextureRect().left / this->_tileSize.x) + 1;
+        else if (entry.Kind == l2d_internal::DrawShapes::Point) {
+            shape = createPoint(entry);
         }
-        else {
-            auto tileset = std::find_if(this->_tilesetList.begin(), this->_tilesetList.end(), [&](Tileset t) {
-                return t.Id == tile.get()->getTilesetId();
-            });
-            tileNumber = (tileset->Size.x) * (tile.get()->getSprite().getTextureRect().top / this->_tileSize.y) + 1 + (tile.get()->getSprite().getTextureRect().left / this->_tileSize.x);
+        else if (entry.Kind == l2d_internal::DrawShapes::Line) {
+            std::vector<std::shared_ptr<l2d_internal::Point>> points;
+            for (const l2d_internal::MapData::ShapeEntry &point : entry.Points) {
+                points.push_back(createPoint(point));
+            }
+            shape = this->makeShape<l2d_internal::Line>(entry.Name, color, points);
+        }
+        if (shape == nullptr) {
+            continue;
         }
-        pTile->SetText(tileNumber);
-        pPos->InsertEndChild(pTile);
-        pTiles->InsertEndChild(pPos);
+        std::vector<l2d_internal::CustomProperty> properties = entry.Properties;
+        shape->setCustomProperties(properties);
+        shape->setId(entry.Id);
+        this->_shapeList.push_back(shape);
     }
+}
 
-    pMap->InsertEndChild(pTiles);
+// void fillMapData
+// Describes the level as the contents of a map file
+void l2d_internal::Level::fillMapData(l2d_internal::MapData &data) const {
+    data.Name = this->_name;
+    data.Size = this->_size;
+    data.TileSize = this->_tileSize;
+    data.Tilesets = this->_tilesetList;
+    for (const auto &layer : this->_background.getLayers()) {
+        data.Backgrounds.push_back(l2d_internal::MapData::BackgroundEntry { layer.first, layer.second.getPath(), layer.second.getScale(),
+                                                                            layer.second.getParallax() });
+    }
+    //The snapshot shares the layers' chunks instead of copying their tiles, so taking it only costs a pointer per
+    //painted chunk. A chunk edited while the save is still running is copied first (see PackedTiles::makeUnique)
+    for (const std::shared_ptr<Layer> &layer : this->_layerList) {
+        data.getLayer(layer->Id).Chunks = layer->getTileChunks();
+    }
 
-    //Save objects
-    tx2::XMLElement* pObjects = document.NewElement("objects");
-    //Lights
-    tx2::XMLElement* pLights = document.NewElement("lights");
-    if (this->_ambientColor != sf::Color::White && this->_ambientIntensity != 1.0f) {
-        tx2::XMLElement* pAmbientLight = document.NewElement("ambient");
-        pAmbientLight->SetAttribute("color", this->_ambientColor.toInteger());
-        pAmbientLight->SetAttribute("intensity", this->_ambientIntensity);
-        pLights->InsertEndChild(pAmbientLight);
+    //Tile types. Names that aren't painted anywhere are left out and the rest are renumbered to match.
+    //If that doesn't change any ids, the chunks are shared the same way as the layers' chunks
+    std::vector<bool> used(this->_tileTypeNames.size(), false);
+    this->_tileTypes.forEachTile([&used](int, int, const TileRecord &tile) {
+        used[tile.Tile] = true;
+    });
+    std::vector<std::uint16_t> remap(this->_tileTypeNames.size(), 0);
+    bool renumbered = false;
+    for (std::size_t i = 1; i < this->_tileTypeNames.size(); ++i) {
+        if (used[i]) {
+            data.TileTypeNames.push_back(this->_tileTypeNames[i]);
+            remap[i] = static_cast<std::uint16_t>(data.TileTypeNames.size() - 1);
+            renumbered = renumbered || remap[i] != i;
+        }
+    }
+    if (data.TileTypeNames.size() > 1 && !renumbered) {
+        data.TileTypes = this->_tileTypes.getTileChunks();
+    }
+    else if (data.TileTypeNames.size() > 1) {
+        this->_tileTypes.forEachTile([&](int x, int y, const TileRecord &tile) {
+            data.setTile(data.TileTypes, x, y, TileRecord { 0, remap[tile.Tile] });
+        });
     }
-    pObjects->InsertEndChild(pLights);
 
-    //Shapes
-    tx2::XMLElement* pShapes = document.NewElement("shapes");
-    tx2::XMLElement* pRectangles = document.NewElement("rectangles");
-    tx2::XMLElement* pPoints = document.NewElement("points");
-    tx2::XMLElement* pLines = document.NewElement("lines");
-    for (std::shared_ptr<l2d_internal::Shape> &shape: this->_shapeList) {
-        auto props = shape->getCustomProperties();
+    data.HasAmbientLight = this->_ambientColor != sf::Color::White || this->_ambientIntensity != 1.0f;
+    data.AmbientColor = this->_ambientColor.toInteger();
+    data.AmbientIntensity = this->_ambientIntensity;
+
+    //Removing a shape reorders the list, so shapes are written by id to keep the file stable
+    std::vector<std::shared_ptr<l2d_internal::Shape>> shapes = this->_shapeList;
+    std::sort(shapes.begin(), shapes.end(), [](const std::shared_ptr<l2d_internal::Shape> &a, const std::shared_ptr<l2d_internal::Shape> &b) {
+        return a->getId() < b->getId();
+    });
+    auto describePoint = [](const std::shared_ptr<l2d_internal::Point> &p) {
+        l2d_internal::MapData::ShapeEntry entry;
+        entry.Kind = l2d_internal::DrawShapes::Point;
+        entry.Id = p->getId();
+        entry.Name = p->getName();
+        entry.Color = p->getColor().toInteger();
+        entry.Position = p->getCircle().getPosition();
+        return entry;
+    };
+    for (const std::shared_ptr<l2d_internal::Shape> &shape : shapes) {
+        l2d_internal::MapData::ShapeEntry entry;
         std::shared_ptr<l2d_internal::Rectangle> r = std::dynamic_pointer_cast<l2d_internal::Rectangle>(shape);
+        std::shared_ptr<l2d_internal::Point> p = std::dynamic_pointer_cast<l2d_internal::Point>(shape);
+        std::shared_ptr<l2d_internal::Line> l = std::dynamic_pointer_cast<l2d_internal::Line>(shape);
         if (r != nullptr) {
-            tx2::XMLElement* pRectangle = document.NewElement("rectangle");
-            pRectangle->SetAttribute("name", r->getName().c_str());
-            pRectangle->SetAttribute("color", r->getColor().toInteger());
-            pRectangle->SetAttribute("type", static_cast<int>(r->getObjectType()));
-            tx2::XMLElement* pRectanglePosition = document.NewElement("pos");
-            pRectanglePosition->SetAttribute("x", r->getRectangle().getPosition().x);
-            pRectanglePosition->SetAttribute("y", r->getRectangle().getPosition().y);
-            pRectangle->InsertEndChild(pRectanglePosition);
-            tx2::XMLElement* pRectangleSize = document.NewElement("size");
-            pRectangleSize->SetAttribute("w", r->getRectangle().getSize().x);
-            pRectangleSize->SetAttribute("h", r->getRectangle().getSize().y);
-            pRectangle->InsertEndChild(pRectangleSize);
-            tx2::XMLElement* pProperties = document.NewElement("properties");
-            for (auto &pr : props) {
-                tx2::XMLElement* pProperty = document.NewElement("property");
-                pProperty->SetAttribute("id", pr.Id);
-                pProperty->SetAttribute("name", pr.Name);
-                pProperty->SetAttribute("value", pr.Value);
-                pProperties->InsertEndChild(pProperty);
-            }
-            pRectangle->InsertEndChild(pProperties);
-            pRectangles->InsertEndChild(pRectangle);
-            continue;
+            entry.Kind = l2d_internal::DrawShapes::Rectangle;
+            entry.ObjectType = static_cast<int>(r->getObjectType());
+            entry.Position = r->getRectangle().getPosition();
+            entry.Size = r->getRectangle().getSize();
         }
-        std::shared_ptr<l2d_internal::Point> p = std::dynamic_pointer_cast<l2d_internal::Point>(shape);
-        if (p != nullptr) {
-            tx2::XMLElement* pPoint = document.NewElement("point");
-            pPoint->SetAttribute("name", p->getName().c_str());
-            pPoint->SetAttribute("color", p->getColor().toInteger());
-            tx2::XMLElement* pPointPosition = document.NewElement("pos");
-            pPointPosition->SetAttribute("x", p->getCircle().getPosition().x);
-            pPointPosition->SetAttribute("y", p->getCircle().getPosition().y);
-            pPoint->InsertEndChild(pPointPosition);
-            tx2::XMLElement* pProperties = document.NewElement("properties");
-            for (auto &pr : props) {
-                tx2::XMLElement* pProperty = document.NewElement("property");
-                pProperty->SetAttribute("id", pr.Id);
-                pProperty->SetAttribute("name", pr.Name);
-                pProperty->SetAttribute("value", pr.Value);
-                pProperties->InsertEndChild(pProperty);
-            }
-            pPoint->InsertEndChild(pProperties);
-            pPoints->InsertEndChild(pPoint);
+        else if (p != nullptr) {
+            entry = describePoint(p);
+        }
+        else if (l != nullptr) {
+            entry.Kind = l2d_internal::DrawShapes::Line;
+            for (const std::shared_ptr<l2d_internal::Point> &point : l->getPoints()) {
+                entry.Points.push_back(describePoint(point));
+            }
+        }
+        else {
             continue;
         }
-        std::shared_ptr<l2d_internal::Line> l = std::dynamic_pointer_cast<l2d_internal::Line>(shape);
-        if (l != nullptr) {
-            tx2::XMLElement* pLine = document.NewElement("line");
-            pLine->SetAttribute("name", l->getName().c_str());
-            pLine->SetAttribute("color", l->getColor().toInteger());
-            tx2::XMLElement* pLinePoints = document.NewElement("points");
-            for (auto &p : l->getPoints()) {
-                tx2::XMLElement* pLinePoint = document.NewElement("point");
-                pLinePoint->SetAttribute("name", p->getName().c_str());
-                pLinePoint->SetAttribute("color", p->getColor().toInteger());
-                tx2::XMLElement* pLinePointPosition = document.NewElement("pos");
-                pLinePointPosition->SetAttribute("x", p->getCircle().getPosition().x);
-                pLinePointPosition->SetAttribute("y", p->getCircle().getPosition().y);
-                pLinePoint->InsertEndChild(pLinePointPosition);
-                pLinePoints->InsertEndChild(pLinePoint);
-            }
-            pLine->InsertEndChild(pLinePoints);
-            tx2::XMLElement* pProperties = document.NewElement("properties");
-            for (auto &pr : props) {
-                tx2::XMLElement* pProperty = document.NewElement("property");
-                pProperty->SetAttribute("id", pr.Id);
-                pProperty->SetAttribute("name", pr.Name);
-                pProperty->SetAttribute("value", pr.Value);
-                pProperties->InsertEndChild(pProperty);
-            }
-            pLine->InsertEndChild(pProperties);
-            pLines->InsertEndChild(pLine);
-        }
-    }
-    pShapes->InsertEndChild(pRectangles);
-    pShapes->InsertEndChild(pPoints);
-    pShapes->InsertEndChild(pLines);
-    pObjects->InsertEndChild(pShapes);
-    pMap->InsertEndChild(pObjects);
-    document.InsertAfterChild(pDeclaration, pMap);
-
-    //Save the document
-    document.SaveFile(ss.str().c_str());
+        entry.Id = shape->getId();
+        entry.Name = shape->getName();
+        entry.Color = shape->getColor().toInteger();
+        entry.Properties = shape->getCustomProperties();
+        data.Shapes.push_back(entry);
+    }
 }
 
-void l2d_internal::Level::updateTile(std::string newTilesetPath, sf::Vector2i newTilesetSize, sf::Vector2i srcPos,
-                                     sf::Vector2f destPos, int tilesetId, int layer) {
-
-    static auto layerExists = [&]()->std::shared_ptr<Layer> {
-        for (unsigned int i = 0; i < this->_layerList.size(); ++i) {
-            if (this->_layerList[i]->Id == layer) {
-                return this->_layerList[i];
-            }
+// std::shared_ptr<Layer> getLayer
+// Returns the layer with the given id, or nullptr if the level doesn't have one
+std::shared_ptr<l2d_internal::Layer> l2d_internal::Level::getLayer(int id) const {
+    for (const std::shared_ptr<Layer> &l : this->_layerList) {
+        if (l->Id == id) {
+            return l;
         }
-        return nullptr;
-    };
+    }
+    return nullptr;
+}
 
-    sf::Vector2f newDestPos((destPos.x - 1) * this->_tileSize.x * static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_x"))),
-                            (destPos.y - 1) * this->_tileSize.y * static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))));
-    //First do a check to see if the tile is identical on the same layer. If so, don't do any of this
-    std::shared_ptr<Layer> cl = layerExists();
-    if (cl != nullptr) {
-        //Layer exists. Now check if there's anything on the tile
-        std::shared_ptr<Tile> t = nullptr;
-        for (unsigned int i = 0; i < cl.get()->Tiles.size(); ++i) {
-            if (cl.get()->Tiles[i].get()->getSprite().getPosition().x == newDestPos.x && cl.get()->Tiles[i].get()->getSprite().getPosition().y == newDestPos.y) {
-                t = cl.get()->Tiles[i];
-                break;
-            }
-        }
-        if (t != nullptr) {
-            //Something's on the tile. Check if it's the same tile trying to be drawn. If so, quit.
-            if (t.get()->getSprite().getTextureRect().left == srcPos.x && t.get()->getSprite().getTextureRect().top == srcPos.y) {
-                //Check if the tileset is the same. If not, continue through function
-                if (t->getTilesetId() == tilesetId) {
-                    //Same tile. Stop the function.
-                    return;
-                }
-            }
-        }
+// Layer* getEditedLayer
+// Returns the layer a journal tile change belongs to: the tile types for TILE_TYPE_LAYER, otherwise the tile layer with that id.
+// A missing tile layer is created if create is true, otherwise nullptr is returned
+l2d_internal::Layer* l2d_internal::Level::getEditedLayer(int id, bool create) {
+    if (id == TILE_TYPE_LAYER) {
+        return &this->_tileTypes;
+    }
+    std::shared_ptr<Layer> l = this->getLayer(id);
+    if (l == nullptr && create) {
+        l = std::make_shared<Layer>(id, this->_size);
+        this->_layerList.push_back(l);
     }
+    return l.get();
+}
 
-    //Set oldLayerList for Undo
-    std::vector<std::shared_ptr<l2d_internal::Layer>> tmpList;
-    for (unsigned int i = 0; i < this->_layerList.size(); ++i) {
-        l2d_internal::Layer l;
-        l.Id = this->_layerList.at(i).get()->Id;
-        for (unsigned int j = 0; j < this->_layerList[i].get()->Tiles.size(); ++j) {
-            l.Tiles.emplace_back(this->_layerList[i].get()->Tiles.at(j));
-        }
-        tmpList.push_back(std::make_shared<l2d_internal::Layer>(l));
+// void rebuildTileSources
+// Loads the texture of every tileset and repacks the atlas. Layers notice the new version and rebuild their vertices.
+void l2d_internal::Level::rebuildTileSources() {
+    this->_tileSources.Tilesets.clear();
+    this->_tileSources.TileSize = this->_tileSize;
+    this->_tileSources.TileScale = l2d_internal::Config::get().TileScale;
+    ++this->_tileSources.Version;
+    if (this->_graphics == nullptr) {
+        return;
+    }
+    for (const Tileset &tls : this->_tilesetList) {
+        TileSource source;
+        source.Texture = this->_graphics->loadImage(tls.Path);
+        source.Columns = tls.Size.x;
+        this->_tileSources.Tilesets[tls.Id] = source;
     }
-    this->_oldLayerList.push(tmpList);
+    this->_atlas.build(this->_graphics, this->_tilesetList);
+}
 
-    //Add the tileset to the map if it isn't already
-    std::shared_ptr<Tileset> tls = nullptr;
-    for (unsigned int i = 0; i < this->_tilesetList.size(); ++i) {
-        if (this->_tilesetList[i].Id == tilesetId) {
-            tls = std::make_shared<Tileset>(this->_tilesetList[i]);
-            break;
-        }
+void l2d_internal::Level::updateTile(std::string newTilesetPath, sf::Vector2i newTilesetSize, sf::Vector2i srcPos,
+                                     sf::Vector2f destPos, int tilesetId, int layer) {
+    //destPos starts at 1
+    const int x = static_cast<int>(destPos.x) - 1;
+    const int y = static_cast<int>(destPos.y) - 1;
+    if (x < 0 || y < 0 || x >= this->_size.x || y >= this->_size.y || this->_tileSize.x <= 0 || this->_tileSize.y <= 0) {
+        return;
     }
-    int newId = 0;
-    if (tls == nullptr) {
+
+    //Find the tileset, or the id it will get once it is added to the map
+    auto tls = std::find_if(this->_tilesetList.begin(), this->_tilesetList.end(), [&](const Tileset &t) {
+        return t.Id == tilesetId;
+    });
+    int columns = newTilesetSize.x / this->_tileSize.x;
+    int newId = tilesetId;
+    if (tls == this->_tilesetList.end()) {
         //Create a new tilesetId (max existing tilesetid + 1)
+        newId = 0;
         for (const l2d_internal::Tileset &t : this->_tilesetList) {
             if (t.Id >= newId) {
                 newId = t.Id + 1;
             }
         }
-        this->_tilesetList.push_back(Tileset(newId, newTilesetPath, sf::Vector2i(newTilesetSize.x / this->_tileSize.x, newTilesetSize.y / this->_tileSize.y)));
     }
-
-    std::shared_ptr<Tile> t = nullptr;
-    //Check if the layer exists. If not, create it
-    std::shared_ptr<Layer> l = layerExists();
-    if (l == nullptr) {
-        l = std::make_shared<Layer>();
-        l->Id = layer;
-        this->_layerList.push_back(l);
+    else {
+        columns = tls->Size.x;
+    }
+    if (columns <= 0) {
+        return;
     }
+    TileRecord record{static_cast<std::uint16_t>(newId),
+                      static_cast<std::uint16_t>(srcPos.y / this->_tileSize.y * columns + srcPos.x / this->_tileSize.x + 1)};
 
-    for (unsigned int i = 0; i < l.get()->Tiles.size(); ++i) {
-        auto tile = l.get()->Tiles[i];
-        int tileLayer = tile.get()->getLayer();
-        sf::Vector2f tilePos(tile.get()->getSprite().getPosition().x / this->_tileSize.x /
-                             static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_x"))) + 1,
-                             tile.get()->getSprite().getPosition().y / this->_tileSize.y /
-                             static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))) + 1);
-        if (tileLayer == layer && tilePos.x == static_cast<int>(destPos.x) &&
-            tilePos.y == static_cast<int>(destPos.y)) {
-            t = tile;
-            break;
-        }
+    //First do a check to see if the tile is identical on the same layer. If so, don't do any of this
+    std::shared_ptr<Layer> l = this->getLayer(layer);
+    const TileRecord before = l != nullptr ? l->getTile(x, y) : TileRecord();
+    if (before == record) {
+        return;
     }
-    if (t != nullptr) {
-        //Remove the existing tile from the layer
-        l.get()->Tiles.erase(
-                std::remove(l.get()->Tiles.begin(),
-                            l.get()->Tiles.end(), t),
-                l.get()->Tiles.end());
+
+    //Add the tileset to the map if it isn't already
+    if (tls == this->_tilesetList.end()) {
+        this->_tilesetList.push_back(Tileset(newId, newTilesetPath, sf::Vector2i(columns, newTilesetSize.y / this->_tileSize.y)));
+        this->rebuildTileSources();
     }
 
-    //Place the new one
-    l.get()->Tiles.push_back(std::make_shared<Tile>(this->_graphics, newTilesetPath, srcPos, this->_tileSize, newDestPos, newId == 0 ? tilesetId : newId, layer));
+    //Check if the layer exists. If not, create it
+    if (l == nullptr) {
+        l = std::make_shared<Layer>(layer, this->_size);
+        this->_layerList.push_back(l);
+    }
+    l->setTile(x, y, record);
+    this->_journal.recordTile(layer, sf::Vector2i(x, y), before, record);
 }
 
 bool l2d_internal::Level::tileExists(int layer, sf::Vector2i pos) const {
-    auto l = std::find_if(this->_layerList.begin(), this->_layerList.end(), [&](std::shared_ptr<Layer> t) {
-        return t.get()->Id == layer;
-    });
-    if (l == this->_layerList.end()) {
-        //The layer doesn't even exist
-        return false;
-    }
-    auto tile = std::find_if(l->get()->Tiles.begin(), l->get()->Tiles.end(), [&](std::shared_ptr<Tile> t) {
-        return this->globalToLocalCoordinates(t.get()->getSprite().getPosition()) == pos;
-    });
-    return !(tile == l->get()->Tiles.end());
+    std::shared_ptr<Layer> l = this->getLayer(layer);
+    //pos starts at 1
+    return l != nullptr && !l->getTile(pos.x - 1, pos.y - 1).isEmpty();
 }
 
 void l2d_internal::Level::removeTile(int layer, sf::Vector2f pos, bool fromResize) {
-    if (!this->tileExists(layer, this->globalToLocalCoordinates(pos))) {
+    const sf::Vector2i localPos = this->globalToLocalCoordinates(pos);
+    if (!this->tileExists(layer, localPos)) {
         return;
     }
+    std::shared_ptr<Layer> l = this->getLayer(layer);
+    const sf::Vector2i cell(localPos.x - 1, localPos.y - 1);
+    const TileRecord before = l->getTile(cell.x, cell.y);
+    l->setTile(cell.x, cell.y, TileRecord());
     if (!fromResize) {
-        //Set oldLayerList for Undo
-        std::vector<std::shared_ptr<l2d_internal::Layer>> tmpList;
-        for (unsigned int i = 0; i < this->_layerList.size(); ++i) {
-            l2d_internal::Layer l;
-            l.Id = this->_layerList.at(i).get()->Id;
-            for (unsigned int j = 0; j < this->_layerList[i].get()->Tiles.size(); ++j) {
-                l.Tiles.emplace_back(this->_layerList[i].get()->Tiles.at(j));
-            }
-            tmpList.push_back(std::make_shared<l2d_internal::Layer>(l));
-        }
-        this->_oldLayerList.push(tmpList);
-    }
-
-    std::shared_ptr<Tile> t = nullptr;
-    //Check if the layer exists. If not, create it
-    std::shared_ptr<Layer> l = nullptr;
-    for (unsigned int i = 0; i < this->_layerList.size(); ++i) {
-        if (this->_layerList[i]->Id == layer) {
-            l = this->_layerList[i];
-            break;
-        }
-    }
-
-    for (unsigned int i = 0; i < l.get()->Tiles.size(); ++i) {
-        auto tile = l.get()->Tiles[i];
-        int tileLayer = tile.get()->getLayer();
-        sf::Vector2f tilePos(tile.get()->getSprite().getPosition().x / this->_tileSize.x /
-                             static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_x"))) + 1,
-                             tile.get()->getSprite().getPosition().y / this->_tileSize.y /
-                             static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))) + 1);
-        if (tileLayer == layer && tilePos.x == static_cast<int>(pos.x / this->_tileSize.x /
-                                                                static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_x"))) + 1) &&
-            tilePos.y == static_cast<int>(pos.y / this->_tileSize.y /
-                                          static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))) + 1)) {
-            t = tile;
-            break;
-        }
-    }
-    if (t != nullptr) {
-        //Remove the existing tile from the layer
-        l.get()->Tiles.erase(
-                std::remove(l.get()->Tiles.begin(),
-                            l.get()->Tiles.end(), t),
-                l.get()->Tiles.end());
+        this->_journal.recordTile(layer, cell, before, TileRecord());
     }
 }
 
@@ -1362,88 +4795,208 @@ int l2d_internal::Level::getTilesetID(const std::string &path) const {
     return -1;
 }
 
+// void undo
+// Reverts the newest entry of the journal, newest change first
 void l2d_internal::Level::undo() {
-    if (!this->isUndoListEmpty()) {
-        std::vector<std::shared_ptr<l2d_internal::Layer>> tmpList;
-        for (unsigned int i = 0; i < this->_oldLayerList.top().size(); ++i) {
-            l2d_internal::Layer l;
-            l.Id = this->_oldLayerList.top().at(i).get()->Id;
-            for (unsigned int j = 0; j < this->_oldLayerList.top()[i].get()->Tiles.size(); ++j) {
-                l.Tiles.emplace_back(this->_oldLayerList.top()[i].get()->Tiles.at(j));
-            }
-            tmpList.push_back(std::make_shared<l2d_internal::Layer>(l));
-        }
-
-        //Set up redo list
-        std::vector<std::shared_ptr<l2d_internal::Layer>> tmpRedoList;
-        for (unsigned int i = 0; i < this->_layerList.size(); ++i) {
-            l2d_internal::Layer l;
-            l.Id = this->_layerList.at(i).get()->Id;
-            for (unsigned int j = 0; j < this->_layerList[i].get()->Tiles.size(); ++j) {
-                l.Tiles.emplace_back(this->_layerList[i].get()->Tiles.at(j));
-            }
-            tmpRedoList.push_back(std::make_shared<l2d_internal::Layer>(l));
+    const UndoJournal::Entry* entry = this->_journal.undo();
+    if (entry == nullptr) {
+        return;
+    }
+    for (auto it = entry->Tiles.rbegin(); it != entry->Tiles.rend(); ++it) {
+        l2d_internal::Layer* l = this->getEditedLayer(it->Layer, false);
+        if (l != nullptr) {
+            l->setTile(it->Cell.x, it->Cell.y, it->Before);
         }
-        this->_redoList.push(tmpRedoList);
-
-        this->_layerList = tmpList;
-        this->_oldLayerList.pop();
+    }
+    //The journal keeps its shapes unchanged, so the level gets copies it can edit
+    for (auto it = entry->Shapes.rbegin(); it != entry->Shapes.rend(); ++it) {
+        this->replaceShape(it->After, this->copyShape(it->Before));
+    }
+    if (entry->AmbientChanged) {
+        this->applyAmbient(entry->AmbientColorBefore, entry->AmbientIntensityBefore);
     }
 }
 
 bool l2d_internal::Level::isUndoListEmpty() const {
-    return this->_oldLayerList.empty();
+    return !this->_journal.canUndo();
 }
 
+// void redo
+// Applies the newest undone entry of the journal again, oldest change first
 void l2d_internal::Level::redo() {
-    if (!this->isRedoListEmpty()) {
-        std::vector<std::shared_ptr<l2d_internal::Layer>> tmpList;
-        for (unsigned int i = 0; i < this->_redoList.top().size(); ++i) {
-            l2d_internal::Layer l;
-            l.Id = this->_redoList.top().at(i).get()->Id;
-            for (unsigned int j = 0; j < this->_redoList.top()[i].get()->Tiles.size(); ++j) {
-                l.Tiles.emplace_back(this->_redoList.top()[i].get()->Tiles.at(j));
-            }
-            tmpList.push_back(std::make_shared<l2d_internal::Layer>(l));
+    const UndoJournal::Entry* entry = this->_journal.redo();
+    if (entry == nullptr) {
+        return;
+    }
+    for (const UndoJournal::TileChange &change : entry->Tiles) {
+        this->getEditedLayer(change.Layer, true)->setTile(change.Cell.x, change.Cell.y, change.After);
+    }
+    for (const UndoJournal::ShapeChange &change : entry->Shapes) {
+        this->replaceShape(change.Before, this->copyShape(change.After));
+    }
+    if (entry->AmbientChanged) {
+        this->applyAmbient(entry->AmbientColorAfter, entry->AmbientIntensityAfter);
+    }
+}
+
+bool l2d_internal::Level::isRedoListEmpty() const {
+    return !this->_journal.canRedo();
+}
+
+// void beginEdit
+// Everything edited until endEdit is undone and redone as one step, e.g. all tiles painted in one mouse drag
+void l2d_internal::Level::beginEdit() {
+    this->recordShapeEdits();
+    this->_journal.beginStroke();
+}
+
+void l2d_internal::Level::endEdit() {
+    this->recordShapeEdits();
+    this->_journal.endStroke();
+}
+
+// void beginShapeEdit
+// Call before changing a shape in place, e.g. while dragging it. A copy of the shape as it is now is kept,
+// and endEdit records it in the journal together with how the shape ended up.
+// For a point of a line, the whole line is kept.
+void l2d_internal::Level::beginShapeEdit(std::shared_ptr<l2d_internal::Shape> shape) {
+    std::shared_ptr<l2d_internal::Shape> owner = this->getOwningShape(shape);
+    if (owner == nullptr) {
+        return;
+    }
+    for (auto &s : this->_shapeEdits) {
+        if (s->getId() == owner->getId()) {
+            return;
         }
+    }
+    this->_shapeEdits.push_back(this->copyShape(owner));
+}
 
-        //Set up undo list
-        std::vector<std::shared_ptr<l2d_internal::Layer>> tmpUndoList;
-        for (unsigned int i = 0; i < this->_layerList.size(); ++i) {
-            l2d_internal::Layer l;
-            l.Id = this->_layerList.at(i).get()->Id;
-            for (unsigned int j = 0; j < this->_layerList[i].get()->Tiles.size(); ++j) {
-                l.Tiles.emplace_back(this->_layerList[i].get()->Tiles.at(j));
-            }
-            tmpUndoList.push_back(std::make_shared<l2d_internal::Layer>(l));
+// void recordShapeEdits
+// Records every shape passed to beginShapeEdit that was actually changed since
+void l2d_internal::Level::recordShapeEdits() {
+    for (auto &before : this->_shapeEdits) {
+        std::shared_ptr<l2d_internal::Shape> after = this->getShape(before->getId());
+        if (after != nullptr && !after->equals(before)) {
+            this->_journal.recordShape(before, this->copyShape(after));
         }
-        this->_oldLayerList.push(tmpUndoList);
+    }
+    this->_shapeEdits.clear();
+}
 
-        this->_layerList = tmpList;
-        this->_redoList.pop();
+// void updateShape
+// Puts newShape in the place of the shape that has oldShape's id. oldShape is what gets restored on undo.
+void l2d_internal::Level::updateShape(std::shared_ptr<l2d_internal::Shape> oldShape, std::shared_ptr<l2d_internal::Shape> newShape) {
+    auto it = this->_shapeHandles.find(oldShape->getId());
+    if (it == this->_shapeHandles.end()) {
+        return;
+    }
+    std::shared_ptr<l2d_internal::Shape> &current = this->_shapeList[it->second];
+    newShape->setId(oldShape->getId());
+    if (current != newShape) {
+        this->_shapeIndex.replace(current, newShape);
+        current = newShape;
+    }
+    else {
+        this->_shapeIndex.update(newShape);
     }
+    this->_journal.recordShape(this->copyShape(oldShape), this->copyShape(newShape));
 }
 
-bool l2d_internal::Level::isRedoListEmpty() const {
-    return this->_redoList.empty();
+void l2d_internal::Level::updateShape(int id, std::shared_ptr<l2d_internal::Shape> newShape) {
+    std::shared_ptr<l2d_internal::Shape> oldShape = this->getShape(id);
+    if (oldShape != nullptr) {
+        this->updateShape(oldShape, newShape);
+    }
 }
 
-void l2d_internal::Level::updateShape(std::shared_ptr<l2d_internal::Shape> oldShape, std::shared_ptr<l2d_internal::Shape> newShape) {
-    for (unsigned int i = 0; i < this->_shapeList.size(); ++i) {
-        if (oldShape->equals(this->_shapeList[i])) {
-            this->_shapeList[i] = newShape;
-            return;
+void l2d_internal::Level::removeShape(std::shared_ptr<l2d_internal::Shape> shape) {
+    if (shape == nullptr || this->getShape(shape->getId()) != shape) {
+        return;
+    }
+    this->eraseShape(shape->getId());
+    this->_journal.recordShape(this->copyShape(shape), nullptr);
+}
+
+void l2d_internal::Level::removeShape(int id) {
+    this->removeShape(this->getShape(id));
+}
+
+// void replaceShape
+// Swaps one shape in the list for another without recording it. A nullptr from adds the shape and a nullptr to removes it.
+// Both shapes share an id, since the journal only ever holds versions of the same shape.
+void l2d_internal::Level::replaceShape(std::shared_ptr<l2d_internal::Shape> from, std::shared_ptr<l2d_internal::Shape> to) {
+    std::shared_ptr<l2d_internal::Shape> current = from == nullptr ? nullptr : this->getShape(from->getId());
+    if (current == nullptr) {
+        if (to != nullptr) {
+            this->insertShape(to);
         }
     }
+    else if (to == nullptr) {
+        this->eraseShape(current->getId());
+    }
+    else {
+        this->_shapeList[this->_shapeHandles[current->getId()]] = to;
+        this->_shapeIndex.replace(current, to);
+    }
 }
 
-void l2d_internal::Level::removeShape(std::shared_ptr<l2d_internal::Shape> shape) {
-    this->_shapeList.erase(std::remove(this->_shapeList.begin(), this->_shapeList.end(), shape), this->_shapeList.end());
+// void insertShape
+// Appends a shape that already has its id and registers it in the handle table and the shape index
+void l2d_internal::Level::insertShape(std::shared_ptr<l2d_internal::Shape> shape) {
+    this->_shapeHandles[shape->getId()] = this->_shapeList.size();
+    this->_nextShapeId = std::max(this->_nextShapeId, shape->getId() + 1);
+    this->_shapeList.push_back(shape);
+    this->_shapeIndex.insert(shape);
+}
+
+// void eraseShape
+// Removes a shape by moving the last shape into its slot, so the list never has to be shifted.
+// Drawing order comes from the shape index, so it isn't affected.
+void l2d_internal::Level::eraseShape(int id) {
+    auto it = this->_shapeHandles.find(id);
+    if (it == this->_shapeHandles.end()) {
+        return;
+    }
+    std::size_t slot = it->second;
+    this->_shapeIndex.remove(this->_shapeList[slot]);
+    this->_shapeHandles.erase(it);
+    if (slot != this->_shapeList.size() - 1) {
+        this->_shapeList[slot] = this->_shapeList.back();
+        this->_shapeHandles[this->_shapeList[slot]->getId()] = slot;
+    }
+    this->_shapeList.pop_back();
+}
+
+// void assignShapeIds
+// Rebuilds the handle table after loading. Shapes saved without an id, or with a duplicate one, get a new id.
+void l2d_internal::Level::assignShapeIds() {
+    this->_shapeHandles.clear();
+    this->_nextShapeId = 1;
+    for (auto &shape : this->_shapeList) {
+        this->_nextShapeId = std::max(this->_nextShapeId, shape->getId() + 1);
+    }
+    for (std::size_t i = 0; i < this->_shapeList.size(); ++i) {
+        std::shared_ptr<l2d_internal::Shape> &shape = this->_shapeList[i];
+        if (shape->getId() <= 0 || this->_shapeHandles.count(shape->getId()) > 0) {
+            shape->setId(this->_nextShapeId++);
+        }
+        this->_shapeHandles[shape->getId()] = i;
+    }
+}
+
+// void clearShapes
+// Removes every shape from the level without recording it
+void l2d_internal::Level::clearShapes() {
+    this->_shapeList.clear();
+    this->_shapeHandles.clear();
+    this->_shapeIndex.clear();
+    this->_nextShapeId = 1;
 }
 
 sf::Vector2i l2d_internal::Level::globalToLocalCoordinates(sf::Vector2f coords) const {
-    return sf::Vector2i(static_cast<int>(coords.x) / this->_tileSize.x / static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_x"))) + 1,
-                        static_cast<int>(coords.y) / this->_tileSize.y / static_cast<int>(std::stof(l2d_internal::utils::getConfigValue("tile_scale_y"))) + 1);
+    return sf::Vector2i(static_cast<int>(coords.x) / this->_tileSize.x / static_cast<int>(l2d_internal::Config::get().TileScale.x) + 1,
+                        static_cast<int>(coords.y) / this->_tileSize.y / static_cast<int>(l2d_internal::Config::get().TileScale.y) + 1);
 }
 
 bool l2d_internal::Level::isLoaded() const {
@@ -1455,9 +5008,19 @@ l2d_internal::Background &l2d_internal::Level::getBackground() {
 }
 
 void l2d_internal::Level::draw(sf::Shader* ambientLight) {
+    this->_graphics->getRenderStats().reset();
+    if (this->_tileSources.TileScale != l2d_internal::Config::get().TileScale) {
+        //The tile scale was changed in the config, so every layer has to be laid out again and the backgrounds
+        //have to be culled against the new level bounds
+        this->rebuildTileSources();
+        this->_background.setLevelSize(this->_size, this->_tileSize);
+    }
     this->_background.draw(ambientLight, *this->_graphics);
+    if (this->_chunkCacheEnabled) {
+        this->_chunkCache.beginFrame();
+    }
     for (auto &layer : this->_layerList) {
-        layer->draw(ambientLight);
+        layer->draw(ambientLight, *this->_graphics, this->_tileSources, this->_atlas, this->_chunkCacheEnabled ? &this->_chunkCache : nullptr);
     }
 }
 
@@ -1466,6 +5029,200 @@ void l2d_internal::Level::update(float elapsedTime) {
 }
 
 
+/*
+ * MapRasterizer
+ */
+
+l2d_internal::MapRasterizer::MapRasterizer() {}
+
+// const sf::Image* loadImage
+// Loads an image into memory once and returns it. Returns nullptr if the file can't be read.
+const sf::Image* l2d_internal::MapRasterizer::loadImage(const std::string &filePath) {
+    auto it = this->_images.find(filePath);
+    if (it == this->_images.end()) {
+        sf::Image image;
+        if (!image.loadFromFile(filePath)) {
+            return nullptr;
+        }
+        it = this->_images.insert(std::make_pair(filePath, image)).first;
+    }
+    return &it->second;
+}
+
+// void blendRow
+// Tints count RGBA pixels from src like content/shaders/ambient.frag does and alpha-blends them over dest.
+// Kept branch-free on plain integers so the compiler can vectorize it.
+void l2d_internal::MapRasterizer::blendRow(sf::Uint8* dest, const sf::Uint8* src, unsigned int count, const unsigned int tint[3]) {
+    for (unsigned int i = 0; i < count * 4; i += 4) {
+        const unsigned int a = src[i + 3];
+        const unsigned int ia = 255 - a;
+        const unsigned int r = std::min(255u, (src[i] * tint[0]) >> 8);
+        const unsigned int g = std::min(255u, (src[i + 1] * tint[1]) >> 8);
+        const unsigned int b = std::min(255u, (src[i + 2] * tint[2]) >> 8);
+        dest[i] = static_cast<sf::Uint8>((r * a + dest[i] * ia + 127) / 255);
+        dest[i + 1] = static_cast<sf::Uint8>((g * a + dest[i + 1] * ia + 127) / 255);
+        dest[i + 2] = static_cast<sf::Uint8>((b * a + dest[i + 2] * ia + 127) / 255);
+        dest[i + 3] = static_cast<sf::Uint8>(a + (dest[i + 3] * ia + 127) / 255);
+    }
+}
+
+// std::string rasterize
+// Renders the map into image. scale is output pixels per tileset pixel (1 = the tilesets' own resolution).
+// Returns an empty string on success, otherwise the error.
+std::string l2d_internal::MapRasterizer::rasterize(const std::string &mapName, sf::Image &image, float scale) {
+    if (!(scale > 0.0f)) {
+        return "The scale must be greater than 0.";
+    }
+    l2d_internal::MapData map;
+    const std::string error = map.load(l2d_internal::MapData::getMapFilePath(mapName));
+    if (!error.empty()) {
+        return error;
+    }
+    const sf::Vector2i size = map.Size;
+    const sf::Vector2i tileSize = map.TileSize;
+    const sf::Vector2f tileScale(l2d_internal::Config::get().TileScale.x,
+                                 l2d_internal::Config::get().TileScale.y);
+    //Worked out in double so big maps and scales can't overflow before they are checked
+    const double imageWidth = static_cast<double>(size.x) * tileSize.x * scale;
+    const double imageHeight = static_cast<double>(size.y) * tileSize.y * scale;
+    if (imageWidth < 1.0 || imageHeight < 1.0) {
+        return "The map " + mapName + " is empty.";
+    }
+    if (imageWidth > MAX_IMAGE_SIZE || imageHeight > MAX_IMAGE_SIZE || imageWidth * imageHeight > MAX_IMAGE_PIXELS) {
+        return "The map " + mapName + " is too large to export at this scale. Try a smaller scale.";
+    }
+    const unsigned int width = static_cast<unsigned int>(imageWidth);
+    const unsigned int height = static_cast<unsigned int>(imageHeight);
+
+    //Ambient light as 8.8 fixed point multipliers
+    sf::Color ambientColor = sf::Color::White;
+    float ambientIntensity = 1.0f;
+    if (map.HasAmbientLight) {
+        ambientColor = sf::Color(map.AmbientColor);
+        ambientIntensity = map.AmbientIntensity;
+    }
+    const unsigned int tint[3] = {
+            static_cast<unsigned int>(std::max(0.0f, ambientColor.r / 255.0f * ambientIntensity * 256.0f)),
+            static_cast<unsigned int>(std::max(0.0f, ambientColor.g / 255.0f * ambientIntensity * 256.0f)),
+            static_cast<unsigned int>(std::max(0.0f, ambientColor.b / 255.0f * ambientIntensity * 256.0f))
+    };
+
+    std::vector<sf::Uint8> pixels(static_cast<std::size_t>(width) * height * 4, 0);
+    std::vector<sf::Uint8> row(static_cast<std::size_t>(width) * 4);
+
+    //Backgrounds repeat across the whole level. Parallax is ignored since there is no camera.
+    for (const l2d_internal::MapData::BackgroundEntry &background : map.Backgrounds) {
+        const float backgroundScale = background.Scale;
+        const sf::Image* backgroundImage = background.Path.empty() ? nullptr : this->loadImage(background.Path);
+        if (backgroundImage == nullptr || backgroundScale <= 0 || backgroundImage->getSize().x == 0 || backgroundImage->getSize().y == 0) {
+            continue;
+        }
+        const sf::Vector2u imageSize = backgroundImage->getSize();
+        const sf::Uint8* src = backgroundImage->getPixelsPtr();
+        //Output pixel -> world unit -> background pixel
+        const sf::Vector2f step(tileScale.x / (scale * backgroundScale), tileScale.y / (scale * backgroundScale));
+        std::vector<unsigned int> columns(width);
+        for (unsigned int x = 0; x < width; ++x) {
+            columns[x] = static_cast<unsigned int>(x * step.x) % imageSize.x;
+        }
+        for (unsigned int y = 0; y < height; ++y) {
+            const sf::Uint8* srcRow = src + (static_cast<unsigned int>(y * step.y) % imageSize.y) * imageSize.x * 4;
+            for (unsigned int x = 0; x < width; ++x) {
+                std::memcpy(&row[x * 4], srcRow + columns[x] * 4, 4);
+            }
+            blendRow(&pixels[static_cast<std::size_t>(y) * width * 4], row.data(), width, tint);
+        }
+    }
+
+    //Tilesets
+    struct TilesetInfo {
+        const sf::Image* Image;
+        int Columns;
+    };
+    std::map<int, TilesetInfo> tilesets;
+    for (const l2d_internal::Tileset &tileset : map.Tilesets) {
+        tilesets[tileset.Id] = TilesetInfo { tileset.Path.empty() ? nullptr : this->loadImage(tileset.Path), tileset.Size.x };
+    }
+
+    //Lower layers are composited first
+    std::vector<const l2d_internal::MapData::LayerEntry*> layers;
+    for (const l2d_internal::MapData::LayerEntry &layer : map.Layers) {
+        layers.push_back(&layer);
+    }
+    std::sort(layers.begin(), layers.end(), [](const l2d_internal::MapData::LayerEntry* a, const l2d_internal::MapData::LayerEntry* b) {
+        return a->Id < b->Id;
+    });
+    struct TileInfo {
+        int X, Y, Tileset, Tile;
+    };
+    const unsigned int chunkCells = l2d_internal::Layer::CHUNK_SIZE * l2d_internal::Layer::CHUNK_SIZE;
+    for (const l2d_internal::MapData::LayerEntry* layer : layers) {
+        for (const auto &chunk : layer->Chunks) {
+            const std::vector<l2d_internal::TileRecord> &palette = chunk.second->getPalette();
+            for (unsigned int cell = 0; cell < chunkCells; ++cell) {
+                const unsigned int index = chunk.second->getIndex(cell);
+                if (index == 0) {
+                    continue;
+                }
+                const TileInfo t { chunk.first.second * l2d_internal::Layer::CHUNK_SIZE + static_cast<int>(cell % l2d_internal::Layer::CHUNK_SIZE),
+                                   chunk.first.first * l2d_internal::Layer::CHUNK_SIZE + static_cast<int>(cell / l2d_internal::Layer::CHUNK_SIZE),
+                                   palette[index].Tileset, palette[index].Tile };
+                auto tls = tilesets.find(t.Tileset);
+                if (tls == tilesets.end() || tls->second.Image == nullptr || tls->second.Columns <= 0 ||
+                    t.X < 0 || t.Y < 0 || t.X >= size.x || t.Y >= size.y) {
+                    continue;
+                }
+                const sf::Image &tilesetImage = *tls->second.Image;
+                const sf::Vector2u imageSize = tilesetImage.getSize();
+                const unsigned int srcX = static_cast<unsigned int>(((t.Tile - 1) % tls->second.Columns) * tileSize.x);
+                const unsigned int srcY = static_cast<unsigned int>(((t.Tile - 1) / tls->second.Columns) * tileSize.y);
+                if (srcX + tileSize.x > imageSize.x || srcY + tileSize.y > imageSize.y) {
+                    continue;
+                }
+                //Destination rect of the tile in the output image
+                const unsigned int left = static_cast<unsigned int>(t.X * tileSize.x * scale);
+                const unsigned int right = std::min(width, static_cast<unsigned int>((t.X + 1) * tileSize.x * scale));
+                const unsigned int top = static_cast<unsigned int>(t.Y * tileSize.y * scale);
+                const unsigned int bottom = std::min(height, static_cast<unsigned int>((t.Y + 1) * tileSize.y * scale));
+                if (left >= right || top >= bottom) {
+                    continue;
+                }
+                const sf::Uint8* src = tilesetImage.getPixelsPtr();
+                for (unsigned int y = top; y < bottom; ++y) {
+                    const unsigned int sy = srcY + std::min(static_cast<unsigned int>(tileSize.y - 1), static_cast<unsigned int>((y - top) / scale));
+                    const sf::Uint8* srcRow = src + (sy * imageSize.x + srcX) * 4;
+                    const sf::Uint8* rowData = srcRow;
+                    if (scale != 1.0f) {
+                        for (unsigned int x = left; x < right; ++x) {
+                            const unsigned int sx = std::min(static_cast<unsigned int>(tileSize.x - 1), static_cast<unsigned int>((x - left) / scale));
+                            std::memcpy(&row[(x - left) * 4], srcRow + sx * 4, 4);
+                        }
+                        rowData = row.data();
+                    }
+                    blendRow(&pixels[(static_cast<std::size_t>(y) * width + left) * 4], rowData, right - left, tint);
+                }
+            }
+        }
+    }
+
+    image.create(width, height, pixels.data());
+    return "";
+}
+
+// std::string exportMap
+// Rasterizes the map and saves it as an image (the format comes from the file extension)
+std::string l2d_internal::MapRasterizer::exportMap(const std::string &mapName, const std::string &outputPath, float scale) {
+    sf::Image image;
+    std::string error = this->rasterize(mapName, image, scale);
+    if (!error.empty()) {
+        return error;
+    }
+    if (!image.saveToFile(outputPath)) {
+        return "Could not write " + outputPath;
+    }
+    return "";
+}
+
 /*
  * Shape
  */
@@ -1480,6 +5237,16 @@ std::string l2d_internal::Shape::getName() {
     return this->_name;
 }
 
+// int getId
+// The stable id of the shape within its level. 0 means the shape hasn't been added to a level yet.
+int l2d_internal::Shape::getId() const {
+    return this->_id;
+}
+
+void l2d_internal::Shape::setId(int id) {
+    this->_id = id;
+}
+
 sf::Color l2d_internal::Shape::getColor() const {
     return this->_color;
 }
@@ -1492,7 +5259,7 @@ void l2d_internal::Shape::setColor(sf::Color color) {
     this->_color = color;
 }
 
-std::vector<l2d_internal::CustomProperty> l2d_internal::Shape::getCustomProperties() {
+const std::vector<l2d_internal::CustomProperty> &l2d_internal::Shape::getCustomProperties() const {
     return this->_customProperties;
 }
 
@@ -1526,6 +5293,10 @@ void l2d_internal::Shape::setCustomProperties(std::vector<l2d_internal::CustomPr
     this->_customProperties = others;
 }
 
+bool l2d_internal::Shape::isSelected() const {
+    return this->_selected;
+}
+
 /*
  * Point
  */
@@ -1536,7 +5307,7 @@ l2d_internal::Point::Point(std::string name, sf::Color color, sf::CircleShape do
     this->_dot = dot;
 }
 
-sf::CircleShape l2d_internal::Point::getCircle() {
+const sf::CircleShape &l2d_internal::Point::getCircle() const {
     return this->_dot;
 }
 
@@ -1558,27 +5329,11 @@ void l2d_internal::Point::fixPosition(sf::Vector2i levelSize, sf::Vector2i tileS
 }
 
 void l2d_internal::Point::select() {
-    if (!this->_selected) {
-        this->_selected = true;
-        this->_dot.setOutlineThickness(this->_dot.getOutlineThickness() + 1);
-        this->_dot.setFillColor(sf::Color(static_cast<sf::Uint8>(std::min(255, this->_dot.getFillColor().r + 16)),
-                                           static_cast<sf::Uint8>(std::min(255, this->_dot.getFillColor().g + 16)),
-                                           static_cast<sf::Uint8>(std::min(255, this->_dot.getFillColor().b + 16)),
-                                           static_cast<sf::Uint8>(std::min(255, this->_dot.getFillColor().a + 16))
-        ));
-    }
+    this->_selected = true;
 }
 
 void l2d_internal::Point::unselect() {
-    if (this->_selected) {
-        this->_selected = false;
-        this->_dot.setOutlineThickness(this->_dot.getOutlineThickness() - 1);
-        this->_dot.setFillColor(sf::Color(static_cast<sf::Uint8>(std::max(0, this->_dot.getFillColor().r - 16)),
-                                           static_cast<sf::Uint8>(std::max(0, this->_dot.getFillColor().g - 16)),
-                                           static_cast<sf::Uint8>(std::max(0, this->_dot.getFillColor().b - 16)),
-                                           static_cast<sf::Uint8>(std::max(0, this->_dot.getFillColor().a - 16))
-        ));
-    }
+    this->_selected = false;
 }
 
 void l2d_internal::Point::setPosition(sf::Vector2f pos) {
@@ -1601,6 +5356,19 @@ void l2d_internal::Point::draw(sf::RenderWindow *window) {
     window->draw(this->_dot);
 }
 
+void l2d_internal::Point::addToBatch(l2d_internal::ShapeRenderer &renderer) {
+    const float radius = this->_dot.getRadius();
+    renderer.addCircle(this->_dot.getPosition() + sf::Vector2f(radius, radius), radius,
+                       static_cast<unsigned int>(this->_dot.getPointCount()),
+                       this->_selected ? ShapeRenderer::getSelectedColor(this->_dot.getFillColor()) : this->_dot.getFillColor(),
+                       this->_selected ? ShapeRenderer::getSelectedColor(this->_dot.getOutlineColor()) : this->_dot.getOutlineColor(),
+                       this->_dot.getOutlineThickness());
+}
+
+sf::FloatRect l2d_internal::Point::getBounds() {
+    return this->_dot.getGlobalBounds();
+}
+
 bool l2d_internal::Point::equals(std::shared_ptr<Shape> other) {
     std::shared_ptr<l2d_internal::Point> p = std::dynamic_pointer_cast<l2d_internal::Point>(other);
     if (p == nullptr) return false;
@@ -1620,7 +5388,7 @@ l2d_internal::Line::Line(std::string name, sf::Color color, std::vector<std::sha
     this->_points = points;
 }
 
-std::vector<std::shared_ptr<l2d_internal::Point>> l2d_internal::Line::getPoints() {
+const std::vector<std::shared_ptr<l2d_internal::Point>> &l2d_internal::Line::getPoints() const {
     return this->_points;
 }
 
@@ -1683,6 +5451,13 @@ void l2d_internal::Line::setSize(sf::Vector2f size) {
     throw utils::NotImplementedException("setSize");
 }
 
+// sf::Vector2f getCenter
+// Returns the center of a line point's circle
+static sf::Vector2f getCenter(l2d_internal::Point &p) {
+    sf::CircleShape c = p.getCircle();
+    return sf::Vector2f(c.getPosition().x + c.getRadius(), c.getPosition().y + c.getRadius());
+}
+
 void l2d_internal::Line::draw(sf::RenderWindow* window) {
     for (auto &p : this->_points) {
         p->draw(window);
@@ -1690,10 +5465,8 @@ void l2d_internal::Line::draw(sf::RenderWindow* window) {
     if (this->_points.size() >= 2) {
         for (unsigned int i = 0; i < this->_points.size() - 1; ++i) {
             sf::Vertex v[4];
-            sf::Vector2f point1 = sf::Vector2f(this->_points[i]->getCircle().getPosition().x + this->_points[i]->getCircle().getRadius(),
-                                               this->_points[i]->getCircle().getPosition().y + this->_points[i]->getCircle().getRadius());
-            sf::Vector2f point2 = sf::Vector2f(this->_points[i + 1]->getCircle().getPosition().x + this->_points[i + 1]->getCircle().getRadius(),
-                                               this->_points[i + 1]->getCircle().getPosition().y + this->_points[i + 1]->getCircle().getRadius());
+            sf::Vector2f point1 = getCenter(*this->_points[i]);
+            sf::Vector2f point2 = getCenter(*this->_points[i + 1]);
 
             sf::Vector2f direction = point2 - point1;
 
@@ -1714,6 +5487,32 @@ void l2d_internal::Line::draw(sf::RenderWindow* window) {
     }
 }
 
+void l2d_internal::Line::addToBatch(l2d_internal::ShapeRenderer &renderer) {
+    for (auto &p : this->_points) {
+        p->addToBatch(renderer);
+    }
+    for (unsigned int i = 0; i + 1 < this->_points.size(); ++i) {
+        renderer.addSegment(getCenter(*this->_points[i]), getCenter(*this->_points[i + 1]), 3.0f, this->_color);
+    }
+}
+
+sf::FloatRect l2d_internal::Line::getBounds() {
+    if (this->_points.empty()) {
+        return sf::FloatRect();
+    }
+    sf::FloatRect bounds = this->_points.front()->getBounds();
+    for (auto &p : this->_points) {
+        sf::FloatRect b = p->getBounds();
+        float right = std::max(bounds.left + bounds.width, b.left + b.width);
+        float bottom = std::max(bounds.top + bounds.height, b.top + b.height);
+        bounds.left = std::min(bounds.left, b.left);
+        bounds.top = std::min(bounds.top, b.top);
+        bounds.width = right - bounds.left;
+        bounds.height = bottom - bounds.top;
+    }
+    return bounds;
+}
+
 bool l2d_internal::Line::equals(std::shared_ptr<Shape> other) {
     std::shared_ptr<l2d_internal::Line> l = std::dynamic_pointer_cast<l2d_internal::Line>(other);
     if (l == nullptr) return false;
@@ -1744,7 +5543,7 @@ l2d_internal::Rectangle::Rectangle(std::string name, sf::Color color, l2d_intern
     this->_objectType = objectType;
 }
 
-sf::RectangleShape l2d_internal::Rectangle::getRectangle() {
+const sf::RectangleShape &l2d_internal::Rectangle::getRectangle() const {
     return this->_rect;
 }
 
@@ -1780,27 +5579,11 @@ bool l2d_internal::Rectangle::isPointInside(sf::Vector2f point) {
 }
 
 void l2d_internal::Rectangle::select() {
-    if (!this->_selected) {
-        this->_selected = true;
-        this->_rect.setOutlineThickness(this->_rect.getOutlineThickness() + 1);
-        this->_rect.setFillColor(sf::Color(static_cast<sf::Uint8>(std::min(255, this->_rect.getFillColor().r + 16)),
-                                           static_cast<sf::Uint8>(std::min(255, this->_rect.getFillColor().g + 16)),
-                                           static_cast<sf::Uint8>(std::min(255, this->_rect.getFillColor().b + 16)),
-                                           static_cast<sf::Uint8>(std::min(255, this->_rect.getFillColor().a + 16))
-        ));
-    }
+    this->_selected = true;
 }
 
 void l2d_internal::Rectangle::unselect() {
-    if (this->_selected) {
-        this->_selected = false;
-        this->_rect.setOutlineThickness(this->_rect.getOutlineThickness() - 1);
-        this->_rect.setFillColor(sf::Color(static_cast<sf::Uint8>(std::max(0, this->_rect.getFillColor().r - 16)),
-                                           static_cast<sf::Uint8>(std::max(0, this->_rect.getFillColor().g - 16)),
-                                           static_cast<sf::Uint8>(std::max(0, this->_rect.getFillColor().b - 16)),
-                                           static_cast<sf::Uint8>(std::max(0, this->_rect.getFillColor().a - 16))
-        ));
-    }
+    this->_selected = false;
 }
 
 void l2d_internal::Rectangle::setPosition(sf::Vector2f pos) {
@@ -1815,6 +5598,17 @@ void l2d_internal::Rectangle::draw(sf::RenderWindow *window) {
     window->draw(this->_rect);
 }
 
+void l2d_internal::Rectangle::addToBatch(l2d_internal::ShapeRenderer &renderer) {
+    renderer.addRectangle(sf::FloatRect(this->_rect.getPosition(), this->_rect.getSize()),
+                          this->_selected ? ShapeRenderer::getSelectedColor(this->_rect.getFillColor()) : this->_rect.getFillColor(),
+                          this->_selected ? ShapeRenderer::getSelectedColor(this->_rect.getOutlineColor()) : this->_rect.getOutlineColor(),
+                          this->_rect.getOutlineThickness());
+}
+
+sf::FloatRect l2d_internal::Rectangle::getBounds() {
+    return this->_rect.getGlobalBounds();
+}
+
 bool l2d_internal::Rectangle::equals(std::shared_ptr<Shape> other) {
     std::shared_ptr<l2d_internal::Rectangle> r = std::dynamic_pointer_cast<l2d_internal::Rectangle>(other);
     if (r == nullptr) return false;
@@ -1826,6 +5620,88 @@ bool l2d_internal::Rectangle::equals(std::shared_ptr<Shape> other) {
 }
 
 
+/*
+ * ShapeRenderer
+ */
+
+l2d_internal::ShapeRenderer::ShapeRenderer() :
+        _vertices(sf::Triangles)
+{}
+
+void l2d_internal::ShapeRenderer::clear() {
+    this->_vertices.clear();
+}
+
+// sf::Color getSelectedColor
+// Selected shapes are drawn slightly brighter and more opaque
+sf::Color l2d_internal::ShapeRenderer::getSelectedColor(sf::Color color) {
+    return sf::Color(static_cast<sf::Uint8>(std::min(255, color.r + 16)),
+                     static_cast<sf::Uint8>(std::min(255, color.g + 16)),
+                     static_cast<sf::Uint8>(std::min(255, color.b + 16)),
+                     static_cast<sf::Uint8>(std::min(255, color.a + 64)));
+}
+
+void l2d_internal::ShapeRenderer::addQuad(sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Vector2f d, sf::Color color) {
+    this->_vertices.append(sf::Vertex(a, color));
+    this->_vertices.append(sf::Vertex(b, color));
+    this->_vertices.append(sf::Vertex(c, color));
+    this->_vertices.append(sf::Vertex(a, color));
+    this->_vertices.append(sf::Vertex(c, color));
+    this->_vertices.append(sf::Vertex(d, color));
+}
+
+// void addRectangle
+// The outline is drawn outside of the rectangle, the same way sf::RectangleShape does it
+void l2d_internal::ShapeRenderer::addRectangle(sf::FloatRect rect, sf::Color fill, sf::Color outline, float outlineThickness) {
+    //Rectangles dragged up or left have a negative size
+    const float left = std::min(rect.left, rect.left + rect.width);
+    const float top = std::min(rect.top, rect.top + rect.height);
+    const float right = std::max(rect.left, rect.left + rect.width);
+    const float bottom = std::max(rect.top, rect.top + rect.height);
+    this->addQuad(sf::Vector2f(left, top), sf::Vector2f(right, top), sf::Vector2f(right, bottom), sf::Vector2f(left, bottom), fill);
+    if (outlineThickness > 0) {
+        const float t = outlineThickness;
+        this->addQuad(sf::Vector2f(left - t, top - t), sf::Vector2f(right + t, top - t), sf::Vector2f(right + t, top), sf::Vector2f(left - t, top), outline);
+        this->addQuad(sf::Vector2f(left - t, bottom), sf::Vector2f(right + t, bottom), sf::Vector2f(right + t, bottom + t), sf::Vector2f(left - t, bottom + t), outline);
+        this->addQuad(sf::Vector2f(left - t, top), sf::Vector2f(left, top), sf::Vector2f(left, bottom), sf::Vector2f(left - t, bottom), outline);
+        this->addQuad(sf::Vector2f(right, top), sf::Vector2f(right + t, top), sf::Vector2f(right + t, bottom), sf::Vector2f(right, bottom), outline);
+    }
+}
+
+void l2d_internal::ShapeRenderer::addCircle(sf::Vector2f center, float radius, unsigned int pointCount, sf::Color fill,
+                                            sf::Color outline, float outlineThickness) {
+    pointCount = std::max(3u, pointCount);
+    const float step = 2.0f * 3.141592654f / pointCount;
+    for (unsigned int i = 0; i < pointCount; ++i) {
+        const sf::Vector2f d1(std::cos(step * i), std::sin(step * i));
+        const sf::Vector2f d2(std::cos(step * (i + 1)), std::sin(step * (i + 1)));
+        this->_vertices.append(sf::Vertex(center, fill));
+        this->_vertices.append(sf::Vertex(center + d1 * radius, fill));
+        this->_vertices.append(sf::Vertex(center + d2 * radius, fill));
+        if (outlineThickness > 0) {
+            this->addQuad(center + d1 * radius, center + d1 * (radius + outlineThickness),
+                          center + d2 * (radius + outlineThickness), center + d2 * radius, outline);
+        }
+    }
+}
+
+void l2d_internal::ShapeRenderer::addSegment(sf::Vector2f start, sf::Vector2f end, float thickness, sf::Color color) {
+    const sf::Vector2f direction = end - start;
+    const float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+    if (length <= 0) {
+        return;
+    }
+    const sf::Vector2f offset = sf::Vector2f(-direction.y / length, direction.x / length) * (thickness / 2.0f);
+    this->addQuad(start + offset, end + offset, end - offset, start - offset, color);
+}
+
+void l2d_internal::ShapeRenderer::draw(l2d_internal::Graphics &graphics) {
+    if (this->_vertices.getVertexCount() > 0) {
+        graphics.draw(&this->_vertices[0], static_cast<unsigned int>(this->_vertices.getVertexCount()), sf::Triangles,
+                      sf::RenderStates::Default, Graphics::SHAPE_LAYER);
+    }
+}
+
 /*
  * LuaScript
  */
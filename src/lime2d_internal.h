@@ -17,9 +17,22 @@ extern "C" {
 
 #include <SFML/Graphics.hpp>
 #include <memory>
+#include <cstdint>
+#include <climits>
+#include <chrono>
+#include <ctime>
+#include <functional>
 #include <stack>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <tuple>
 #include <sstream>
 #include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "../libext/imgui.h"
 
 namespace l2d_internal {
@@ -28,6 +41,12 @@ namespace l2d_internal {
      * Forward declares
      */
     class Shape;
+    class Rectangle;
+    class Point;
+    class Line;
+    class ShapeRenderer;
+    class MapData;
+    class MapSaver;
 
     /*
      * Enumerations
@@ -78,6 +97,44 @@ namespace l2d_internal {
         };
     }
     
+    /*
+     * The internal Config class for Lime2D
+     * lime2d.config is parsed once into typed fields, so reading a setting is a plain member read.
+     * Keys without a typed field are kept as strings and can still be read with getValue.
+     * reloadIfChanged picks up edits made to the file outside of the editor.
+     */
+    class Config {
+    public:
+        static Config &get();
+        std::string MapPath;
+        std::string TilesetPath;
+        std::string SpritePath;
+        std::string AnimationPath;
+        sf::Vector2f SpriteScale;
+        sf::Vector2f TileScale;
+        sf::Vector2i ScreenSize;
+        float CameraPanFactor;
+        std::string TileTypes;
+        //In kilobytes
+        unsigned int UndoMemoryBudget;
+        //How tile layers are written to map files. One of the names MapData::getTileEncodingName returns
+        std::string MapEncoding;
+        std::string getValue(const std::string &key) const;
+        void load();
+        std::string save();
+        bool reloadIfChanged();
+        unsigned int getVersion() const;
+    private:
+        static const char* FILE_NAME;
+        std::map<std::string, std::string> _values;
+        std::time_t _lastWriteTime;
+        std::chrono::steady_clock::time_point _lastCheck;
+        unsigned int _version;
+
+        Config();
+        std::time_t getLastWriteTime() const;
+    };
+
     struct ConsoleItem {
     public:
         enum Type {
@@ -112,27 +169,88 @@ namespace l2d_internal {
         }
     };
 
+    /*
+     * Counters filled in while the level is drawn, used for profiling the renderer
+     */
+    struct RenderStats {
+    public:
+        unsigned int ChunksDrawn = 0;
+        unsigned int ChunksCulled = 0;
+        unsigned int TilesDrawn = 0;
+        unsigned int ChunksBaked = 0;
+        unsigned int SpritesDrawn = 0;
+        unsigned int SpritesCulled = 0;
+        unsigned int ShapesDrawn = 0;
+        unsigned int ShapesCulled = 0;
+        unsigned int DrawCalls = 0;
+        unsigned int StateChanges = 0;
+        void reset() {
+            *this = RenderStats();
+        }
+    };
+
+    /*
+     * What a single Graphics::flush did
+     */
+    struct FlushStats {
+    public:
+        unsigned int Commands = 0;
+        unsigned int DrawCalls = 0;
+        unsigned int StateChanges = 0;
+    };
+
     /*
      * The internal graphics class for Lime2D.
      * Handles the loading, storage, and drawing of all sprites, tiles, and effects
+     * Vertex draws are queued and sorted by layer, shader and texture, then submitted on flush.
+     * A draw with the same state as the last one queued for its layer, shader and texture is appended to it,
+     * so batches are built as draws come in. Drawing any other sf::Drawable flushes the queue first so scene order is kept.
+     * Vertex arrays that outlive the frame, like the tiles of a layer chunk, are queued with drawBuffer instead,
+     * which keeps a pointer to them rather than copying their vertices.
      */
     class Graphics {
     public:
+        static const int BACKGROUND_LAYER = -1000000;
+        static const int SHAPE_LAYER = 1000000;
+        static const int OVERLAY_LAYER = 2000000;
+
         Graphics(sf::RenderWindow* window);
         void draw(sf::Drawable &drawable, sf::Shader* ambientLight = nullptr);
-        void draw(const sf::Vertex* vertices, unsigned int vertexCount, sf::PrimitiveType type, const sf::RenderStates &states = sf::RenderStates::Default);
-        sf::Texture loadImage(const std::string &filePath);
+        void draw(const sf::Vertex* vertices, unsigned int vertexCount, sf::PrimitiveType type, const sf::RenderStates &states = sf::RenderStates::Default, int layer = 0);
+        void drawBuffer(const sf::VertexArray &vertices, const sf::RenderStates &states = sf::RenderStates::Default, int layer = 0);
+        FlushStats flush();
+        std::shared_ptr<sf::Texture> loadImage(const std::string &filePath);
         void setViewPosition(sf::Vector2f pos);
         void zoom(float n, sf::Vector2i pixel);
         void update(float elapsedTime, sf::Vector2f tileSize, bool windowHasFocus);
         sf::View getView() const;
+        sf::FloatRect getViewBounds() const;
+        RenderStats &getRenderStats();
         float getZoomPercentage() const;
         void setZoomPercentage(float zoomPercentage);
     private:
-        std::map<std::string, sf::Texture> _spriteSheets;
+        std::map<std::string, std::shared_ptr<sf::Texture>> _spriteSheets;
         sf::RenderWindow* _window;
         sf::View _view;
         float _zoomPercentage;
+        RenderStats _renderStats;
+
+        struct RenderCommand {
+            int Layer;
+            sf::RenderStates States;
+            sf::PrimitiveType Type;
+            std::vector<sf::Vertex> Vertices;
+            //Set instead of Vertices for a command queued with drawBuffer
+            const sf::VertexArray* Buffer;
+            //How many draws were appended to this command
+            unsigned int Draws;
+        };
+        //Commands are reused from frame to frame so their vertex arrays keep their memory. Only the first _commandCount are queued
+        std::vector<RenderCommand> _commands;
+        std::size_t _commandCount = 0;
+        std::vector<std::size_t> _order;
+        //The last command queued for each layer, shader and texture
+        std::map<std::tuple<int, const sf::Shader*, const sf::Texture*>, std::size_t> _lastCommands;
     };
 
     /*
@@ -149,7 +267,7 @@ namespace l2d_internal {
         virtual void update(float elapsedTime);
         virtual void draw(sf::Shader* ambientLight = nullptr);
     protected:
-        sf::Texture _texture;
+        std::shared_ptr<sf::Texture> _texture;
         sf::Sprite _sprite;
         std::shared_ptr<Graphics> _graphics;
     };
@@ -168,7 +286,7 @@ namespace l2d_internal {
         void updateAnimation(int frames, sf::Vector2i srcPos, std::string name, sf::Vector2i size, sf::Vector2i offset, float timeToUpdate);
         void removeAnimation(std::string name);
         void setVisible(bool visible);
-        sf::Sprite getSprite() const;
+        const sf::Sprite &getSprite() const;
     protected:
         float _timeToUpdate;
         bool _currentAnimationOnce;
@@ -193,8 +311,8 @@ namespace l2d_internal {
         Tile(std::shared_ptr<Graphics> graphics, std::string &filePath, sf::Vector2i srcPos, sf::Vector2i size, sf::Vector2f destPos, int tilesetId, int layer);
         Tile(const Tile& tile);
         virtual ~Tile();
-        sf::Sprite getSprite() const;
-        sf::Texture getTexture() const;
+        const sf::Sprite &getSprite() const;
+        const std::shared_ptr<sf::Texture> &getTexture() const;
         int getTilesetId() const;
         int getLayer() const;
         virtual void update(float elapsedTime);
@@ -216,30 +334,233 @@ namespace l2d_internal {
         Tileset(int id, std::string path, sf::Vector2i size);
     };
 
+    /*
+     * The internal TilesetAtlas class for Lime2D
+     * Packs every tileset used by a level into as few textures (pages) as possible so tiles from
+     * different tilesets can be batched together. Tilesets that do not fit keep their own texture.
+     */
+    class TilesetAtlas {
+    public:
+        TilesetAtlas();
+        void build(std::shared_ptr<Graphics> &graphics, const std::vector<Tileset> &tilesets);
+        void clear();
+        bool lookup(const sf::Texture* source, const sf::Texture* &page, sf::Vector2f &offset) const;
+        unsigned int getPageCount() const;
+        unsigned int getVersion() const;
+    private:
+        struct Entry {
+            unsigned int Page;
+            sf::Vector2f Offset;
+        };
+        std::vector<std::shared_ptr<sf::Texture>> _pages;
+        std::map<const sf::Texture*, Entry> _entries;
+        unsigned int _version;
+    };
+
+    /*
+     * A single cell of a layer: which tileset it comes from and which tile of that tileset it is.
+     * Tile numbers start at 1, the same as in the map file. Tile 0 means the cell is empty.
+     */
+    struct TileRecord {
+    public:
+        std::uint16_t Tileset = 0;
+        std::uint16_t Tile = 0;
+        bool isEmpty() const {
+            return Tile == 0;
+        }
+        bool operator==(const TileRecord &other) const {
+            return Tileset == other.Tileset && Tile == other.Tile;
+        }
+        bool operator!=(const TileRecord &other) const {
+            return !(*this == other);
+        }
+    };
+
+    /*
+     * The texture and number of columns of a tileset, used to turn tile records into vertices
+     */
+    struct TileSource {
+    public:
+        std::shared_ptr<sf::Texture> Texture;
+        int Columns = 0;
+    };
+
+    /*
+     * Every tileset a level's layers can draw from, keyed by tileset id.
+     * Version changes whenever anything in here does so layers know to rebuild their vertices.
+     */
+    struct TileSources {
+    public:
+        std::map<int, TileSource> Tilesets;
+        sf::Vector2i TileSize;
+        sf::Vector2f TileScale = sf::Vector2f(1.0f, 1.0f);
+        unsigned int Version = 0;
+    };
+
+    /*
+     * The internal PackedTiles class for Lime2D
+     * Holds the tiles of one chunk as a small palette of the distinct tile records it uses, plus one palette index
+     * per cell packed into 32-bit words. Palette entry 0 is always the empty tile.
+     * Indices start at 1 bit per cell and are widened (to 2, 4, 8 and then 16 bits) when the palette outgrows them.
+     * Palette entries no longer used by any cell are reused before the palette grows.
+     * Chunks are shared between a level and the snapshots it saves from, see makeUnique.
+     */
+    class PackedTiles {
+    public:
+        explicit PackedTiles(unsigned int cellCount = 0);
+        static PackedTiles &makeUnique(std::shared_ptr<PackedTiles> &tiles);
+        static std::shared_ptr<PackedTiles> fromPacked(unsigned int cellCount, unsigned int bits, std::vector<TileRecord> palette,
+                                                       std::vector<std::uint32_t> words);
+        TileRecord get(unsigned int cell) const;
+        void set(unsigned int cell, TileRecord tile);
+        unsigned int getIndex(unsigned int cell) const;
+        const std::vector<TileRecord> &getPalette() const;
+        unsigned int getTileCount() const;
+        unsigned int getBitsPerCell() const;
+        const std::vector<std::uint32_t> &getWords() const;
+    private:
+        static const unsigned int MAX_BITS = 16;
+        unsigned int _cellCount;
+        unsigned int _bits;
+        std::vector<TileRecord> _palette;
+        std::vector<unsigned int> _uses;
+        std::vector<std::uint32_t> _words;
+
+        void setIndex(unsigned int cell, unsigned int index);
+        void widen(unsigned int bits);
+    };
+
+    //The painted chunks of a layer, keyed by (chunk row, chunk column). Chunks without any tiles are left out.
+    //The chunks may be shared with a level, so they are only changed through PackedTiles::makeUnique
+    typedef std::map<std::pair<int, int>, std::shared_ptr<PackedTiles>> TileChunkMap;
+
+    /*
+     * The internal ChunkCache class for Lime2D
+     * Keeps track of every layer chunk of a level that is baked into a render texture, under one budget for all layers.
+     * The chunks are listed in the order they were last drawn, so the one to free is always at the front
+     * and chunks without a render texture are never visited.
+     */
+    class ChunkCache {
+    public:
+        //The most chunks of the whole level that keep a render texture around. When more chunks than this are
+        //on screen, the ones without a render texture are drawn from their vertices instead of being baked
+        static const unsigned int BUDGET = 64;
+        struct Entry {
+            //The render texture of the chunk, which is reset when the chunk is evicted
+            std::shared_ptr<sf::RenderTexture>* Texture;
+            unsigned int LastDrawn;
+        };
+        typedef std::list<Entry>::iterator Handle;
+        ChunkCache();
+        void beginFrame();
+        bool reserve();
+        Handle add(std::shared_ptr<sf::RenderTexture>* texture);
+        void touch(Handle handle);
+        void remove(Handle handle);
+        std::size_t getSize() const;
+        void clear();
+    private:
+        std::list<Entry> _entries;
+        unsigned int _frame;
+    };
+
     /*
      * The internal Layer class for Lime2D
+     * The layer is split into square chunks of CHUNK_SIZE x CHUNK_SIZE cells. A chunk only exists while it has at
+     * least one tile in it, so memory grows with the painted area instead of the size of the map.
+     * A chunk's tiles are palette compressed (see PackedTiles), which usually takes a few bits per cell.
+     * Each chunk also keeps one vertex array per tileset texture so it can be drawn in a single call per texture.
      */
     class Layer {
     public:
+        static const int CHUNK_SIZE = 32;
         int Id;
-        std::vector<std::shared_ptr<Tile>> Tiles;
-        Layer();
-        void draw(sf::Shader* ambientLight);
+        Layer(int id = 0, sf::Vector2i size = sf::Vector2i(0, 0));
+        Layer(const Layer &layer);
+        Layer &operator=(const Layer &layer) = delete;
+        ~Layer();
+        sf::Vector2i getSize() const;
+        void resize(sf::Vector2i size);
+        TileRecord getTile(int x, int y) const;
+        bool setTile(int x, int y, TileRecord tile);
+        bool isEmpty() const;
+        void forEachTile(const std::function<void(int x, int y, const TileRecord &tile)> &callback) const;
+        void forEachChunkIn(const sf::IntRect &area, const std::function<void(int x, int y, const PackedTiles &tiles)> &callback) const;
+        TileChunkMap getTileChunks() const;
+        void setTileChunks(const TileChunkMap &chunks);
+        void invalidateAll();
+        void invalidateCache();
+        void draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics, const TileSources &sources, const TilesetAtlas &atlas,
+                  ChunkCache* cache = nullptr);
+    private:
+        struct Chunk {
+            std::shared_ptr<PackedTiles> Tiles;
+            std::map<const sf::Texture*, sf::VertexArray> Batches;
+            bool Dirty = true;
+            //Only set while the chunk is in the cache, and reset by the cache when it is evicted
+            std::shared_ptr<sf::RenderTexture> Cache;
+            ChunkCache::Handle CacheEntry;
+            bool CacheDirty = true;
+        };
+        sf::Vector2i _size;
+        std::map<std::pair<int, int>, Chunk> _chunks;
+        bool _rebuildAll;
+        bool _hasDirtyChunks;
+        unsigned int _atlasVersion;
+        unsigned int _sourcesVersion;
+        //The cache the chunks were last baked into, which must outlive the layer
+        ChunkCache* _cache;
+
+        void rebuildChunks(const TileSources &sources, const TilesetAtlas &atlas);
+        void buildChunk(Chunk &chunk, int chunkX, int chunkY, const TileSources &sources, const TilesetAtlas &atlas);
+        void bakeChunk(Chunk &chunk, const sf::FloatRect &bounds, sf::Vector2u size, sf::Shader* ambientLight);
+        void releaseCache(Chunk &chunk);
+        void releaseCaches();
+
+        //Calls callback with every chunk in the chunk rows and columns of area, in row order.
+        //Chunks outside of the columns are skipped over instead of visited, so this costs about as much as the chunks found
+        template<class Chunks, class Callback>
+        static void visitChunks(Chunks &chunks, const sf::IntRect &area, Callback callback) {
+            const int lastRow = area.top + area.height - 1;
+            const int lastColumn = area.left + area.width - 1;
+            auto it = chunks.lower_bound(std::make_pair(area.top, area.left));
+            while (it != chunks.end() && it->first.first <= lastRow) {
+                if (it->first.second < area.left) {
+                    it = chunks.lower_bound(std::make_pair(it->first.first, area.left));
+                }
+                else if (it->first.second > lastColumn) {
+                    //Past the area on this row, skip ahead to the next one
+                    it = chunks.lower_bound(std::make_pair(it->first.first + 1, area.left));
+                }
+                else {
+                    callback(it++);
+                }
+            }
+        }
     };
     
     /*
      * The internal BackgroundLayer class
+     * Drawn as one quad covering the visible part of the level with the image repeated across it.
+     * A parallax factor of 1 keeps the image fixed to the level, 0 keeps it fixed to the camera.
      */
     class BackgroundLayer {
     public:
         BackgroundLayer();
-        BackgroundLayer(std::shared_ptr<Graphics> &graphics, sf::Vector2i size, const std::string &filePath, sf::Vector2i levelSize, sf::Vector2i tileSize);
-        std::string getPath() const;
+        BackgroundLayer(std::shared_ptr<Graphics> &graphics, const std::string &filePath, sf::Vector2i levelSize, sf::Vector2i tileSize,
+                        float scale = 1.25f, sf::Vector2f parallax = sf::Vector2f(1.0f, 1.0f));
+        const std::string &getPath() const;
+        float getScale() const;
+        sf::Vector2f getParallax() const;
+        void setLevelSize(sf::Vector2i levelSize, sf::Vector2i tileSize);
         void update(float elapsedTime);
-        void draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics);
+        void draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics, int layer);
     private:
-        std::vector<std::shared_ptr<l2d_internal::Sprite>> _sprites;
+        std::shared_ptr<sf::Texture> _texture;
         std::string _filePath;
+        sf::FloatRect _levelBounds;
+        float _scale;
+        sf::Vector2f _parallax;
     };
     
     /*
@@ -248,13 +569,215 @@ namespace l2d_internal {
     class Background {
     public:
         Background();
-        void addLayer(std::shared_ptr<Graphics> &graphics, sf::Vector2i size, const std::string &filePath, sf::Vector2i levelSize, sf::Vector2i tileSize);
-        std::map<int, l2d_internal::BackgroundLayer> getLayers() const;
+        void addLayer(std::shared_ptr<Graphics> &graphics, const std::string &filePath, sf::Vector2i levelSize, sf::Vector2i tileSize,
+                      float scale = 1.25f, sf::Vector2f parallax = sf::Vector2f(1.0f, 1.0f));
+        const std::map<int, l2d_internal::BackgroundLayer> &getLayers() const;
+        void setLevelSize(sf::Vector2i levelSize, sf::Vector2i tileSize);
+        void clear();
         void draw(sf::Shader* ambientLight, l2d_internal::Graphics &graphics);
     private:
         std::map<int, l2d_internal::BackgroundLayer> _layers;
     };
 
+    /*
+     * The internal ShapeRenderer class for Lime2D
+     * Collects many shapes into one triangle list so they can be drawn in one call
+     * Each shape's fill is added before its outline, so shapes stack the same way as drawing them one by one
+     */
+    class ShapeRenderer {
+    public:
+        ShapeRenderer();
+        void clear();
+        void addRectangle(sf::FloatRect rect, sf::Color fill, sf::Color outline, float outlineThickness);
+        void addCircle(sf::Vector2f center, float radius, unsigned int pointCount, sf::Color fill, sf::Color outline, float outlineThickness);
+        void addSegment(sf::Vector2f start, sf::Vector2f end, float thickness, sf::Color color);
+        void draw(l2d_internal::Graphics &graphics);
+        static sf::Color getSelectedColor(sf::Color color);
+    private:
+        sf::VertexArray _vertices;
+        void addQuad(sf::Vector2f a, sf::Vector2f b, sf::Vector2f c, sf::Vector2f d, sf::Color color);
+    };
+
+    /*
+     * The internal ShapeIndex class for Lime2D
+     * A uniform grid over the level that remembers which cells each shape's bounds touch, so point and
+     * rectangle queries only look at shapes near the area instead of every shape in the level.
+     * Shapes big enough to cover a lot of cells are kept in a separate list that every query checks.
+     * Query results are in the same back to front order as the level's shape list.
+     */
+    class ShapeIndex {
+    public:
+        explicit ShapeIndex(float cellSize = 256.0f);
+        void clear();
+        void insert(const std::shared_ptr<Shape> &shape);
+        void replace(const std::shared_ptr<Shape> &from, const std::shared_ptr<Shape> &to);
+        void update(const std::shared_ptr<Shape> &shape);
+        void remove(const std::shared_ptr<Shape> &shape);
+        bool contains(const std::shared_ptr<Shape> &shape) const;
+        void query(const sf::FloatRect &area, std::vector<std::shared_ptr<Shape>> &result) const;
+        std::shared_ptr<Shape> queryPoint(sf::Vector2f point) const;
+        std::size_t size() const;
+    private:
+        //Shapes covering more cells than this go in the large list instead of the grid
+        static const int MAX_CELLS_PER_SHAPE = 256;
+        struct Item {
+            std::shared_ptr<l2d_internal::Shape> Target;
+            sf::FloatRect Bounds;
+            unsigned long long Order;
+            sf::IntRect Cells;
+            bool Large;
+            mutable unsigned int QueryStamp;
+        };
+        float _cellSize;
+        unsigned long long _nextOrder;
+        mutable unsigned int _queryStamp;
+        std::unordered_map<const l2d_internal::Shape*, Item> _items;
+        std::unordered_map<long long, std::vector<const l2d_internal::Shape*>> _cells;
+        std::vector<const l2d_internal::Shape*> _large;
+
+        static long long getCellKey(int x, int y);
+        void link(Item &item);
+        void unlink(const Item &item);
+        void collect(const sf::FloatRect &area, std::vector<const Item*> &items) const;
+    };
+
+    /*
+     * The internal UndoJournal class for Lime2D
+     * Records what each edit changed instead of copying the map: single tile cells, shapes and the ambient light.
+     * Everything recorded between beginStroke and endStroke (one mouse press to its release) becomes one entry,
+     * and painting over the same cell twice in a stroke keeps only its first and last tile.
+     * Strokes don't nest: beginning a stroke while one is active ends the active one first.
+     * When the entries take more memory than the budget, the oldest ones are forgotten.
+     */
+    class UndoJournal {
+    public:
+        struct TileChange {
+            int Layer;
+            sf::Vector2i Cell;
+            TileRecord Before;
+            TileRecord After;
+        };
+        //Before is nullptr for an added shape, After is nullptr for a removed one.
+        //Both are copies that nothing else holds, so editing the shape in the level doesn't change them
+        struct ShapeChange {
+            std::shared_ptr<Shape> Before;
+            std::shared_ptr<Shape> After;
+        };
+        struct Entry {
+            std::vector<TileChange> Tiles;
+            std::vector<ShapeChange> Shapes;
+            bool AmbientChanged = false;
+            sf::Color AmbientColorBefore;
+            sf::Color AmbientColorAfter;
+            float AmbientIntensityBefore = 1.0f;
+            float AmbientIntensityAfter = 1.0f;
+            bool isEmpty() const;
+            std::size_t getMemoryUsage() const;
+        };
+        explicit UndoJournal(std::size_t budget = 16 * 1024 * 1024);
+        void beginStroke();
+        void endStroke();
+        void recordTile(int layer, sf::Vector2i cell, TileRecord before, TileRecord after);
+        void recordShape(std::shared_ptr<Shape> before, std::shared_ptr<Shape> after);
+        void recordAmbient(sf::Color colorBefore, float intensityBefore, sf::Color colorAfter, float intensityAfter);
+        const Entry* undo();
+        const Entry* redo();
+        void forEachTileChange(const std::function<void(const TileChange &change)> &callback) const;
+        bool canUndo() const;
+        bool canRedo() const;
+        void clear();
+        void setBudget(std::size_t budget);
+        std::size_t getMemoryUsage() const;
+    private:
+        std::deque<Entry> _undo;
+        std::deque<Entry> _redo;
+        std::size_t _budget;
+        bool _strokeActive;
+        bool _strokeOpen;
+        //Where each cell painted during the current stroke is in the stroke's entry
+        std::map<std::tuple<int, int, int>, std::size_t> _strokeCells;
+
+        Entry &getOpenEntry();
+        void closeEntry();
+        void enforceBudget();
+    };
+
+    /*
+     * The internal ShapePool class for Lime2D
+     * Hands out fixed size blocks carved from large slabs, with a slot of its own for each type of shape, so the
+     * shapes of a level sit next to each other in memory instead of being scattered over the heap.
+     * When nothing allocated from it is alive anymore, reset rewinds every slab at once for the next map.
+     */
+    class ShapePool {
+    public:
+        ShapePool();
+        template<class T>
+        static DrawShapes getShapeType();
+        void* allocate(DrawShapes shapeType, std::size_t size);
+        void deallocate(DrawShapes shapeType, void* p, std::size_t size);
+        void reset();
+        std::size_t getLiveCount() const;
+        std::size_t getReservedBytes() const;
+    private:
+        static const std::size_t BLOCKS_PER_SLAB = 256;
+        static const std::size_t SLOT_COUNT = 3;
+        struct Slot {
+            std::vector<std::unique_ptr<char[]>> Slabs;
+            std::vector<void*> FreeBlocks;
+            std::size_t BlockSize = 0;
+            std::size_t NextSlab = 0;
+            std::size_t NextBlock = 0;
+        };
+        Slot _slots[SLOT_COUNT];
+        std::size_t _liveCount;
+
+        static std::size_t getBlockSize(std::size_t size);
+        Slot &getSlot(DrawShapes shapeType);
+    };
+
+    template<>
+    inline DrawShapes ShapePool::getShapeType<Rectangle>() {
+        return DrawShapes::Rectangle;
+    }
+    template<>
+    inline DrawShapes ShapePool::getShapeType<Point>() {
+        return DrawShapes::Point;
+    }
+    template<>
+    inline DrawShapes ShapePool::getShapeType<Line>() {
+        return DrawShapes::Line;
+    }
+
+    /*
+     * Allocator that takes its memory from a ShapePool, for use with std::allocate_shared.
+     * The pool is shared so it stays alive for as long as any shape allocated from it does.
+     * ShapeType picks the pool's slot, and is kept when std::allocate_shared rebinds the allocator to its control block.
+     */
+    template<class T>
+    class PoolAllocator {
+    public:
+        typedef T value_type;
+        PoolAllocator(std::shared_ptr<ShapePool> pool, DrawShapes shapeType) : Pool(pool), ShapeType(shapeType) {}
+        template<class U>
+        PoolAllocator(const PoolAllocator<U> &other) : Pool(other.Pool), ShapeType(other.ShapeType) {}
+        T* allocate(std::size_t n) {
+            return static_cast<T*>(this->Pool->allocate(this->ShapeType, n * sizeof(T)));
+        }
+        void deallocate(T* p, std::size_t n) {
+            this->Pool->deallocate(this->ShapeType, p, n * sizeof(T));
+        }
+        template<class U>
+        bool operator==(const PoolAllocator<U> &other) const {
+            return this->Pool == other.Pool && this->ShapeType == other.ShapeType;
+        }
+        template<class U>
+        bool operator!=(const PoolAllocator<U> &other) const {
+            return !(*this == other);
+        }
+        std::shared_ptr<ShapePool> Pool;
+        DrawShapes ShapeType;
+    };
+
     /*
      * The internal Level class for Lime2D
      */
@@ -265,6 +788,9 @@ namespace l2d_internal {
         void createMap(std::string name, sf::Vector2i size, sf::Vector2i tileSize);
         std::string loadMap(std::string &name);
         void saveMap(std::string name);
+        bool isSaving() const;
+        float getSaveProgress() const;
+        bool takeSaveResult(std::string &error);
         void draw(sf::Shader* ambientLight);
         void update(float elapsedTime);
         std::string getName() const;
@@ -276,37 +802,111 @@ namespace l2d_internal {
         sf::Color getAmbientColor() const;
         void setAmbientIntensity(float intensity);
         void setAmbientColor(sf::Color color);
-        std::vector<Tileset> getTilesetList();
-        std::vector<std::shared_ptr<Layer>> getLayerList();
+        bool isChunkCacheEnabled() const;
+        void setChunkCacheEnabled(bool enabled);
+        const std::vector<Tileset> &getTilesetList() const;
+        const std::vector<std::shared_ptr<Layer>> &getLayerList() const;
         void addShape(std::shared_ptr<l2d_internal::Shape> shape);
-        std::vector<std::shared_ptr<l2d_internal::Shape>> getShapeList();
+        const std::vector<std::shared_ptr<l2d_internal::Shape>> &getShapeList() const;
+        template<class T, class... Args>
+        std::shared_ptr<T> makeShape(Args&&... args) {
+            return std::allocate_shared<T>(PoolAllocator<T>(this->_shapePool, ShapePool::getShapeType<T>()), std::forward<Args>(args)...);
+        }
+        std::shared_ptr<l2d_internal::Shape> getShape(int id) const;
+        std::vector<std::shared_ptr<l2d_internal::Shape>> getShapesInArea(const sf::FloatRect &area) const;
+        std::shared_ptr<l2d_internal::Shape> getShapeAt(sf::Vector2f point) const;
+        std::shared_ptr<l2d_internal::Shape> copyShape(std::shared_ptr<l2d_internal::Shape> shape);
+        void refreshShape(std::shared_ptr<l2d_internal::Shape> shape);
+        void refreshShapes();
+        void drawShapes();
+        std::string getTileType(sf::Vector2i pos) const;
+        bool setTileType(sf::Vector2i pos, const std::string &name);
+        void drawTileTypes(const std::vector<l2d_internal::TileType> &types);
         void removeTile(int layer, sf::Vector2f pos, bool fromResize = false);
         void updateTile(std::string newTilesetPath, sf::Vector2i newTilesetSize, sf::Vector2i srcPos, sf::Vector2f destPos, int tilesetId, int layer);
         void updateShape(std::shared_ptr<l2d_internal::Shape> oldShape, std::shared_ptr<l2d_internal::Shape> newShape);
+        void updateShape(int id, std::shared_ptr<l2d_internal::Shape> newShape);
         void removeShape(std::shared_ptr<l2d_internal::Shape> shape);
+        void removeShape(int id);
         bool tileExists(int layer, sf::Vector2i pos) const;
         int getTilesetID(const std::string &path) const;
         void undo();
         bool isUndoListEmpty() const;
         void redo();
         bool isRedoListEmpty() const;
+        void beginEdit();
+        void endEdit();
+        void beginShapeEdit(std::shared_ptr<l2d_internal::Shape> shape);
         sf::Vector2i globalToLocalCoordinates(sf::Vector2f coords) const;
         bool isLoaded() const;
         l2d_internal::Background &getBackground();
     private:
+        //The layer the journal records tile type changes under, which no tile layer can have
+        static const int TILE_TYPE_LAYER = INT_MIN;
+
         std::string _name;
         bool _loaded;
         sf::Vector2i _size;
         sf::Vector2i _tileSize;
+        l2d_internal::TileSources _tileSources;
         std::vector<Tileset> _tilesetList;
+        //Declared before the layers, since they give their render textures back to it when destroyed
+        l2d_internal::ChunkCache _chunkCache;
         std::vector<std::shared_ptr<Layer>> _layerList;
         std::vector<std::shared_ptr<l2d_internal::Shape>> _shapeList;
+        std::unordered_map<int, std::size_t> _shapeHandles;
+        int _nextShapeId = 1;
+        std::shared_ptr<l2d_internal::ShapePool> _shapePool;
+        std::shared_ptr<l2d_internal::MapSaver> _saver;
         std::shared_ptr<Graphics> _graphics;
-        std::stack<std::vector<std::shared_ptr<Layer>>> _oldLayerList;
-        std::stack<std::vector<std::shared_ptr<Layer>>> _redoList;
+        l2d_internal::UndoJournal _journal;
+        //How the shapes passed to beginShapeEdit were before the current edit
+        std::vector<std::shared_ptr<l2d_internal::Shape>> _shapeEdits;
+        l2d_internal::ShapeIndex _shapeIndex;
         float _ambientIntensity = 1.0f;
         sf::Color _ambientColor = sf::Color::White;
+        bool _chunkCacheEnabled = false;
         l2d_internal::Background _background;
+        l2d_internal::ShapeRenderer _shapeRenderer;
+        l2d_internal::TilesetAtlas _atlas;
+        //A layer that is never drawn, so tile types are stored in sparse chunks the same way as tiles.
+        //The tile of a cell is the index of its type in _tileTypeNames, and an empty cell has no type
+        l2d_internal::Layer _tileTypes;
+        std::vector<std::string> _tileTypeNames;
+        l2d_internal::ShapeRenderer _tileTypeRenderer;
+
+        std::shared_ptr<Layer> getLayer(int id) const;
+        l2d_internal::Layer* getEditedLayer(int id, bool create);
+        void rebuildTileSources();
+        std::shared_ptr<l2d_internal::Shape> getOwningShape(std::shared_ptr<l2d_internal::Shape> shape) const;
+        void recordShapeEdits();
+        void replaceShape(std::shared_ptr<l2d_internal::Shape> from, std::shared_ptr<l2d_internal::Shape> to);
+        void insertShape(std::shared_ptr<l2d_internal::Shape> shape);
+        void eraseShape(int id);
+        void assignShapeIds();
+        void clearShapes();
+        void applyMapData(const l2d_internal::MapData &data);
+        void fillMapData(l2d_internal::MapData &data) const;
+        void applyAmbient(sf::Color color, float intensity);
+    };
+
+    /*
+     * The internal MapRasterizer class for Lime2D
+     * Renders a saved map into an sf::Image entirely on the CPU, so it works without a window or a GPU.
+     * Backgrounds, tile layers and the ambient light are composited the same way the editor draws them.
+     */
+    class MapRasterizer {
+    public:
+        MapRasterizer();
+        std::string rasterize(const std::string &mapName, sf::Image &image, float scale = 1.0f);
+        std::string exportMap(const std::string &mapName, const std::string &outputPath, float scale = 1.0f);
+    private:
+        //The largest image rasterize makes, per side and in total (1 GB of pixels)
+        static const unsigned int MAX_IMAGE_SIZE = 32768;
+        static const std::size_t MAX_IMAGE_PIXELS = 256 * 1024 * 1024;
+        std::map<std::string, sf::Image> _images;
+        const sf::Image* loadImage(const std::string &filePath);
+        static void blendRow(sf::Uint8* dest, const sf::Uint8* src, unsigned int count, const unsigned int tint[3]);
     };
 
     struct CustomProperty {
@@ -324,6 +924,189 @@ namespace l2d_internal {
         char Value[100];
     };
 
+    /*
+     * The internal MappedFile class for Lime2D
+     * Maps a whole file into memory read-only (mmap, or a file mapping on Windows) so it can be read in place.
+     */
+    class MappedFile {
+    public:
+        MappedFile();
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        bool open(const std::string &filePath);
+        void close();
+        const char* getData() const;
+        std::size_t getSize() const;
+    private:
+        const char* _data;
+        std::size_t _size;
+#ifdef _WIN32
+        void* _file;
+        void* _mapping;
+#else
+        int _file;
+#endif
+    };
+
+    /*
+     * The internal XmlPullParser class for Lime2D
+     * Reads XML straight out of a block of memory one element at a time, without building a document.
+     * Names, attribute values and text are pointers into the memory, so nothing is copied until asked for.
+     * A self closing element is reported as a start followed by an end.
+     */
+    class XmlPullParser {
+    public:
+        enum class Event {
+            StartElement, EndElement, Text, End, Error
+        };
+        XmlPullParser(const char* data, std::size_t size);
+        Event next();
+        bool isElement(const char* name) const;
+        bool getAttribute(const char* name, int &value) const;
+        bool getAttribute(const char* name, unsigned int &value) const;
+        bool getAttribute(const char* name, float &value) const;
+        bool getAttribute(const char* name, std::string &value) const;
+        bool getTextInt(int &value) const;
+        std::string getText() const;
+        const std::string &getError() const;
+    private:
+        struct Span {
+            const char* Begin;
+            const char* End;
+        };
+        struct Attribute {
+            Span Name;
+            Span Value;
+        };
+        const char* _pos;
+        const char* _end;
+        Span _name;
+        Span _text;
+        bool _rawText;
+        bool _pendingEnd;
+        std::vector<Attribute> _attributes;
+        std::string _error;
+
+        Event fail(const std::string &error);
+        const char* find(const char* pattern) const;
+        const Span* findAttribute(const char* name) const;
+        static bool parseInteger(Span span, long long &value);
+        static std::string decode(Span span);
+    };
+
+    /*
+     * The internal MapData class for Lime2D
+     * Everything a map file holds, as plain data and without any textures, so maps can be read, written and
+     * converted without a window. Level fills itself from one of these and hands one back when it saves.
+     * Maps are stored as XML (.xml) or in the binary format (.l2dm). The binary format is a header and a
+     * table of sections, each a flat run of little endian values, and is read straight out of a mapped file.
+     */
+    class MapData {
+    public:
+        //How the tiles of each layer are written in the XML format. Verbose writes an element per tile,
+        //the others write one data element per layer with a chunk element per painted chunk holding a tile id per cell
+        enum class TileEncoding {
+            Verbose, Csv, Base64, Base64Zlib
+        };
+        struct BackgroundEntry {
+            int Id;
+            std::string Path;
+            float Scale;
+            sf::Vector2f Parallax;
+        };
+        struct LayerEntry {
+            int Id;
+            //Chunks are Layer::CHUNK_SIZE cells square, the same as the level's layers
+            TileChunkMap Chunks;
+        };
+        struct ShapeEntry {
+            DrawShapes Kind = DrawShapes::None;
+            int Id = 0;
+            std::string Name;
+            sf::Uint32 Color = 0;
+            int ObjectType = 0;
+            sf::Vector2f Position;
+            sf::Vector2f Size;
+            std::vector<CustomProperty> Properties;
+            //The points of a line
+            std::vector<ShapeEntry> Points;
+        };
+
+        static const std::uint32_t BINARY_VERSION = 3;
+        static const char* BINARY_EXTENSION;
+
+        std::string Name;
+        sf::Vector2i Size;
+        sf::Vector2i TileSize;
+        std::vector<Tileset> Tilesets;
+        std::vector<BackgroundEntry> Backgrounds;
+        std::vector<LayerEntry> Layers;
+        //Entry 0 is always the empty name. TileTypes holds the painted cells in chunks like a layer does,
+        //with the index of the cell's name as the tile
+        std::vector<std::string> TileTypeNames;
+        TileChunkMap TileTypes;
+        bool HasAmbientLight = false;
+        sf::Uint32 AmbientColor = 0xFFFFFFFF;
+        float AmbientIntensity = 1.0f;
+        std::vector<ShapeEntry> Shapes;
+        TileEncoding Encoding = TileEncoding::Verbose;
+
+        MapData();
+        std::string load(const std::string &filePath);
+        std::string save(const std::string &filePath) const;
+        std::string loadXml(const std::string &filePath);
+        std::string saveXml(const std::string &filePath, const std::function<void(float)> &progress = nullptr) const;
+        std::string loadBinary(const std::string &filePath);
+        std::string saveBinary(const std::string &filePath) const;
+        LayerEntry &getLayer(int id);
+        void setTile(TileChunkMap &chunks, int x, int y, TileRecord tile) const;
+        sf::IntRect getChunkArea(std::pair<int, int> chunk) const;
+        static std::string getMapFilePath(const std::string &mapName);
+        static bool isBinaryPath(const std::string &filePath);
+        static TileEncoding getTileEncoding(const std::string &name);
+        static const char* getTileEncodingName(TileEncoding encoding);
+    private:
+        void encodeRuns(const std::function<void(const std::string&)> &write) const;
+        void decodeRuns(const char* text);
+        static std::string encodeChunk(const PackedTiles &tiles, sf::Vector2i size, TileEncoding encoding);
+        std::string decodeTiles(const std::string &text, TileEncoding encoding, LayerEntry &layer, sf::IntRect area) const;
+    };
+
+    /*
+     * The internal MapSaver class for Lime2D
+     * Writes map snapshots on a worker thread, so the editor keeps running while a map saves.
+     * A save asked for while another is being written waits its turn. Waiting saves of the same file are merged,
+     * so only the newest snapshot of each map is written.
+     */
+    class MapSaver {
+    public:
+        MapSaver();
+        ~MapSaver();
+        void save(MapData data, const std::string &xmlPath, const std::string &binaryPath);
+        void wait();
+        bool isSaving() const;
+        float getProgress() const;
+        bool takeResult(std::string &error);
+    private:
+        struct Job {
+            MapData Data;
+            std::string XmlPath;
+            //Empty if no binary file is written
+            std::string BinaryPath;
+        };
+        std::thread _thread;
+        mutable std::mutex _mutex;
+        std::condition_variable _idle;
+        std::deque<std::unique_ptr<Job>> _pending;
+        bool _running;
+        //How each finished save went, oldest first
+        std::deque<std::string> _results;
+        std::atomic<float> _progress;
+
+        void run();
+    };
+
     /*
      * The internal Shape class for Lime2D
      */
@@ -331,11 +1114,13 @@ namespace l2d_internal {
     public:
         Shape(std::string name, sf::Color color);
         std::string getName();
+        int getId() const;
+        void setId(int id);
 
         virtual sf::Color getColor() const;
         void setName(std::string name);
         virtual void setColor(sf::Color color);
-        std::vector<l2d_internal::CustomProperty> getCustomProperties();
+        const std::vector<l2d_internal::CustomProperty> &getCustomProperties() const;
         void addCustomProperty(std::string name, std::string value);
         void removeCustomProperty(int id);
         void setCustomProperties(std::vector<l2d_internal::CustomProperty> &others);
@@ -347,8 +1132,12 @@ namespace l2d_internal {
         virtual void setPosition(sf::Vector2f pos) = 0;
         virtual void setSize(sf::Vector2f size) = 0;
         virtual void draw(sf::RenderWindow* window) = 0;
+        virtual void addToBatch(ShapeRenderer &renderer) = 0;
+        virtual sf::FloatRect getBounds() = 0;
         virtual bool equals(std::shared_ptr<Shape> other) = 0;
+        bool isSelected() const;
     protected:
+        int _id = 0;
         std::string _name;
         sf::Color _color = sf::Color::White;
         bool _selected;
@@ -363,7 +1152,7 @@ namespace l2d_internal {
     class Point : public Shape {
     public:
         Point(std::string name, sf::Color color, sf::CircleShape dot);
-        sf::CircleShape getCircle();
+        const sf::CircleShape &getCircle() const;
         virtual sf::Color getColor() const override;
         virtual void setColor(sf::Color color) override;
         virtual void fixPosition(sf::Vector2i levelSize, sf::Vector2i tileSize, sf::Vector2f tileScale) override;
@@ -373,6 +1162,8 @@ namespace l2d_internal {
         virtual void setPosition(sf::Vector2f pos) override;
         virtual void setSize(sf::Vector2f size) override;
         virtual void draw(sf::RenderWindow* window) override;
+        virtual void addToBatch(ShapeRenderer &renderer) override;
+        virtual sf::FloatRect getBounds() override;
         virtual bool equals(std::shared_ptr<Shape> other) override;
     private:
         sf::CircleShape _dot;
@@ -385,7 +1176,7 @@ namespace l2d_internal {
     class Line : public Shape {
     public:
         Line(std::string name, sf::Color color, std::vector<std::shared_ptr<l2d_internal::Point>> points);
-        std::vector<std::shared_ptr<l2d_internal::Point>> getPoints();
+        const std::vector<std::shared_ptr<l2d_internal::Point>> &getPoints() const;
         std::shared_ptr<Point> getSelectedPoint(sf::Vector2f mousePos);
         void deletePoint(std::shared_ptr<l2d_internal::Point> p);
         virtual sf::Color getColor() const override;
@@ -397,6 +1188,8 @@ namespace l2d_internal {
         virtual void setPosition(sf::Vector2f pos) override;
         virtual void setSize(sf::Vector2f size) override;
         virtual void draw(sf::RenderWindow* window) override;
+        virtual void addToBatch(ShapeRenderer &renderer) override;
+        virtual sf::FloatRect getBounds() override;
         virtual bool equals(std::shared_ptr<Shape> other) override;
     private:
         std::vector<std::shared_ptr<l2d_internal::Point>> _points;
@@ -409,7 +1202,7 @@ namespace l2d_internal {
     class Rectangle : public Shape {
     public:
         Rectangle(std::string name, sf::Color color, l2d_internal::ObjectTypes objectType, sf::RectangleShape rect);
-        sf::RectangleShape getRectangle();
+        const sf::RectangleShape &getRectangle() const;
         virtual sf::Color getColor() const override;
         virtual void setColor(sf::Color color) override;
         virtual void fixPosition(sf::Vector2i levelSize, sf::Vector2i tileSize, sf::Vector2f tileScale) override;
@@ -421,6 +1214,8 @@ namespace l2d_internal {
         virtual void setPosition(sf::Vector2f pos) override;
         virtual void setSize(sf::Vector2f size) override;
         virtual void draw(sf::RenderWindow* window) override;
+        virtual void addToBatch(ShapeRenderer &renderer) override;
+        virtual sf::FloatRect getBounds() override;
         virtual bool equals(std::shared_ptr<Shape> other) override;
     private:
         sf::RectangleShape _rect;
@@ -6,13 +6,51 @@
  */
 
 #include <iostream>
+#include <string>
+#include <cstdlib>
 #include <SFML/Graphics.hpp>
 
 #include "lime2d.h"
 
 using namespace std;
 
-int main() {
+int main(int argc, char* argv[]) {
+    //Headless export: Lime2D --export-map <map name> <output.png> [scale]
+    if (argc >= 4 && std::string(argv[1]) == "--export-map") {
+        float scale = 1.0f;
+        if (argc >= 5) {
+            char* end = nullptr;
+            scale = std::strtof(argv[4], &end);
+            if (end == argv[4] || *end != '\0' || !(scale > 0.0f)) {
+                cerr << "Usage: Lime2D --export-map <map name> <output.png> [scale]" << endl;
+                cerr << "The scale must be a number greater than 0." << endl;
+                return 1;
+            }
+        }
+        l2d_internal::MapRasterizer rasterizer;
+        std::string error = rasterizer.exportMap(argv[2], argv[3], scale);
+        if (!error.empty()) {
+            cerr << error << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    //Map conversion: Lime2D --convert-map <input file> <output file>
+    //The format of each file follows from its extension (.xml or .l2dm)
+    if (argc >= 4 && std::string(argv[1]) == "--convert-map") {
+        l2d_internal::MapData map;
+        std::string error = map.load(argv[2]);
+        if (error.empty()) {
+            error = map.save(argv[3]);
+        }
+        if (!error.empty()) {
+            cerr << error << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     sf::RenderWindow window(sf::VideoMode(800, 600), "Lime2D", sf::Style::Titlebar | sf::Style::Close);
     sf::Image img;
     img.loadFromFile("content/sprites/mstile-310x310.png");